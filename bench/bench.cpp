@@ -0,0 +1,355 @@
+// BedrockMap 渲染管线的微基准测试
+// 用法: bedrockmap_bench [--world <存档根目录>] [--regions N] [--iterations N] [--out result.json]
+// 不指定存档时只运行不依赖区块数据的项目，结果以JSON输出，方便在不同提交之间对比
+
+#include <QCoreApplication>
+#include <QtDebug>
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "asynclevelloader.h"
+#include "config.h"
+#include "json/json.hpp"
+#include "keyutils.h"
+#include "nbtreader.h"
+#include "palette.h"
+#include "renderfilterdialog.h"
+#include "resourcemanager.h"
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::string world;
+        std::string out;
+        int regions{16};
+        int iterations{50};
+    };
+
+    bool parseOptions(int argc, char *argv[], Options &opt) {
+        for (int i = 1; i < argc; i++) {
+            const std::string arg = argv[i];
+            if (i + 1 >= argc) return false;
+            if (arg == "--world") {
+                opt.world = argv[++i];
+            } else if (arg == "--out") {
+                opt.out = argv[++i];
+            } else if (arg == "--regions") {
+                opt.regions = std::max(1, std::atoi(argv[++i]));
+            } else if (arg == "--iterations") {
+                opt.iterations = std::max(1, std::atoi(argv[++i]));
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <typename F>
+    int64_t timeIt(F &&f) {
+        auto begin = Clock::now();
+        f();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count();
+    }
+
+    class BenchRunner {
+       public:
+        explicit BenchRunner(int iterations) : iterations_(iterations) {}
+
+        /**
+         * 运行一个测试项目
+         * @param fn 参数是第几次迭代，返回本次被测部分的耗时(纳秒)，准备工作不计入
+         */
+        void run(const std::string &name, const std::function<int64_t(int)> &fn) {
+            fn(0);  // 预热
+            std::vector<int64_t> samples;
+            samples.reserve(this->iterations_);
+            for (int i = 0; i < this->iterations_; i++) samples.push_back(fn(i));
+            std::sort(samples.begin(), samples.end());
+            double sum = 0;
+            for (auto s : samples) sum += static_cast<double>(s);
+            auto at = [&samples](double q) {
+                return static_cast<double>(samples[std::min(samples.size() - 1, static_cast<size_t>(q * samples.size()))]) / 1000.0;
+            };
+            nlohmann::json r;
+            r["name"] = name;
+            r["iterations"] = samples.size();
+            r["min_us"] = static_cast<double>(samples.front()) / 1000.0;
+            r["median_us"] = at(0.5);
+            r["p90_us"] = at(0.9);
+            r["mean_us"] = sum / static_cast<double>(samples.size()) / 1000.0;
+            qInfo() << name.c_str() << ": median" << r["median_us"].get<double>() << "us";
+            this->results_.push_back(r);
+        }
+
+        void skip(const std::string &name, const std::string &reason) { this->skipped_.push_back({{"name", name}, {"reason", reason}}); }
+
+        nlohmann::json toJson() const { return {{"results", this->results_}, {"skipped", this->skipped_}}; }
+
+       private:
+        int iterations_;
+        nlohmann::json results_ = nlohmann::json::array();
+        nlohmann::json skipped_ = nlohmann::json::array();
+    };
+
+    // 手写一段基岩版格式(小端)的NBT，用于没有存档时的解析测试
+    class NbtWriter {
+       public:
+        void begin(uint8_t type, const std::string &name) {
+            this->out_.push_back(static_cast<char>(type));
+            this->u16(static_cast<uint16_t>(name.size()));
+            this->out_ += name;
+        }
+
+        void u8(uint8_t v) { this->out_.push_back(static_cast<char>(v)); }
+
+        void u16(uint16_t v) { this->raw(&v, 2); }
+
+        void i32(int32_t v) { this->raw(&v, 4); }
+
+        void str(const std::string &s) {
+            this->u16(static_cast<uint16_t>(s.size()));
+            this->out_ += s;
+        }
+
+        void end() { this->u8(0); }
+
+        std::string &data() { return this->out_; }
+
+       private:
+        void raw(const void *p, size_t n) { this->out_.append(static_cast<const char *>(p), n); }
+
+        std::string out_;
+    };
+
+    // 一个装满物品的箱子
+    std::string syntheticChestNbt(int x, int y, int z) {
+        NbtWriter w;
+        w.begin(10, "");
+        w.begin(8, "id");
+        w.str("Chest");
+        w.begin(3, "x");
+        w.i32(x);
+        w.begin(3, "y");
+        w.i32(y);
+        w.begin(3, "z");
+        w.i32(z);
+        w.begin(1, "isMovable");
+        w.u8(1);
+        w.begin(9, "Items");
+        w.u8(10);
+        w.i32(27);
+        for (int i = 0; i < 27; i++) {
+            w.begin(1, "Count");
+            w.u8(static_cast<uint8_t>(1 + i % 64));
+            w.begin(2, "Damage");
+            w.u16(0);
+            w.begin(8, "Name");
+            w.str(i % 2 ? "minecraft:cobblestone" : "minecraft:oak_log");
+            w.begin(1, "Slot");
+            w.u8(static_cast<uint8_t>(i));
+            w.begin(1, "WasPickedUp");
+            w.u8(0);
+            w.end();
+        }
+        w.end();
+        return w.data();
+    }
+
+    void fillSyntheticHeights(ChunkRegion *region) {
+        const int W = cfg::RW << 4;
+        for (int i = 0; i < W; i++) {
+            for (int j = 0; j < W; j++) {
+                region->tips_info_[i][j].height = static_cast<int16_t>(64 + 12 * std::sin(i * 0.11) + 9 * std::cos(j * 0.07 + i * 0.03));
+            }
+        }
+    }
+
+    void benchNbt(BenchRunner &runner, const std::string &prefix, const std::string &raw) {
+        runner.run(prefix + "_parse", [&raw](int) {
+            std::vector<bl::palette::compound_tag *> tags;
+            auto t = timeIt([&]() { tags = bl::palette::read_palette_to_end(raw.data(), raw.size()); });
+            for (auto *tag : tags) delete tag;
+            return t;
+        });
+
+        // 同样的数据只读取id和物品名，不构建树
+        runner.run(prefix + "_project", [&raw](int) {
+            NbtProjection projection;
+            projection.add("id");
+            projection.add("Items[].Name");
+            size_t hits = 0;
+            auto t = timeIt([&]() {
+                NbtReader reader(raw);
+                while (!reader.atEnd()) {
+                    if (!reader.project(projection, [&hits](int, const NbtValue &) { hits++; })) break;
+                }
+            });
+            return t;
+        });
+
+        auto tags = bl::palette::read_palette_to_end(raw.data(), raw.size());
+        runner.run(prefix + "_serialize", [&tags](int) {
+            std::string out;
+            return timeIt([&]() {
+                for (auto *tag : tags) out += tag->to_raw();
+            });
+        });
+        for (auto *tag : tags) delete tag;
+    }
+
+    void benchSynthetic(BenchRunner &runner) {
+        std::bitset<cfg::RW * cfg::RW> bitmap;
+        bitmap.set();
+        runner.run("create_region_img", [&bitmap](int) { return timeIt([&]() { cfg::CREATE_REGION_IMG(bitmap); }); });
+
+        AsyncLevelLoader loader;
+        // 每次换一个区域，避免直接命中缓存
+        runner.run("baked_slime_chunk_image", [&loader](int i) {
+            static int next = 0;
+            region_pos rp{(next++) * cfg::RW, i * cfg::RW, 0};
+            return timeIt([&]() { loader.bakedSlimeChunkImage(rp); });
+        });
+
+        for (int style = 1; style <= 2; style++) {
+            std::unique_ptr<ChunkRegion> region(new ChunkRegion());
+            region->chunk_bit_map_ = bitmap;
+            region->valid = true;
+            fillSyntheticHeights(region.get());
+            runner.run("shade_style_" + std::to_string(style), [&region, &bitmap, style](int) {
+                region->terrain_bake_image_ = cfg::CREATE_REGION_IMG(bitmap);
+                region->biome_bake_image_ = cfg::CREATE_REGION_IMG(bitmap);
+                return timeIt([&]() { LoadRegionTask::shadeRegion(region.get(), style); });
+            });
+        }
+
+        std::string raw;
+        for (int i = 0; i < 64; i++) raw += syntheticChestNbt(i, 64, -i);
+        benchNbt(runner, "nbt_synthetic", raw);
+    }
+
+    /**
+     * 收集存档里有数据的区域，以及一些方块实体的原始NBT
+     */
+    std::vector<region_pos> sampleRegions(bl::bedrock_level &level, size_t count, std::string &block_entities) {
+        std::set<region_pos> regions;
+        std::unique_ptr<leveldb::Iterator> it(level.db()->NewIterator(leveldb::ReadOptions()));
+        bl::chunk_pos cp;
+        int type{0};
+        for (it->SeekToFirst(); it->Valid(); it->Next()) {
+            auto key = it->key();
+            if (!parseChunkKeyPos(key.data(), key.size(), cp, type) || cp.dim != 0) continue;
+            if (type == 49 && block_entities.size() < (1u << 20)) block_entities += it->value().ToString();
+            if ((type == 44 || type == 118) && regions.size() < count) regions.insert(cfg::c2r(cp));
+            if (regions.size() >= count && block_entities.size() >= (1u << 20)) break;
+        }
+        return {regions.begin(), regions.end()};
+    }
+
+    void benchWorld(BenchRunner &runner, const Options &opt) {
+        static const char *names[] = {"region_load",          "region_render_column", "region_render_layer",
+                                      "region_task_full",     "nbt_world_parse",      "nbt_world_serialize"};
+        bl::bedrock_level level;
+        level.set_cache(false);
+        if (opt.world.empty() || !level.open(opt.world)) {
+            for (auto *name : names) runner.skip(name, opt.world.empty() ? "no world given" : "can not open world");
+            return;
+        }
+
+        std::string block_entities;
+        auto regions = sampleRegions(level, static_cast<size_t>(opt.regions), block_entities);
+        if (regions.empty()) {
+            for (auto *name : names) runner.skip(name, "no chunk in overworld");
+            level.close();
+            return;
+        }
+        qInfo() << "Sampled" << regions.size() << "regions";
+        constexpr int N = cfg::RW * cfg::RW;
+
+        runner.run("region_load", [&](int i) {
+            bl::chunk *chunks[N]{nullptr};
+            auto t = timeIt([&]() { LoadRegionTask::loadChunks(&level, regions[i % regions.size()], chunks); });
+            for (auto *ch : chunks) delete ch;
+            return t;
+        });
+
+        // 渲染测试使用预先读好的区块，只测烘焙本身
+        std::vector<std::array<bl::chunk *, N>> loaded(regions.size());
+        for (size_t i = 0; i < regions.size(); i++) {
+            loaded[i].fill(nullptr);
+            LoadRegionTask::loadChunks(&level, regions[i], loaded[i].data());
+        }
+        for (int layer_mode = 0; layer_mode < 2; layer_mode++) {
+            MapFilter filter;
+            filter.enable_layer_ = layer_mode == 1;
+            runner.run(layer_mode ? "region_render_layer" : "region_render_column", [&](int i) {
+                std::unique_ptr<ChunkRegion> region(new ChunkRegion());
+                return timeIt([&]() { LoadRegionTask::renderRegion(loaded[i % loaded.size()].data(), &filter, region.get()); });
+            });
+        }
+        for (auto &chunks : loaded) {
+            for (auto *ch : chunks) delete ch;
+        }
+
+        MapFilter filter;
+        runner.run("region_task_full", [&](int i) {
+            std::unique_ptr<ChunkRegion> region(new ChunkRegion());
+            bl::chunk *chunks[N]{nullptr};
+            auto t = timeIt([&]() {
+                LoadRegionTask::loadChunks(&level, regions[i % regions.size()], chunks);
+                LoadRegionTask::renderRegion(chunks, &filter, region.get());
+                LoadRegionTask::shadeRegion(region.get(), cfg::MAP_RENDER_STYLE);
+                LoadRegionTask::fingerprintRegion(region.get());
+            });
+            for (auto *ch : chunks) delete ch;
+            return t;
+        });
+
+        if (block_entities.empty()) {
+            runner.skip("nbt_world_parse", "no block entity in sampled data");
+            runner.skip("nbt_world_serialize", "no block entity in sampled data");
+        } else {
+            benchNbt(runner, "nbt_world", block_entities);
+        }
+        level.close();
+    }
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    Options opt;
+    if (!parseOptions(argc, argv, opt)) {
+        std::cerr << "Usage: bedrockmap_bench [--world <dir>] [--regions N] [--iterations N] [--out result.json]" << std::endl;
+        return 1;
+    }
+    QCoreApplication a(argc, argv);
+    initResources();
+    cfg::initConfig();
+
+    BenchRunner runner(opt.iterations);
+    benchSynthetic(runner);
+    benchWorld(runner, opt);
+
+    auto j = runner.toJson();
+    j["version"] = cfg::SOFTWARE_VERSION;
+    j["region_width"] = cfg::RW;
+    j["map_render_style"] = cfg::MAP_RENDER_STYLE;
+    j["world"] = opt.world;
+    if (opt.out.empty()) {
+        std::cout << j.dump(2) << std::endl;
+    } else {
+        std::ofstream f(opt.out);
+        f << j.dump(2) << std::endl;
+    }
+    return 0;
+}
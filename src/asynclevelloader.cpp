@@ -4,116 +4,697 @@
 #include <qobject.h>
 #include <qvector3d.h>
 
+#include <QMetaObject>
 #include <QObject>
+#include <QThread>
 #include <QVector3D>
 #include <QtConcurrent>
 #include <QtDebug>
 #include <algorithm>
 #include <chrono>
+#include <filesystem>
+#include <fstream>
 #include <thread>
 
 #include "config.h"
+#include "dbprofile.h"
+#include "keyutils.h"
+#include "levelscan.h"
+#include "levelsnapshot.h"
 #include "leveldb/write_batch.h"
+#include "memstats.h"
+#include "trace.h"
 #include "qdebug.h"
 #include "resourcemanager.h"
 
 namespace {
     namespace {
         bool load_raw(leveldb::DB *&db, const std::string &raw_key, std::string &raw) {
-            auto r = db->Get(leveldb::ReadOptions(), raw_key, &raw);
+            auto r = db->Get(interactiveReadOptions(), raw_key, &raw);
             return r.ok();
         }
     }  // namespace
 
+    constexpr size_t WAL_BLOCK_SIZE = 32768;
+    constexpr size_t WAL_HEADER_SIZE = 7;
+
+    bool readVarint32(const char *&p, const char *end, uint32_t &v) {
+        v = 0;
+        for (int shift = 0; shift <= 28 && p < end; shift += 7) {
+            auto byte = static_cast<uint8_t>(*p++);
+            v |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) return true;
+        }
+        return false;
+    }
+
+    // WriteBatch: seq(8) count(4) 然后是 [tag key (value)]...
+    void collectBatchKeys(const char *data, size_t size, std::vector<std::string> &keys) {
+        if (size < 12) return;
+        const char *p = data + 12;
+        const char *end = data + size;
+        while (p < end) {
+            auto tag = static_cast<uint8_t>(*p++);
+            uint32_t len{0};
+            if (!readVarint32(p, end, len) || static_cast<size_t>(end - p) < len) return;
+            keys.emplace_back(p, len);
+            p += len;
+            if (tag == 1) {  // kTypeValue
+                if (!readVarint32(p, end, len) || static_cast<size_t>(end - p) < len) return;
+                p += len;
+            } else if (tag != 0) {  // kTypeDeletion
+                return;
+            }
+        }
+    }
+
+    /**
+     * 从offset开始解析LevelDB的预写日志(格式见leveldb的doc/log_format.md)，收集所有写入或者删除的key
+     * offset只会停在完整的逻辑记录之后，还没写完的记录留到下一次
+     */
+    void parseWalKeys(const std::string &data, size_t &offset, std::vector<std::string> &keys) {
+        size_t pos = offset;
+        std::string record;
+        bool in_fragment{false};
+        while (pos < data.size()) {
+            auto left = WAL_BLOCK_SIZE - pos % WAL_BLOCK_SIZE;
+            if (left < WAL_HEADER_SIZE) {  // 块尾部的填充
+                pos = std::min(pos + left, data.size());
+                if (!in_fragment) offset = pos;
+                continue;
+            }
+            if (pos + WAL_HEADER_SIZE > data.size()) break;
+            auto *h = reinterpret_cast<const uint8_t *>(data.data() + pos);
+            const size_t len = h[4] | (h[5] << 8);
+            const auto type = h[6];
+            if (type == 0 && len == 0) break;  // 预分配但还没写入的空间
+            if (pos + WAL_HEADER_SIZE + len > data.size()) break;
+            const char *payload = data.data() + pos + WAL_HEADER_SIZE;
+            pos += WAL_HEADER_SIZE + len;
+            switch (type) {
+                case 1:  // FULL
+                    collectBatchKeys(payload, len, keys);
+                    in_fragment = false;
+                    offset = pos;
+                    break;
+                case 2:  // FIRST
+                    record.assign(payload, len);
+                    in_fragment = true;
+                    break;
+                case 3:  // MIDDLE
+                    if (in_fragment) record.append(payload, len);
+                    break;
+                case 4:  // LAST
+                    if (in_fragment) {
+                        record.append(payload, len);
+                        collectBatchKeys(record.data(), record.size(), keys);
+                    }
+                    in_fragment = false;
+                    offset = pos;
+                    break;
+                default:
+                    in_fragment = false;
+                    offset = pos;
+                    break;
+            }
+        }
+    }
+
+    PipelineMetrics::Lookup lookupResult(bool empty, const ChunkRegion *region) {
+        if (empty) return PipelineMetrics::Empty;
+        return region ? PipelineMetrics::Hit : PipelineMetrics::Miss;
+    }
+
+    constexpr int PREFETCH_PRIORITY = -1;  // 比视野内的请求低，QThreadPool会先执行优先级高的任务
+
+    // 两次重新打开数据库之间至少间隔的时间，服务端持续写入时不会一直打断后台任务
+    constexpr qint64 MIN_REOPEN_INTERVAL_MS = 5000;
+
+    constexpr size_t MAX_DELETE_BATCH_BYTES = 4u << 20;  // 删除区块时单个WriteBatch的大小上限
+
+    // 区块列的key前缀 x(4) z(4) [dim(4)]，同一个区块的所有数据都以它开头
+    std::string chunkKeyPrefix(const bl::chunk_pos &cp) {
+        std::string prefix(reinterpret_cast<const char *>(&cp.x), 4);
+        prefix.append(reinterpret_cast<const char *>(&cp.z), 4);
+        if (cp.dim != 0) prefix.append(reinterpret_cast<const char *>(&cp.dim), 4);
+        return prefix;
+    }
+
+    bool readWholeFile(const std::string &path, std::string &data) {
+        std::ifstream f(std::filesystem::u8path(path), std::ios::binary);
+        if (!f.is_open()) return false;
+        data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    // 日志中最后一条完整记录的结束位置，快照复制日志时可能正好截在一条记录中间
+    size_t completeWalSize(const std::string &path) {
+        std::string data;
+        size_t offset = 0;
+        std::vector<std::string> keys;
+        if (readWholeFile(path, data)) parseWalKeys(data, offset, keys);
+        return offset;
+    }
+
 }  // namespace
 
 AsyncLevelLoader::AsyncLevelLoader() {
-    this->pool_.setMaxThreadCount(cfg::THREAD_NUM);
+    this->pool_.setMaxThreadCount(this->pool_sizer_.size());
     for (int i = 0; i < 3; i++) {
-        this->region_cache_.push_back(new QCache<region_pos, ChunkRegion>(cfg::REGION_CACHE_SIZE));
+        this->region_cache_.push_back(new QCache<RegionKey, CachedRegion>(cfg::REGION_CACHE_SIZE));
         this->invalid_cache_.push_back(new QCache<region_pos, char>(cfg::EMPTY_REGION_CACHE_SIZE));
     }
     this->slime_chunk_cache_ = new QCache<region_pos, QImage>(8192);
     /**
      * 不要相信bedrock_level的任何数据，不在库内做任何长期的缓存
      */
-    this->level_.set_cache(false);
+    this->level_->set_cache(false);
+
+    // 存档目录的变化先攒一会再处理，避免服务端连续写入时反复刷新
+    // 计时器已经在走时不重新开始，否则持续的写入会让它永远不触发
+    this->db_change_timer_.setSingleShot(true);
+    this->db_change_timer_.setInterval(1000);
+    connect(&this->db_change_timer_, &QTimer::timeout, this, &AsyncLevelLoader::handleLevelDBChanged);
+    auto schedule = [this] {
+        if (!this->db_change_timer_.isActive()) this->db_change_timer_.start();
+    };
+    connect(&this->db_watcher_, &QFileSystemWatcher::directoryChanged, this, schedule);
+    connect(&this->db_watcher_, &QFileSystemWatcher::fileChanged, this, schedule);
+    connect(&this->reopen_watcher_, &QFutureWatcher<bool>::finished, this, &AsyncLevelLoader::finishReopen);
+
+    this->pool_size_timer_.setInterval(1000);
+    connect(&this->pool_size_timer_, &QTimer::timeout, this, &AsyncLevelLoader::adjustPoolSize);
+    this->pool_size_timer_.start();
+
+    connect(&this->chunk_index_watcher_, &QFutureWatcher<bool>::finished, this, [this] {
+        if (!this->loaded_ || !this->chunk_index_.ready()) return;
+        qInfo() << "Chunk index ready: " << this->chunk_index_.chunkCount() << " chunks in " << this->chunk_index_.regionCount()
+                << " regions";
+        emit this->chunkIndexReady();
+    });
+}
+
+void AsyncLevelLoader::adjustPoolSize() {
+    if (!this->loaded_) return;
+    auto n = this->pool_sizer_.adjust(this->processing_.size());
+    if (n == this->pool_.maxThreadCount()) return;
+    qInfo() << "Resize background thread pool: " << this->pool_.maxThreadCount() << " -> " << n;
+    this->pool_.setMaxThreadCount(n);
 }
 
 ChunkRegion *AsyncLevelLoader::tryGetRegion(const region_pos &p, bool &empty) {
     empty = false;
     if (!this->loaded_) return nullptr;
+    // 索引里没有区块的区域不需要排队加载
+    if (!this->chunk_index_.mayHaveChunks(p)) {
+        empty = true;
+        return nullptr;
+    }
     auto *invalid = this->invalid_cache_[p.dim]->operator[](p);
     if (invalid) {
         empty = true;
         return nullptr;
     }
+    if (cfg::PREBAKE_ALT_FILTER) this->prebakeAlternate(p);
     // chunk cache
-    auto *region = this->region_cache_[p.dim]->operator[](p);
-    if (region) return region;
+    const RegionKey key{p, this->filter_->key};
+    auto *cached = this->region_cache_[p.dim]->object(key);
+    if (cached) return cached->region;
     // not in cache but in queue
-    if (this->processing_.contains(p)) return nullptr;
-    auto *task = new LoadRegionTask(&this->level_, p, &this->map_filter_);
-    connect(task, &LoadRegionTask::finish, this,
-            [this](int x, int z, int dim, ChunkRegion *region, long long load_time, long long render_time, bl::chunk **chunks) {
-                this->region_load_timer_.push(load_time);
-                this->region_render_timer_.push(render_time);
-
-                if (!region || (!region->valid)) {
-                    this->invalid_cache_[dim]->insert(bl::chunk_pos(x, z, dim), new char(0));
-                    delete region;
-                } else {
-                    this->region_cache_[dim]->insert(bl::chunk_pos(x, z, dim), region);
-                }
-                this->processing_.remove(bl::chunk_pos{x, z, dim});
-            });
-    this->processing_.add(p);
-    this->pool_.start(task);
+    if (!this->processing_.contains(key)) this->queueRegion(p, this->filter_);
+    // 刚切换过滤器时先显示上一个过滤器的结果
+    if (this->alternate_filter_) {
+        auto *old = this->region_cache_[p.dim]->object({p, this->alternate_filter_->key});
+        if (old) return old->region;
+    }
     return nullptr;
 }
 
-bool AsyncLevelLoader::open(const std::string &path) {
-    this->level_.set_cache(false);
-    this->loaded_ = this->level_.open(path);
+void AsyncLevelLoader::queueRegion(const region_pos &p, const std::shared_ptr<const FilterSnapshot> &filter, int priority) {
+    // 等待重新打开数据库时不提交新任务，需要的区域下一帧会再次请求
+    if (this->reopening_) return;
+    auto *task = new LoadRegionTask(this, this->level_.get(), p, filter, &this->metrics_, this->generation(p.dim));
+    this->processing_.add({p, filter->key});
+    this->background_budget_--;
+    this->metrics_.recordQueueDepth(this->processing_.size());
+    this->pool_.start(task, priority);
+}
+
+void AsyncLevelLoader::setFilter(const MapFilter &f) {
+    auto next = std::make_shared<const FilterSnapshot>(f);
+    if (next->key == this->filter_->key) return;
+    this->alternate_filter_ = this->filter_;
+    this->filter_ = next;
+}
+
+bool AsyncLevelLoader::backgroundBusy() const { return this->reopening_ || this->background_budget_ <= 0; }
+
+void AsyncLevelLoader::updateBackgroundBudget() {
+    // 队列里的任务超过线程数的两倍说明前台请求还没处理完，低优先级的任务只会和它们抢线程
+    // processing_.size()需要锁住所有分片，每帧只统计一次，之后由queueRegion递减
+    this->background_budget_ = this->pool_.maxThreadCount() * 2 - static_cast<int>(this->processing_.size());
+}
+
+bool AsyncLevelLoader::prefetchRegion(const region_pos &p) {
+    if (!this->loaded_ || p.dim < 0 || p.dim > 2) return false;
+    if (!this->chunk_index_.mayHaveChunks(p)) return true;
+    if (this->backgroundBusy()) return false;
+    // contains不会调整LRU顺序，预取不应该让已有的缓存变“新”
+    const RegionKey key{p, this->filter_->key};
+    if (this->invalid_cache_[p.dim]->contains(p) || this->region_cache_[p.dim]->contains(key)) return true;
+    if (this->processing_.contains(key)) return true;
+    this->queueRegion(p, this->filter_, PREFETCH_PRIORITY);
+    this->prefetched_++;
+    return true;
+}
+
+void AsyncLevelLoader::prebakeAlternate(const region_pos &p) {
+    if (!this->alternate_filter_) return;
+    const RegionKey key{p, this->alternate_filter_->key};
+    if (this->region_cache_[p.dim]->contains(key) || this->processing_.contains(key)) return;
+    if (this->backgroundBusy()) return;
+    this->queueRegion(p, this->alternate_filter_, PREFETCH_PRIORITY);
+}
+
+void AsyncLevelLoader::deliver(const region_pos &pos, ChunkRegion *region, uint64_t generation) {
+    // 只有让队列从空变成非空的那次提交需要唤醒UI线程，之后的结果会被同一次处理一起取走
+    if (this->completed_.push(new RegionResult{pos, region, generation})) {
+        QMetaObject::invokeMethod(this, [this]() { this->drainCompleted(); }, Qt::QueuedConnection);
+    }
+}
+
+void AsyncLevelLoader::drainCompleted() {
+    auto *r = this->completed_.takeAll();
+    if (!r) {
+        this->updateBackgroundBudget();
+        return;
+    }
+    TRACE_SCOPE("region_complete");
+    auto begin = PipelineMetrics::Clock::now();
+    std::vector<region_pos> loaded;
+    while (r) {
+        auto &pos = r->pos;
+        auto *region = r->region;
+        if (r->generation != this->generation(pos.dim)) {
+            // 任务被取消之前就已经完成的结果，processing_中同一位置可能已经是新的任务了，不能移除
+            FreeMemoryTask::retire(region);
+        } else if (this->stale_.count({pos, region->filter_key_})) {
+            // 烘焙期间区块被修改过，结果作废，当前过滤器的重新排队
+            const RegionKey key{pos, region->filter_key_};
+            this->stale_.erase(key);
+            this->processing_.remove(key);
+            FreeMemoryTask::retire(region);
+            if (key.filter == this->filter_->key) this->queueRegion(pos, this->filter_);
+        } else {
+            const RegionKey key{pos, region->filter_key_};
+            if (!region->valid) {
+                // 区域里有没有区块和过滤器无关
+                this->region_cache_[pos.dim]->remove(key);
+                this->invalid_cache_[pos.dim]->insert(pos, new char(0));
+                FreeMemoryTask::retire(region);
+            } else {
+                this->invalid_cache_[pos.dim]->remove(pos);
+                this->region_cache_[pos.dim]->insert(key, new CachedRegion(region));
+            }
+            this->processing_.remove(key);
+            loaded.push_back(pos);
+        }
+        auto *next = r->next;
+        delete r;
+        r = next;
+    }
+    this->metrics_.record(PipelineMetrics::CacheInsert, PipelineMetrics::Clock::now() - begin);
+    this->metrics_.recordQueueDepth(this->processing_.size());
+    this->updateBackgroundBudget();
+    for (auto &pos : loaded) emit this->regionLoaded(pos.x, pos.z, pos.dim);
+}
+
+void AsyncLevelLoader::cancelTasks(int dim) {
+    for (int i = 0; i < 3; i++) {
+        if (dim < 0 || dim == i) this->generation_[i].fetch_add(1, std::memory_order_acq_rel);
+    }
+    if (dim < 0) {
+        this->pool_.clear();
+        this->processing_.clear();
+        this->stale_.clear();
+    } else {
+        // 排队中的任务没法单独移出线程池，它们开始执行时会发现自己已经过期，立刻返回
+        this->processing_.removeIf([dim](const RegionKey &k) { return k.pos.dim == dim; });
+        for (auto it = this->stale_.begin(); it != this->stale_.end();) {
+            it = it->pos.dim == dim ? this->stale_.erase(it) : std::next(it);
+        }
+    }
+    this->metrics_.recordQueueDepth(this->processing_.size());
+}
+
+void AsyncLevelLoader::discardCompleted() {
+    auto *r = this->completed_.takeAll();
+    while (r) {
+        auto *next = r->next;
+        FreeMemoryTask::retire(r->region);
+        delete r;
+        r = next;
+    }
+}
+
+void AsyncLevelLoader::reloadRegions(const std::unordered_set<region_pos> &regions) {
+    if (!this->loaded_) return;
+    // 其他过滤器烘焙的结果也过期了，当前过滤器的保留到新的结果出来
+    const auto current = this->filter_->key;
+    for (auto *cache : this->region_cache_) {
+        for (auto &key : cache->keys()) {
+            if (key.filter != current && regions.count(key.pos)) cache->remove(key);
+        }
+    }
+    for (auto &rp : regions) {
+        if (rp.dim < 0 || rp.dim > 2) continue;
+        this->invalid_cache_[rp.dim]->remove(rp);
+        // 正在执行的任务可能已经读到了修改之前的数据
+        for (auto *f : {this->filter_.get(), this->alternate_filter_.get()}) {
+            if (f && this->processing_.contains({rp, f->key})) this->stale_.insert({rp, f->key});
+        }
+        if (!this->processing_.contains({rp, current})) this->queueRegion(rp, this->filter_);
+    }
+}
+
+void AsyncLevelLoader::invalidate(const std::unordered_set<bl::chunk_pos> &chunks) {
+    std::unordered_set<region_pos> regions;
+    for (auto &cp : chunks) regions.insert(cfg::c2r(cp));
+    this->reloadRegions(regions);
+}
+
+bool AsyncLevelLoader::open(const std::string &path, bool read_only, const std::string &snapshot_source) {
+    this->level_->set_cache(false);
+    this->root_path_ = path;
+    this->snapshot_source_ = snapshot_source;
+    this->read_only_ = read_only || !snapshot_source.empty();
+    this->reopening_ = false;
+    this->last_reopen_.invalidate();
+    this->loaded_ = openProfiledLevel(*this->level_, path);
+    if (!this->loaded_ && !snapshot_source.empty()) {
+        LevelSnapshot::remove(path);
+        this->snapshot_source_.clear();
+    }
+    // 只读打开的存档不会变化；快照监视的是原存档
+    if (this->loaded_ && cfg::WATCH_LEVEL_CHANGES && (!read_only || !snapshot_source.empty())) this->startWatching();
+    if (this->loaded_ && cfg::CHUNK_INDEX) this->buildChunkIndex();
     return this->loaded_;
 }
 
+void AsyncLevelLoader::buildChunkIndex() {
+    this->chunk_index_.clear();
+    // 建立索引期间持有存档，外部修改推迟到建完之后再处理，新区块会通过日志补进索引
+    (void)this->pinLevel();
+    auto *db = this->level_->db();
+    auto future = QtConcurrent::run([this, db]() {
+        TRACE_SCOPE("chunk_index");
+        auto res = this->chunk_index_.build(db, cfg::THREAD_NUM);
+        this->unpinLevel();
+        return res;
+    });
+    this->chunk_index_watcher_.setFuture(future);
+}
+
+bool AsyncLevelLoader::reopenLevel() {
+    if (!this->snapshot_source_.empty()) {
+        /*
+         * 原存档的LOCK被服务端持有，重新做一个快照再打开；新旧快照是不同的目录，可以先打开新的
+         * 失败时旧的存档保持可用，只是停止自动刷新
+         * 只做硬链接，不能硬链接时每次刷新都要完整复制数据库，不值得
+         */
+        std::string error;
+        auto snapshot = LevelSnapshot::create(this->snapshot_source_, error);
+        if (snapshot.empty()) {
+            qWarning() << "Can not refresh snapshot: " << error.c_str();
+            return false;
+        }
+        auto level = std::make_unique<bl::bedrock_level>();
+        level->set_cache(false);
+        if (!openProfiledLevel(*level, snapshot)) {
+            LevelSnapshot::remove(snapshot);
+            return false;
+        }
+        this->reopened_level_ = std::move(level);
+        this->reopened_root_ = snapshot;
+        return true;
+    }
+    /*
+     * 已经打开的DB看不到其他进程的写入，只能重新打开，区域缓存不受影响
+     * LevelDB的LOCK文件在同一个进程内也是独占的，新旧两个句柄不能同时打开，只能先关掉旧的
+     * 服务端可能正好在压缩或者切换日志，打不开时稍等再试一次
+     */
+    this->level_->close();
+    for (int i = 0; i < 2; i++) {
+        if (i > 0) QThread::msleep(200);
+        auto level = std::make_unique<bl::bedrock_level>();
+        level->set_cache(false);
+        if (openProfiledLevel(*level, this->root_path_)) {
+            this->reopened_level_ = std::move(level);
+            this->reopened_root_ = this->root_path_;
+            return true;
+        }
+    }
+    qWarning() << "Can not reopen level: " << this->root_path_.c_str();
+    return false;
+}
+
+void AsyncLevelLoader::settleReopen() {
+    if (!this->reopening_) return;
+    this->reopen_watcher_.waitForFinished();
+    this->finishReopen();
+}
+
+bool AsyncLevelLoader::pinLevel() {
+    this->settleReopen();
+    if (!this->loaded_) return false;
+    ++this->level_pins_;
+    return true;
+}
+
+std::string AsyncLevelLoader::watchedDbPath() const {
+    return (this->snapshot_source_.empty() ? this->root_path_ : this->snapshot_source_) + "/db";
+}
+
+void AsyncLevelLoader::startWatching() {
+    namespace fs = std::filesystem;
+    this->wal_offsets_.clear();
+    // 打开的时候日志里已有的内容都已经读到了，快照模式下以快照里复制的日志为准
+    std::error_code ec;
+    for (auto &entry : fs::directory_iterator(fs::u8path(this->root_path_ + "/db"), ec)) {
+        if (entry.path().extension() != ".log") continue;
+        this->wal_offsets_[entry.path().filename().u8string()] = completeWalSize(entry.path().u8string());
+    }
+    const auto db_path = this->watchedDbPath();
+    for (auto &entry : fs::directory_iterator(fs::u8path(db_path), ec)) {
+        if (entry.path().extension() == ".log") this->db_watcher_.addPath(QString::fromStdString(entry.path().u8string()));
+    }
+    this->db_watcher_.addPath(QString::fromStdString(db_path));
+    qInfo() << "Watching level db directory: " << db_path.c_str();
+}
+
+void AsyncLevelLoader::stopWatching() {
+    this->db_change_timer_.stop();
+    auto files = this->db_watcher_.files();
+    auto dirs = this->db_watcher_.directories();
+    if (!files.isEmpty()) this->db_watcher_.removePaths(files);
+    if (!dirs.isEmpty()) this->db_watcher_.removePaths(dirs);
+    this->wal_offsets_.clear();
+}
+
+void AsyncLevelLoader::skipOwnWrites() {
+    namespace fs = std::filesystem;
+    if (this->db_watcher_.directories().isEmpty()) return;
+    /*
+     * 自己的写入已经通过invalidate刷新过了，把日志位置移到末尾，不再为它们重新打开数据库
+     * 打开期间数据库的LOCK被本进程持有，其他进程不可能同时写入，日志末尾之前都是自己的记录
+     */
+    std::error_code ec;
+    for (auto &entry : fs::directory_iterator(fs::u8path(this->root_path_ + "/db"), ec)) {
+        if (entry.path().extension() != ".log") continue;
+        const auto size = static_cast<size_t>(entry.file_size(ec));
+        if (ec) continue;
+        const auto name = entry.path().filename().u8string();
+        auto &offset = this->wal_offsets_[name];
+        offset = std::max(offset, size);
+        auto it = this->pending_wal_offsets_.find(name);
+        if (it != this->pending_wal_offsets_.end()) it->second = std::max(it->second, size);
+    }
+}
+
+void AsyncLevelLoader::handleLevelDBChanged() {
+    namespace fs = std::filesystem;
+    if (!this->loaded_) return;
+    // 有后台扫描在使用当前的DB，或者上一次重新打开还没完成，或者离上一次太近，稍后再处理
+    if (this->level_pins_ > 0 || this->reopening_ ||
+        (this->last_reopen_.isValid() && this->last_reopen_.elapsed() < MIN_REOPEN_INTERVAL_MS)) {
+        this->db_change_timer_.start();
+        return;
+    }
+    /*
+     * 所有写入都会先进入日志，新生成的.ldb要么来自日志的落盘，要么是已有数据的压缩
+     * 所以只需要解析日志中新增的记录就能知道哪些区块发生了变化
+     */
+    std::vector<std::string> keys;
+    std::map<std::string, size_t> offsets;
+    std::error_code ec;
+    for (auto &entry : fs::directory_iterator(fs::u8path(this->watchedDbPath()), ec)) {
+        if (entry.path().extension() != ".log") continue;
+        auto name = entry.path().filename().u8string();
+        auto it = this->wal_offsets_.find(name);
+        size_t offset = it == this->wal_offsets_.end() ? 0 : it->second;
+        std::string data;
+        if (readWholeFile(entry.path().u8string(), data) && data.size() > offset) {
+            parseWalKeys(data, offset, keys);
+        }
+        offsets[name] = offset;
+        auto qpath = QString::fromStdString(entry.path().u8string());
+        if (!this->db_watcher_.files().contains(qpath)) this->db_watcher_.addPath(qpath);
+    }
+
+    std::unordered_set<region_pos> regions;
+    for (auto &key : keys) {
+        bl::chunk_pos cp;
+        int type{0};
+        if (parseChunkKeyPos(key, cp, type)) {
+            this->chunk_index_.add(cp);
+            regions.insert(cfg::c2r(cp));
+        } else if (parseDigestKeyPos(key, cp)) {
+            regions.insert(cfg::c2r(cp));
+        }
+    }
+    if (regions.empty()) {
+        this->wal_offsets_ = offsets;  // 已经被删除的日志一并丢弃
+        return;
+    }
+    qInfo() << "Level db changed, reload " << regions.size() << " regions";
+    // 日志的位置等重新打开成功之后再提交，失败时这些修改下次还能读到
+    this->pending_wal_offsets_ = std::move(offsets);
+    this->pending_regions_ = std::move(regions);
+    /*
+     * 正在执行的任务用旧的DB正常完成，不取消；等待任务、关闭和打开数据库都在后台线程
+     * 这期间UI线程不提交新任务也不访问数据库，需要数据库的操作会先等重新打开结束
+     */
+    this->reopening_ = true;
+    this->reopen_watcher_.setFuture(QtConcurrent::run([this]() {
+        TRACE_SCOPE("reopen_level");
+        this->pool_.waitForDone();
+        return this->reopenLevel();
+    }));
+}
+
+void AsyncLevelLoader::finishReopen() {
+    // 已经被settleReopen处理过了，或者期间存档被关闭了；isFinished防止旧的信号在下一次重新打开时阻塞UI线程
+    if (!this->reopening_ || !this->reopen_watcher_.isFinished()) return;
+    this->last_reopen_.start();
+    if (!this->reopen_watcher_.result()) {
+        this->stopWatching();
+        if (!this->snapshot_source_.empty()) {
+            // 旧的快照还能用，只是看不到之后的修改
+            this->reopening_ = false;
+            this->pending_wal_offsets_.clear();
+            this->pending_regions_.clear();
+            emit this->levelReopenFailed(false);
+            return;
+        }
+        // 此时没有可用的DB，reopening_保持为true，UI处理通知时不会再提交任务
+        emit this->levelReopenFailed(true);
+        this->reopening_ = false;
+        this->close();
+        return;
+    }
+    // 直接打开时旧的存档已经在后台关闭，快照模式下在这里关闭并删除旧的快照
+    this->level_->close();
+    this->level_ = std::move(this->reopened_level_);
+    if (this->reopened_root_ != this->root_path_) {
+        LevelSnapshot::remove(this->root_path_);
+        this->root_path_ = this->reopened_root_;
+    }
+    this->reopening_ = false;
+    this->wal_offsets_ = std::move(this->pending_wal_offsets_);
+    this->reloadRegions(this->pending_regions_);
+    this->pending_wal_offsets_.clear();
+    this->pending_regions_.clear();
+}
+
 AsyncLevelLoader::~AsyncLevelLoader() { this->close(); }
 
+bool LoadRegionTask::cancelled() const { return this->loader_->generation(this->pos_.dim) != this->generation_; }
+
 void LoadRegionTask::run() {
-#ifdef QT_DEBUG
-    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
-#endif
+    using Clock = PipelineMetrics::Clock;
+    auto begin = Clock::now();
+    const auto cpu_begin = PoolSizer::threadCpuTime();
+    this->metrics_->record(PipelineMetrics::QueueWait, begin - this->queued_at_);
+    if (this->cancelled()) return;
 
-    auto *region = new ChunkRegion();
     bl::chunk *chunks_[cfg::RW * cfg::RW]{nullptr};
+    auto retireChunks = [&chunks_]() {
+        std::vector<bl::chunk *> loaded;
+        for (auto *ch : chunks_) {
+            if (ch) loaded.push_back(ch);
+        }
+        FreeMemoryTask::retire(nullptr, std::move(loaded));
+    };
+    // bedrock_level::get_chunk 同时完成读取和解析，两者无法分开计时
+    auto isCancelled = [this]() { return this->cancelled(); };
+    if (!LoadRegionTask::loadChunks(this->level_, this->pos_, chunks_, isCancelled) || isCancelled()) {
+        if (Trace::enabled()) Trace::complete("cancelled", begin, Clock::now());
+        retireChunks();
+        return;
+    }
+    auto load_end = Clock::now();
+    this->metrics_->record(PipelineMetrics::Load, load_end - begin);
+
+    auto *region = new ChunkRegion();
+    LoadRegionTask::renderRegion(chunks_, &this->filter_->filter, region);
+    region->filter_key_ = this->filter_->key;
+    auto bake_end = Clock::now();
+    this->metrics_->record(PipelineMetrics::Bake, bake_end - load_end);
+
+    LoadRegionTask::shadeRegion(region, cfg::MAP_RENDER_STYLE);
+    LoadRegionTask::fingerprintRegion(region);
+    auto shade_end = Clock::now();
+    this->metrics_->record(PipelineMetrics::Shade, shade_end - bake_end);
+    if (Trace::enabled()) {
+        Trace::complete("LoadRegionTask", begin, shade_end);
+        Trace::complete("load", begin, load_end);
+        Trace::complete("bake", load_end, bake_end);
+        Trace::complete("shade", bake_end, shade_end);
+    }
+    this->loader_->poolSizer().record(std::chrono::duration_cast<std::chrono::microseconds>(shade_end - begin).count(),
+                                      PoolSizer::threadCpuTime() - cpu_begin);
+    region->trackMemory();
+    this->loader_->deliver(this->pos_, region, this->generation_);
+    retireChunks();
+}
 
+bool LoadRegionTask::loadChunks(bl::bedrock_level *level, const region_pos &pos, bl::chunk **chunks,
+                                const std::function<bool()> &cancelled) {
     // 读取区块数据
     for (int i = 0; i < cfg::RW; i++) {
         for (int j = 0; j < cfg::RW; j++) {
-            bl::chunk_pos p{this->pos_.x + i, this->pos_.z + j, this->pos_.dim};
-            chunks_[i * cfg::RW + j] = this->level_->get_chunk(p, true);
+            if (cancelled && cancelled()) return false;
+            bl::chunk_pos p{pos.x + i, pos.z + j, pos.dim};
+            chunks[i * cfg::RW + j] = level->get_chunk(p, true);
         }
     }
+    return true;
+}
 
-#ifdef QT_DEBUG
-    std::chrono::steady_clock::time_point load_end = std::chrono::steady_clock::now();
-#endif
-
+void LoadRegionTask::renderRegion(bl::chunk **chunks, const MapFilter *filter, ChunkRegion *region) {
     // 如果有合法区块，当前区域就是有效的
-    for (auto &chunk : chunks_) {
-        if (chunk && chunk->loaded()) {
+    for (int i = 0; i < cfg::RW * cfg::RW; i++) {
+        if (chunks[i] && chunks[i]->loaded()) {
             region->valid = true;
             break;
         }
     }
 
-    const auto IMG_WIDTH = cfg::RW << 4;
     // 有效的才开始渲染
     if (region->valid) {  // 尝试烘焙
         for (int rw = 0; rw < cfg::RW; rw++) {
             for (int rh = 0; rh < cfg::RW; rh++) {
-                auto *chunk = chunks_[rw * cfg::RW + rh];
+                auto *chunk = chunks[rw * cfg::RW + rh];
                 region->chunk_bit_map_.set(rw * cfg::RW + rh, chunk != nullptr);
             }
         }
@@ -126,9 +707,9 @@ void LoadRegionTask::run() {
         // draw blocks
         for (int rw = 0; rw < cfg::RW; rw++) {
             for (int rh = 0; rh < cfg::RW; rh++) {
-                auto *chunk = chunks_[rw * cfg::RW + rh];
-                this->filter_->renderImages(chunk, rw, rh, region);
-                this->filter_->bakeChunkActors(chunk, region);
+                auto *chunk = chunks[rw * cfg::RW + rh];
+                filter->renderImages(chunk, rw, rh, region);
+                filter->bakeChunkActors(chunk, region);
                 if (chunk) {
                     auto hss = chunk->HSAs();
                     region->HSAs_.insert(region->HSAs_.end(), hss.begin(), hss.end());
@@ -136,10 +717,11 @@ void LoadRegionTask::run() {
             }
         }
     }
+}
 
-    // 烘焙
-
-    if (cfg::MAP_RENDER_STYLE == 1) {
+void LoadRegionTask::shadeRegion(ChunkRegion *region, int style) {
+    const auto IMG_WIDTH = cfg::RW << 4;
+    if (style == 1) {
         for (int i = 0; i < IMG_WIDTH; i++) {
             for (int j = 0; j < IMG_WIDTH; j++) {
                 auto current_height = region->tips_info_[i][j].height;
@@ -166,7 +748,7 @@ void LoadRegionTask::run() {
                 }
             }
         }
-    } else if (cfg::MAP_RENDER_STYLE == 2) {
+    } else if (style == 2) {
         QVector3D normal{0., 2., 0.};
         QVector3D sun{5., -8, -1.};
         sun.normalize();
@@ -213,35 +795,51 @@ void LoadRegionTask::run() {
             }
         }
     }
-    for (auto *ch : chunks_) delete ch;
+}
 
-#ifdef QT_DEBUG
-    std::chrono::steady_clock::time_point total_end = std::chrono::steady_clock::now();
-    auto load_time = std::chrono::duration_cast<std::chrono::microseconds>(load_end - begin).count();
-    auto render_time = std::chrono::duration_cast<std::chrono::microseconds>(total_end - load_end).count();
-#else
-    auto load_time = -1;
-    auto render_time = -1;
-#endif
-    emit finish(this->pos_.x, this->pos_.z, this->pos_.dim, region, load_time, render_time, chunks_);
+void LoadRegionTask::fingerprintRegion(ChunkRegion *region) {
+    if (region->valid) {
+        auto fp = qHashBits(region->terrain_bake_image_.constBits(), region->terrain_bake_image_.sizeInBytes());
+        fp = qHashBits(region->biome_bake_image_.constBits(), region->biome_bake_image_.sizeInBytes(), fp);
+        region->fingerprint_ = qHashBits(region->height_bake_image_.constBits(), region->height_bake_image_.sizeInBytes(), fp);
+    }
 }
 
 void AsyncLevelLoader::close() {
     if (!this->loaded_) return;
     qInfo() << "Try close level";
     this->loaded_ = false;      // 阻止UI层请求数据
-    this->processing_.clear();  // 队列清除
-    this->pool_.clear();        // 清除所有任务
+    this->stopWatching();
+    this->cancelTasks();        // 清除排队的任务，并让正在执行的任务尽快退出
     this->pool_.waitForDone();  // 等待当前任务完成
+    this->discardCompleted();   // 丢弃还没放入缓存的结果
     qInfo() << "Clear work pool";
-    this->level_.close();  // 关闭存档
+    this->chunk_index_.cancel();
+    this->chunk_index_watcher_.waitForFinished();
+    this->reopen_watcher_.waitForFinished();
+    this->reopening_ = false;
+    if (this->reopened_level_) this->reopened_level_->close();
+    this->reopened_level_.reset();
+    if (this->reopened_root_ != this->root_path_ && !this->snapshot_source_.empty()) LevelSnapshot::remove(this->reopened_root_);
+    this->reopened_root_.clear();
+    this->pending_wal_offsets_.clear();
+    this->pending_regions_.clear();
+    this->level_->close();  // 关闭存档
+    if (!this->snapshot_source_.empty()) LevelSnapshot::remove(this->root_path_);
+    this->snapshot_source_.clear();
     this->clearAllCache();
+    this->chunk_index_.clear();
 }
 
-bl::chunk *AsyncLevelLoader::getChunkDirect(const bl::chunk_pos &p) { return this->level_.get_chunk(p, false); }
+bl::chunk *AsyncLevelLoader::getChunkDirect(const bl::chunk_pos &p) {
+    this->settleReopen();
+    if (!this->loaded_) return nullptr;
+    return this->level_->get_chunk(p, false);
+}
 
 void AsyncLevelLoader::clearAllCache() {
     qDebug() << "Clear cache";
+    this->cancelTasks();  // 还在执行的任务用的是旧的设置，结果不能再放进缓存
     for (auto &cache : this->region_cache_) {
         cache->clear();
     }
@@ -253,29 +851,104 @@ void AsyncLevelLoader::clearAllCache() {
 }
 
 QFuture<bool> AsyncLevelLoader::dropChunk(const bl::chunk_pos &min, const bl::chunk_pos &max) {
-    auto directChunkReader = [&](const bl::chunk_pos &min, const bl::chunk_pos &max) {
-        int res = 0;
-        for (int i = min.x; i <= max.x; i++) {
-            for (int j = min.z; j <= max.z; j++) {
-                bl::chunk_pos cp{i, j, min.dim};
-                this->level_.remove_chunk(cp);
+    this->settleReopen();
+    if (!this->loaded_ || this->read_only_) return QtConcurrent::run([]() { return false; });
+    this->drop_progress_ = 0;
+    this->drop_total_ = (max.x - min.x + 1) * (max.z - min.z + 1);
+    // 删除期间不允许重新打开存档，前面已经等过重新打开了
+    (void)this->pinLevel();
+    return QtConcurrent::run([this, min, max]() {
+        TRACE_SCOPE("drop_chunks");
+        std::unordered_set<region_pos> touched;
+        auto res = this->dropChunkRange(min, max, touched);
+        qInfo() << "Drop chunks finished, reload " << touched.size() << " regions";
+        // 在UI线程跳过日志之后才解除持有，中间不会因为自己的删除触发重新打开
+        // 区域坐标本身就是区域左上角的区块坐标，可以直接当作区块传入
+        QMetaObject::invokeMethod(
+            this,
+            [this, touched]() {
+                this->skipOwnWrites();
+                this->unpinLevel();
+                this->invalidate(touched);
+            },
+            Qt::QueuedConnection);
+        return res;
+    });
+}
+
+bool AsyncLevelLoader::dropChunkRange(const bl::chunk_pos &min, const bl::chunk_pos &max, std::unordered_set<region_pos> &touched) {
+    auto *db = this->level_->db();
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(bulkReadOptions()));
+    leveldb::WriteBatch batch;
+    size_t batch_bytes = 0;
+    auto deleteKey = [&](const leveldb::Slice &key) {
+        batch.Delete(key);
+        batch_bytes += key.size();
+    };
+    auto flush = [&]() {
+        if (batch_bytes == 0) return true;
+        auto s = db->Write(leveldb::WriteOptions(), &batch);
+        batch.Clear();
+        batch_bytes = 0;
+        if (!s.ok()) qWarning() << "Can not delete chunks: " << s.ToString().c_str();
+        return s.ok();
+    };
+    // 按区域遍历，索引中没有区块的区域整个跳过
+    const auto rmin = cfg::c2r(min);
+    const auto rmax = cfg::c2r(max);
+    for (int rx = rmin.x; rx <= rmax.x; rx += cfg::RW) {
+        for (int rz = rmin.z; rz <= rmax.z; rz += cfg::RW) {
+            const region_pos rp{rx, rz, min.dim};
+            const int x0 = std::max(rx, min.x), x1 = std::min(rx + cfg::RW - 1, max.x);
+            const int z0 = std::max(rz, min.z), z1 = std::min(rz + cfg::RW - 1, max.z);
+            if (!this->chunk_index_.mayHaveChunks(rp)) {
+                this->drop_progress_ += (x1 - x0 + 1) * (z1 - z0 + 1);
+                continue;
+            }
+            for (int x = x0; x <= x1; x++) {
+                for (int z = z0; z <= z1; z++) {
+                    const bl::chunk_pos cp{x, z, min.dim};
+                    bool found = false;
+                    const auto prefix = chunkKeyPrefix(cp);
+                    for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix); it->Next()) {
+                        // 主世界区块的前缀同时也是其他维度同一坐标区块key的前缀，要按完整的key判断
+                        bl::chunk_pos kp;
+                        int type{0};
+                        if (!parseChunkKeyPos(it->key().data(), it->key().size(), kp, type) || !(kp == cp)) continue;
+                        deleteKey(it->key());
+                        found = true;
+                    }
+                    bl::actor_digest_key digest_key{cp};
+                    std::string digest_raw;
+                    if (db->Get(bulkReadOptions(), digest_key.to_raw(), &digest_raw).ok()) {
+                        bl::actor_digest_list al;
+                        al.load(digest_raw);
+                        for (auto &uid : al.actor_digests_) deleteKey("actorprefix" + uid);
+                        deleteKey(digest_key.to_raw());
+                        found = true;
+                    }
+                    if (found) touched.insert(rp);
+                    ++this->drop_progress_;
+                    if (batch_bytes >= MAX_DELETE_BATCH_BYTES && !flush()) return false;
+                }
             }
         }
-        return true;
-    };
-    return QtConcurrent::run(directChunkReader, min, max);
+    }
+    return flush();
 }
 
 bool AsyncLevelLoader::modifyLeveldat(bl::palette::compound_tag *nbt) {
-    if (!this->loaded_) return false;
-    level_.dat().set_nbt(nbt);
-    auto raw = level_.dat().to_raw();
-    bl::utils::write_file(level_.root_path() + "/" + bl::bedrock_level::LEVEL_DATA, raw.data(), raw.size());
+    this->settleReopen();
+    if (!this->loaded_ || this->read_only_) return false;
+    this->level_->dat().set_nbt(nbt);
+    auto raw = this->level_->dat().to_raw();
+    bl::utils::write_file(this->level_->root_path() + "/" + bl::bedrock_level::LEVEL_DATA, raw.data(), raw.size());
     return true;
 }
 
 bool AsyncLevelLoader::modifyDBGlobal(const std::unordered_map<std::string, std::string> &modifies) {
-    if (!this->loaded_) return false;
+    this->settleReopen();
+    if (!this->loaded_ || this->read_only_) return false;
     leveldb::WriteBatch batch;
     for (auto &kv : modifies) {
         if (kv.second.empty()) {
@@ -286,23 +959,38 @@ bool AsyncLevelLoader::modifyDBGlobal(const std::unordered_map<std::string, std:
             qDebug() << "Put key: " << kv.first.c_str();
         }
     }
-    auto s = this->level_.db()->Write(leveldb::WriteOptions(), &batch);
+    auto s = this->level_->db()->Write(leveldb::WriteOptions(), &batch);
+    if (s.ok()) this->skipOwnWrites();
     return true;
 }
 
 bool AsyncLevelLoader::modifyChunkBlockEntities(const bl::chunk_pos &cp, const std::string &raw) {
+    this->settleReopen();
+    if (!this->loaded_ || this->read_only_) return false;
     bl::chunk_key key{bl::chunk_key::BlockEntity, cp, -1};
-    auto s = this->level_.db()->Put(leveldb::WriteOptions(), key.to_raw(), raw);
+    auto s = this->level_->db()->Put(leveldb::WriteOptions(), key.to_raw(), raw);
+    if (s.ok()) {
+        this->skipOwnWrites();
+        this->invalidate({cp});
+    }
     return s.ok();
 }
 
 bool AsyncLevelLoader::modifyChunkPendingTicks(const bl::chunk_pos &cp, const std::string &raw) {
+    this->settleReopen();
+    if (!this->loaded_ || this->read_only_) return false;
     bl::chunk_key key{bl::chunk_key::PendingTicks, cp, -1};
-    auto s = this->level_.db()->Put(leveldb::WriteOptions(), key.to_raw(), raw);
+    auto s = this->level_->db()->Put(leveldb::WriteOptions(), key.to_raw(), raw);
+    if (s.ok()) {
+        this->skipOwnWrites();
+        this->invalidate({cp});
+    }
     return s.ok();
 }
 
 bool AsyncLevelLoader::modifyChunkActors(const bl::chunk_pos &cp, const bl::ChunkVersion v, const std::vector<bl::actor *> &actors) {
+    this->settleReopen();
+    if (!this->loaded_ || this->read_only_) return false;
     qDebug() << cp.to_string().c_str() << "Update actors to " << actors.size();
     // clear entities (the chunk with new format will store entities with
     // different format)
@@ -315,7 +1003,7 @@ bool AsyncLevelLoader::modifyChunkActors(const bl::chunk_pos &cp, const bl::Chun
 
     // 1. Remove all entities with new format
     std::string actor_digest_raw;
-    if (load_raw(this->level_.db(), chunk_digest_key.to_raw(), actor_digest_raw)) {
+    if (load_raw(this->level_->db(), chunk_digest_key.to_raw(), actor_digest_raw)) {
         bl::actor_digest_list al;
         al.load(actor_digest_raw);
         for (auto &uid : al.actor_digests_) {
@@ -346,13 +1034,55 @@ bool AsyncLevelLoader::modifyChunkActors(const bl::chunk_pos &cp, const bl::Chun
         // 写入摘要
         batch.Put(chunk_digest_key.to_raw(), digest);
     }
-    auto s = this->level_.db()->Write(leveldb::WriteOptions(), &batch);
+    auto s = this->level_->db()->Write(leveldb::WriteOptions(), &batch);
+    if (s.ok()) {
+        this->skipOwnWrites();
+        this->invalidate({cp});
+    }
     return s.ok();
 }
 
-ChunkRegion::~ChunkRegion() = default;
+ChunkRegion::~ChunkRegion() {
+    MemStats::add(MemStats::RegionImages, -this->tracked_images_);
+    MemStats::add(MemStats::TipsInfo, -this->tracked_tips_);
+    MemStats::add(MemStats::ActorMaps, -this->tracked_actors_);
+}
+
+void ChunkRegion::trackMemory() {
+    // 容器节点的开销按64字节估算
+    constexpr int64_t NODE_OVERHEAD = 64;
+    constexpr size_t SSO_CAPACITY = 15;
+    int64_t images = this->terrain_bake_image_.sizeInBytes() + this->biome_bake_image_.sizeInBytes() + this->height_bake_image_.sizeInBytes();
+    int64_t tips = sizeof(this->tips_info_);
+    for (auto &row : this->tips_info_) {
+        for (auto &info : row) {
+            if (info.block_name.capacity() > SSO_CAPACITY) tips += static_cast<int64_t>(info.block_name.capacity());
+        }
+    }
+    int64_t actors = static_cast<int64_t>(this->HSAs_.capacity() * sizeof(bl::hardcoded_spawn_area));
+    for (auto &kv : this->actors_) actors += NODE_OVERHEAD + static_cast<int64_t>(kv.second.capacity() * sizeof(bl::vec3));
+    for (auto &kv : this->actors_counts_) actors += NODE_OVERHEAD * static_cast<int64_t>(kv.second.size() + 1);
+
+    MemStats::add(MemStats::RegionImages, images - this->tracked_images_);
+    MemStats::add(MemStats::TipsInfo, tips - this->tracked_tips_);
+    MemStats::add(MemStats::ActorMaps, actors - this->tracked_actors_);
+    this->tracked_images_ = images;
+    this->tracked_tips_ = tips;
+    this->tracked_actors_ = actors;
+}
+
+void AsyncLevelLoader::updateMemoryStats() {
+    constexpr int64_t NODE_OVERHEAD = 64;
+    const int64_t slime_image_size = (cfg::RW << 4) * (cfg::RW << 4) + 2 * sizeof(QRgb);
+    MemStats::set(MemStats::SlimeCache, this->slime_chunk_cache_->size() * (slime_image_size + NODE_OVERHEAD));
+    int64_t negative = 0;
+    for (auto *cache : this->invalid_cache_) negative += cache->size() * (NODE_OVERHEAD + static_cast<int64_t>(sizeof(region_pos)) + 1);
+    MemStats::set(MemStats::NegativeCache, negative);
+    MemStats::set(MemStats::ChunkBitmap, this->chunk_index_.memoryUsage());
+}
 
 std::vector<QString> AsyncLevelLoader::debugInfo() {
+    this->updateMemoryStats();
     std::vector<QString> res;
     res.emplace_back("Region cache:");
     for (int i = 0; i < 3; i++) {
@@ -367,20 +1097,19 @@ std::vector<QString> AsyncLevelLoader::debugInfo() {
                                QString::number(this->invalid_cache_[i]->maxCost())));
     }
 
+    res.push_back(QString("Chunk index: %1 chunks, %2 regions%3")
+                      .arg(QString::number(this->chunk_index_.chunkCount()), QString::number(this->chunk_index_.regionCount()),
+                           this->chunk_index_.ready() ? "" : " (building)"));
+
     res.push_back(QString("Slime Chunk cache: %2/%3")
                       .arg(QString::number(this->slime_chunk_cache_->totalCost()), QString::number(this->slime_chunk_cache_->maxCost())));
 
     res.emplace_back("Background thread pool:");
-    res.push_back(QString(" - Total threads: %1").arg(QString::number(cfg::THREAD_NUM)));
-
-#ifdef QT_DEBUG
-    res.push_back(QString(" - Background tasks %1").arg(QString::number(this->processing_.size())));
-    res.push_back(
-        QString("Region timer: %1 ms:")
-            .arg(QString::number(static_cast<double>(this->region_render_timer_.mean() + this->region_load_timer_.mean()) / 1000.0)));
-    res.push_back(QString(" - Region Load: %1 ms").arg(QString::number(static_cast<double>(this->region_load_timer_.mean()) / 1000.0)));
-    res.push_back(QString(" - Region Render: %1 ms").arg(QString::number(static_cast<double>(this->region_render_timer_.mean()) / 1000.0)));
-#endif
+    auto pool = this->pool_sizer_.debugInfo();
+    res.insert(res.end(), pool.begin(), pool.end());
+    res.push_back(QString(" - Prefetched regions: %1").arg(QString::number(this->prefetched_)));
+    auto metrics = this->metrics_.debugInfo();
+    res.insert(res.end(), metrics.begin(), metrics.end());
     return res;
 }
 
@@ -388,6 +1117,7 @@ QImage *AsyncLevelLoader::bakedTerrainImage(const region_pos &rp) {
     if (!this->loaded_) return cfg::UNLOADED_REGION_IMAGE();
     bool null_region{false};
     auto *region = this->tryGetRegion(rp, null_region);
+    this->metrics_.recordLookup(PipelineMetrics::Terrain, lookupResult(null_region, region));
     if (null_region) return cfg::NULL_REGION_IMAGE();
     return region ? &region->terrain_bake_image_ : cfg::UNLOADED_REGION_IMAGE();
 }
@@ -397,6 +1127,7 @@ QImage *AsyncLevelLoader::bakedBiomeImage(const region_pos &rp) {
     bool null_region{false};
 
     auto *region = this->tryGetRegion(rp, null_region);
+    this->metrics_.recordLookup(PipelineMetrics::Biome, lookupResult(null_region, region));
     if (null_region) return cfg::NULL_REGION_IMAGE();
     return region ? &region->biome_bake_image_ : cfg::UNLOADED_REGION_IMAGE();
 }
@@ -405,10 +1136,38 @@ QImage *AsyncLevelLoader::bakedHeightImage(const region_pos &rp) {
     if (!this->loaded_) return cfg::UNLOADED_REGION_IMAGE();
     bool null_region{false};
     auto *region = this->tryGetRegion(rp, null_region);
+    this->metrics_.recordLookup(PipelineMetrics::Height, lookupResult(null_region, region));
     if (null_region) return cfg::NULL_REGION_IMAGE();
     return region ? &region->height_bake_image_ : cfg::UNLOADED_REGION_IMAGE();
 }
 
+QImage *AsyncLevelLoader::bakedLayerImage(const region_pos &rp, int layer) {
+    switch (layer) {
+        case 0:
+            return this->bakedBiomeImage(rp);
+        case 1:
+            return this->bakedTerrainImage(rp);
+        case 2:
+            return this->bakedHeightImage(rp);
+        case SLIME_LAYER:
+            return this->bakedSlimeChunkImage(rp);
+        default:
+            return cfg::NULL_REGION_IMAGE();
+    }
+}
+
+uint AsyncLevelLoader::regionFingerprint(const region_pos &rp) {
+    if (!this->loaded_) return 0;
+    // 和tryGetRegion的查找顺序一致，刚切换过滤器时返回的是上一个过滤器的结果
+    // 过滤器也算进指纹里，换成当前过滤器的结果之后ETag一定会变
+    for (auto *f : {this->filter_.get(), this->alternate_filter_.get()}) {
+        if (!f) continue;
+        auto *cached = this->region_cache_[rp.dim]->object({rp, f->key});
+        if (cached) return cached->region->fingerprint_ ^ static_cast<uint>(f->key ^ (f->key >> 32));
+    }
+    return 0;
+}
+
 std::unordered_map<QImage *, std::vector<bl::vec3>> AsyncLevelLoader::getActorList(const region_pos &rp) {
     if (!this->loaded_) return {};
     bool null_region{false};
@@ -451,6 +1210,7 @@ BlockTipsInfo AsyncLevelLoader::getBlockTips(const bl::block_pos &p, int dim) {
 QImage *AsyncLevelLoader::bakedSlimeChunkImage(const region_pos &rp) {
     if (rp.dim != 0) return cfg::NULL_REGION_IMAGE();
     auto *img = this->slime_chunk_cache_->operator[](rp);
+    this->metrics_.recordLookup(PipelineMetrics::Slime, img ? PipelineMetrics::Hit : PipelineMetrics::Miss);
     if (img) {
         return img;
     }
@@ -472,21 +1232,24 @@ QImage *AsyncLevelLoader::bakedSlimeChunkImage(const region_pos &rp) {
     return res;
 }
 
-int64_t RegionTimer::mean() const {
-    return this->values.empty() ? 0 : std::accumulate(values.begin(), values.end(), 0ll) / static_cast<int64_t>(values.size());
+QThreadPool *FreeMemoryTask::pool() {
+    static auto *p = [] {
+        auto *res = new QThreadPool();
+        res->setMaxThreadCount(1);
+        res->setExpiryTimeout(-1);
+        return res;
+    }();
+    return p;
 }
 
-void RegionTimer::push(int64_t value) {
-    this->values.push_back(value);
-    if (this->values.size() > 10) {
-        this->values.pop_front();
-    }
+void FreeMemoryTask::retire(ChunkRegion *region, std::vector<bl::chunk *> chunks) {
+    if (!region && chunks.empty()) return;
+    pool()->start(new FreeMemoryTask(region, std::move(chunks)));
 }
 
-// void FreeMemoryTask::run() {
-//     constexpr auto n = cfg::RW * cfg::RW;
-//     for (int i = 0; i < n; i++) {
-//         delete chunks_[n];
-//     }
-//
-// }
+void FreeMemoryTask::run() {
+    QThread::currentThread()->setPriority(QThread::LowestPriority);
+    TRACE_SCOPE("FreeMemoryTask");
+    delete this->region_;
+    for (auto *ch : this->chunks_) delete ch;
+}
@@ -0,0 +1,147 @@
+#include "chunkindex.h"
+
+#include <algorithm>
+#include <memory>
+
+#include "keyutils.h"
+#include "levelscan.h"
+
+namespace {
+    constexpr int64_t NODE_OVERHEAD = 32;
+
+    using RegionMaps = std::array<std::unordered_map<region_pos, ChunkIndex::RegionMask>, 3>;
+}  // namespace
+
+void ChunkIndex::Bounds::extend(int x, int z) {
+    if (!this->valid) {
+        *this = {x, z, x, z, true};
+        return;
+    }
+    this->min_x = std::min(this->min_x, x);
+    this->min_z = std::min(this->min_z, z);
+    this->max_x = std::max(this->max_x, x);
+    this->max_z = std::max(this->max_z, z);
+}
+
+bool ChunkIndex::build(leveldb::DB *db, int threads) {
+    if (!db) return false;
+    auto ranges = splitKeyRanges(db, static_cast<size_t>(threads) * 8);
+    std::atomic_bool failed{false};
+    parallelForRanges(ranges, threads, [&](size_t, const KeyRange &range) {
+        RegionMaps local;
+        std::unique_ptr<leveldb::Iterator> it(db->NewIterator(bulkReadOptions()));
+        bl::chunk_pos cp;
+        int type{0};
+        // 只解析key，value不会被复制出来
+        for (it->Seek(range.begin); it->Valid() && inRange(it->key(), range) && !this->cancel_; it->Next()) {
+            auto key = it->key();
+            if (!parseChunkKeyPos(key.data(), key.size(), cp, type) || cp.dim < 0 || cp.dim > 2) continue;
+            auto rp = cfg::c2r(cp);
+            local[cp.dim][rp].set(bitOf(cp, rp));
+        }
+        if (!it->status().ok()) failed = true;
+        {
+            std::lock_guard<std::mutex> lk(this->mu_);
+            for (int d = 0; d < 3; d++) {
+                for (auto &kv : local[d]) this->regions_[d][kv.first] |= kv.second;
+            }
+        }
+        return !this->cancel_ && !failed;
+    });
+    if (this->cancel_ || failed) return false;
+
+    std::lock_guard<std::mutex> lk(this->mu_);
+    this->chunk_count_ = 0;
+    for (int d = 0; d < 3; d++) {
+        auto &b = this->bounds_[d];
+        b = Bounds();
+        for (auto &kv : this->regions_[d]) {
+            auto &rp = kv.first;
+            this->chunk_count_ += kv.second.count();
+            for (int i = 0; i < cfg::RW * cfg::RW; i++) {
+                if (kv.second[i]) b.extend(rp.x + i / cfg::RW, rp.z + i % cfg::RW);
+            }
+        }
+    }
+    this->ready_ = true;
+    return true;
+}
+
+void ChunkIndex::clear() {
+    std::lock_guard<std::mutex> lk(this->mu_);
+    for (auto &m : this->regions_) m.clear();
+    this->bounds_ = {};
+    this->chunk_count_ = 0;
+    this->silhouette_cache_.clear();
+    this->ready_ = false;
+    this->cancel_ = false;
+}
+
+void ChunkIndex::add(const bl::chunk_pos &cp) {
+    if (cp.dim < 0 || cp.dim > 2) return;
+    auto rp = cfg::c2r(cp);
+    std::lock_guard<std::mutex> lk(this->mu_);
+    auto &mask = this->regions_[cp.dim][rp];
+    const int bit = bitOf(cp, rp);
+    if (mask[bit]) return;
+    mask.set(bit);
+    this->chunk_count_++;
+    this->bounds_[cp.dim].extend(cp.x, cp.z);
+    this->silhouette_cache_.remove(rp);
+}
+
+bool ChunkIndex::mayHaveChunks(const region_pos &rp) const {
+    if (!this->ready_ || rp.dim < 0 || rp.dim > 2) return true;
+    std::lock_guard<std::mutex> lk(this->mu_);
+    return this->regions_[rp.dim].count(rp) > 0;
+}
+
+bool ChunkIndex::bounds(int dim, bl::chunk_pos &min, bl::chunk_pos &max) const {
+    if (!this->ready_ || dim < 0 || dim > 2) return false;
+    std::lock_guard<std::mutex> lk(this->mu_);
+    auto &b = this->bounds_[dim];
+    if (!b.valid) return false;
+    min = bl::chunk_pos{b.min_x, b.min_z, dim};
+    max = bl::chunk_pos{b.max_x, b.max_z, dim};
+    return true;
+}
+
+size_t ChunkIndex::chunkCount() const {
+    std::lock_guard<std::mutex> lk(this->mu_);
+    return this->chunk_count_;
+}
+
+size_t ChunkIndex::regionCount() const {
+    std::lock_guard<std::mutex> lk(this->mu_);
+    return this->regions_[0].size() + this->regions_[1].size() + this->regions_[2].size();
+}
+
+int64_t ChunkIndex::memoryUsage() const {
+    const int64_t node = NODE_OVERHEAD + static_cast<int64_t>(sizeof(region_pos) + sizeof(RegionMask));
+    const int64_t image = NODE_OVERHEAD * 2 + cfg::RW * cfg::RW + 2 * static_cast<int64_t>(sizeof(QRgb));
+    return static_cast<int64_t>(this->regionCount()) * node + this->silhouette_cache_.size() * image;
+}
+
+QImage *ChunkIndex::silhouette(const region_pos &rp) {
+    if (!this->ready_ || rp.dim < 0 || rp.dim > 2) return nullptr;
+    auto *img = this->silhouette_cache_.object(rp);
+    if (img) return img;
+    RegionMask mask;
+    {
+        std::lock_guard<std::mutex> lk(this->mu_);
+        auto it = this->regions_[rp.dim].find(rp);
+        if (it == this->regions_[rp.dim].end()) return nullptr;
+        mask = it->second;
+    }
+    // 颜色和未加载区域、空区域的底色一致，绘制时按区块大小放大
+    img = new QImage(cfg::RW, cfg::RW, QImage::Format_Indexed8);
+    img->setColor(0, qRgb(30, 30, 30));
+    img->setColor(1, qRgb(138, 138, 138));
+    for (int i = 0; i < cfg::RW; i++) {
+        for (int j = 0; j < cfg::RW; j++) {
+            img->setPixel(i, j, mask[i * cfg::RW + j] ? 1 : 0);
+        }
+    }
+    this->silhouette_cache_.insert(rp, img);
+    return img;
+}
@@ -8,6 +8,7 @@
 
 #include <QDir>
 #include <QtDebug>
+#include <algorithm>
 #include <fstream>
 #include <string>
 
@@ -31,6 +32,8 @@ const int cfg::GRID_WIDTH = 32;
 int cfg::SHADOW_LEVEL = 128;
 float cfg::ZOOM_SPEED = 1.2;
 int cfg::THREAD_NUM = 8;
+int cfg::MIN_THREAD_NUM = 2;
+int cfg::MAX_THREAD_NUM = 32;
 int cfg::REGION_CACHE_SIZE = 4096;
 int cfg::EMPTY_REGION_CACHE_SIZE = 16384;
 int cfg::MINIMUM_SCALE_LEVEL = 4;
@@ -42,6 +45,15 @@ std::string cfg::COLOR_THEME = "developing";
 int cfg::FONT_SIZE = 10;
 std::string cfg::GRID_LINE_COLOR = "#bbbbbb";
 int cfg::ACTOR_RENDER_STYLE = 0;  // 0: 渲染每一个实体；1:一个区块内每种实体仅渲染一次
+int cfg::TILE_SERVER_PORT = 8765;
+bool cfg::WATCH_LEVEL_CHANGES = true;
+int cfg::PREFETCH_RING = 2;
+bool cfg::PREBAKE_ALT_FILTER = false;
+int cfg::LDB_CACHE_MB = 64;
+int cfg::LDB_BLOOM_BITS = 10;
+int cfg::LDB_MAX_OPEN_FILES = 1000;
+bool cfg::LDB_VERIFY_CHECKSUM = false;
+bool cfg::CHUNK_INDEX = true;
 
 // 运行时可变的
 bool cfg::transparent_void = false;
@@ -137,6 +149,17 @@ void cfg::initConfig() {
             cfg::OPEN_NBT_EDITOR_ONLY = j["nbt_editor_mode"].get<bool>();
             cfg::GRID_LINE_COLOR = j["grid_line_color"].get<std::string>();
             cfg::ACTOR_RENDER_STYLE = j["actor_render_style"].get<int>();
+            cfg::TILE_SERVER_PORT = j.value("tile_server_port", cfg::TILE_SERVER_PORT);
+            cfg::WATCH_LEVEL_CHANGES = j.value("watch_level_changes", cfg::WATCH_LEVEL_CHANGES);
+            cfg::PREFETCH_RING = j.value("prefetch_ring", cfg::PREFETCH_RING);
+            cfg::PREBAKE_ALT_FILTER = j.value("prebake_alternate_filter", cfg::PREBAKE_ALT_FILTER);
+            cfg::LDB_CACHE_MB = j.value("leveldb_block_cache_mb", cfg::LDB_CACHE_MB);
+            cfg::LDB_BLOOM_BITS = j.value("leveldb_bloom_bits", cfg::LDB_BLOOM_BITS);
+            cfg::LDB_MAX_OPEN_FILES = j.value("leveldb_max_open_files", cfg::LDB_MAX_OPEN_FILES);
+            cfg::LDB_VERIFY_CHECKSUM = j.value("leveldb_verify_checksums", cfg::LDB_VERIFY_CHECKSUM);
+            cfg::CHUNK_INDEX = j.value("build_chunk_index", cfg::CHUNK_INDEX);
+            cfg::MIN_THREAD_NUM = j.value("min_background_thread_number", cfg::MIN_THREAD_NUM);
+            cfg::MAX_THREAD_NUM = j.value("max_background_thread_number", cfg::MAX_THREAD_NUM);
         }
 
     } catch (std::exception &e) {
@@ -146,13 +169,16 @@ void cfg::initConfig() {
         THREAD_NUM = 2;
         qWarning() << "Invalid background thread number, reset it to default(2)";
     }
+    // 上下限要包含初始值，两者相等时不做自动调整
+    MIN_THREAD_NUM = std::max(1, std::min(MIN_THREAD_NUM, THREAD_NUM));
+    MAX_THREAD_NUM = std::max(MAX_THREAD_NUM, THREAD_NUM);
 
     qInfo() << "Read config finished, here are the details";
     qInfo() << "- Shadow level: " << cfg::SHADOW_LEVEL;
     qInfo() << "- Theme: " << COLOR_THEME.c_str();
     qInfo() << "- Region cache size: " << REGION_CACHE_SIZE;
     qInfo() << "- Empty region cache size: " << EMPTY_REGION_CACHE_SIZE;
-    qInfo() << "- Background thread number: " << THREAD_NUM;
+    qInfo() << "- Background thread number: " << THREAD_NUM << " (" << MIN_THREAD_NUM << " ~ " << MAX_THREAD_NUM << ")";
     qInfo() << "- Minimum scale level: " << MINIMUM_SCALE_LEVEL;
     qInfo() << "- Maximum thread number: " << MAXIMUM_SCALE_LEVEL;
     qInfo() << "- Font size: " << FONT_SIZE;
@@ -162,6 +188,13 @@ void cfg::initConfig() {
     qInfo() << "- NBT editor mode:" << cfg::OPEN_NBT_EDITOR_ONLY;
     qInfo() << "- Grid line color:" << cfg::GRID_LINE_COLOR.c_str();
     qInfo() << "- Actor render style: " << cfg::ACTOR_RENDER_STYLE;
+    qInfo() << "- Tile server port: " << cfg::TILE_SERVER_PORT;
+    qInfo() << "- Watch level changes: " << cfg::WATCH_LEVEL_CHANGES;
+    qInfo() << "- Prefetch ring: " << cfg::PREFETCH_RING;
+    qInfo() << "- Prebake alternate filter: " << cfg::PREBAKE_ALT_FILTER;
+    qInfo() << "- LevelDB block cache: " << cfg::LDB_CACHE_MB << "MB, bloom bits: " << cfg::LDB_BLOOM_BITS
+            << ", max open files: " << cfg::LDB_MAX_OPEN_FILES << ", verify checksums: " << cfg::LDB_VERIFY_CHECKSUM;
+    qInfo() << "- Build chunk index: " << cfg::CHUNK_INDEX;
     qInfo() << "Reading biome and block color table...";
     initColorTable();
 }
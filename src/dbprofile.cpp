@@ -0,0 +1,71 @@
+#include "dbprofile.h"
+
+#include <QtDebug>
+#include <algorithm>
+
+#include "config.h"
+#include "leveldb/cache.h"
+#include "leveldb/filter_policy.h"
+#include "leveldb/zlib_compressor.h"
+
+namespace {
+    // 都是进程级别的单例，和数据库一样一直存活到程序退出，所以不释放
+    leveldb::Cache *sharedBlockCache() {
+        static auto *cache = leveldb::NewLRUCache(static_cast<size_t>(std::max(1, cfg::LDB_CACHE_MB)) << 20);
+        return cache;
+    }
+
+    const leveldb::FilterPolicy *sharedFilterPolicy() {
+        // 游戏写入的表带有10 bits的布隆过滤器，名字相同的过滤器才能被读取时使用
+        static const auto *policy = cfg::LDB_BLOOM_BITS > 0 ? leveldb::NewBloomFilterPolicy(cfg::LDB_BLOOM_BITS) : nullptr;
+        return policy;
+    }
+
+    leveldb::Compressor *rawZlib() {
+        static auto *c = new leveldb::ZlibCompressorRaw(-1);
+        return c;
+    }
+
+    leveldb::Compressor *zlib() {
+        static auto *c = new leveldb::ZlibCompressor();
+        return c;
+    }
+}  // namespace
+
+leveldb::Options profileOptions() {
+    leveldb::Options options;
+    options.block_cache = sharedBlockCache();
+    options.filter_policy = sharedFilterPolicy();
+    options.max_open_files = std::max(16, cfg::LDB_MAX_OPEN_FILES);
+    options.compressors[0] = rawZlib();
+    options.compressors[1] = zlib();
+    return options;
+}
+
+leveldb::ReadOptions interactiveReadOptions() {
+    leveldb::ReadOptions opt;
+    opt.verify_checksums = cfg::LDB_VERIFY_CHECKSUM;
+    return opt;
+}
+
+bool openProfiledLevel(bl::bedrock_level &level, const std::string &root) {
+    // 根目录、打开状态和level.dat都由库自己设置，之后库里依赖这些状态的接口才能正常工作
+    if (!level.open(root)) {
+        qWarning() << "Can not open level " << root.c_str();
+        return false;
+    }
+    /*
+     * 库的open已经完成了日志恢复(恢复出的数据写进了新的表文件)，
+     * 这里再打开时日志几乎是空的，只多了读取MANIFEST和打开文件的开销
+     */
+    auto *&db = level.db();
+    delete db;
+    db = nullptr;
+    auto s = leveldb::DB::Open(profileOptions(), root + "/db", &db);
+    if (s.ok()) return true;
+    qWarning() << "Can not open level db with profile options: " << s.ToString().c_str();
+    // 不能让level留着空的数据库，退回库内置的参数
+    db = nullptr;
+    level.close();
+    return level.open(root);
+}
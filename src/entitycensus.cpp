@@ -0,0 +1,175 @@
+#include "entitycensus.h"
+
+#include <QtDebug>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <unordered_map>
+
+#include "json/json.hpp"
+#include "nbtreader.h"
+
+namespace {
+    enum CensusPath { Identifier, PosX, PosZ };
+
+    const NbtProjection &censusProjection() {
+        static const NbtProjection projection = []() {
+            NbtProjection p;
+            p.add("identifier");
+            p.add("Pos[0]");
+            p.add("Pos[2]");
+            return p;
+        }();
+        return projection;
+    }
+
+    // 每个区间自己的结果，遍历结束后再合并，遍历时不需要加锁
+    struct LocalCensus {
+        std::unordered_map<std::string, EntityCensus::DimCounts> types;
+        std::unordered_map<bl::chunk_pos, int64_t> chunks;
+        std::string key;  // 复用的identifier缓冲，避免每个实体都分配一次
+        int64_t bad{0};
+    };
+
+    int dimIndex(int dim) { return dim >= 0 && dim <= 2 ? dim : EntityCensus::UNKNOWN_DIM; }
+
+    int blockToChunk(double v) { return static_cast<int>(std::floor(v / 16.0)); }
+
+    std::string csvField(const std::string &s) {
+        if (s.find_first_of(",\"\r\n") == std::string::npos) return s;
+        std::string res = "\"";
+        for (auto c : s) {
+            if (c == '"') res += '"';
+            res += c;
+        }
+        return res + "\"";
+    }
+}  // namespace
+
+bool EntityCensus::run(leveldb::DB *db, int threads) {
+    this->clear();
+    std::vector<LocalCensus> locals;
+    auto visit = [&](size_t range, const NbtRecordScan::Record &record) {
+        auto &local = locals[range];
+        NbtReader reader(record.value.data(), record.value.size());
+        while (!reader.atEnd()) {
+            local.key.clear();
+            double pos[2]{};
+            unsigned found = 0;
+            auto ok = reader.project(censusProjection(), [&](int path, const NbtValue &v) {
+                if (path == Identifier) {
+                    if (v.type == NbtType::String) local.key.assign(v.s.data(), v.s.size());
+                } else if (v.isNumber()) {
+                    pos[path - PosX] = v.f;
+                    found |= 1u << (path - PosX);
+                }
+            });
+            if (!ok) {
+                local.bad++;
+                break;
+            }
+            if (local.key.empty()) local.key = "unknown";
+            const int dim = dimIndex(record.cp.dim);
+            local.types[local.key][dim]++;
+            if (dim == UNKNOWN_DIM) continue;
+            // 实体可能已经走出了保存它的区块，有坐标时以坐标为准
+            auto cp = record.cp;
+            if (found == 3) {
+                cp.x = blockToChunk(pos[0]);
+                cp.z = blockToChunk(pos[1]);
+            }
+            local.chunks[cp]++;
+        }
+        return true;
+    };
+    auto res = this->scan_.run(
+        db, threads, NbtRecordScan::Entity | NbtRecordScan::Actor, [&](size_t n) { locals.resize(n); }, visit);
+    if (!res) return false;
+
+    std::unordered_map<bl::chunk_pos, int64_t> chunks;
+    for (auto &local : locals) {
+        for (auto &kv : local.types) {
+            auto &dst = this->counts_[kv.first];
+            for (size_t i = 0; i < dst.size(); i++) {
+                dst[i] += kv.second[i];
+                this->dim_totals_[i] += kv.second[i];
+            }
+        }
+        for (auto &kv : local.chunks) chunks[kv.first] += kv.second;
+        this->bad_records_ += local.bad;
+    }
+    this->chunks_.reserve(chunks.size());
+    for (auto &kv : chunks) this->chunks_.push_back({kv.first, kv.second});
+    std::sort(this->chunks_.begin(), this->chunks_.end(), [](const ChunkCount &a, const ChunkCount &b) {
+        if (a.count != b.count) return a.count > b.count;
+        if (a.cp.dim != b.cp.dim) return a.cp.dim < b.cp.dim;
+        return a.cp.x != b.cp.x ? a.cp.x < b.cp.x : a.cp.z < b.cp.z;
+    });
+    if (this->bad_records_ > 0) qWarning() << "Entity census skipped " << this->bad_records_ << " malformed records";
+    qInfo() << "Entity census finished: " << this->entityCount() << " entities, " << this->counts_.size() << " types";
+    return true;
+}
+
+void EntityCensus::clear() {
+    this->counts_.clear();
+    this->dim_totals_ = {};
+    this->chunks_.clear();
+    this->bad_records_ = 0;
+}
+
+int64_t EntityCensus::entityCount() const {
+    int64_t res = 0;
+    for (auto c : this->dim_totals_) res += c;
+    return res;
+}
+
+std::vector<EntityCensus::ChunkCount> EntityCensus::topChunks(size_t n) const {
+    return {this->chunks_.begin(), this->chunks_.begin() + static_cast<std::ptrdiff_t>(std::min(n, this->chunks_.size()))};
+}
+
+std::string EntityCensus::toCsv(size_t top) const {
+    std::string res = "category,name,dim,chunk_x,chunk_z,count\n";
+    for (int d = 0; d < 4; d++) {
+        res += std::string("dimension,,") + NbtRecordScan::dimName(d) + ",,," + std::to_string(this->dim_totals_[d]) + "\n";
+    }
+    for (auto &kv : this->counts_) {
+        for (int d = 0; d < 4; d++) {
+            if (kv.second[d] == 0) continue;
+            res += "type," + csvField(kv.first) + "," + NbtRecordScan::dimName(d) + ",,," + std::to_string(kv.second[d]) + "\n";
+        }
+    }
+    for (auto &c : this->topChunks(top)) {
+        res += std::string("chunk,,") + NbtRecordScan::dimName(c.cp.dim) + "," + std::to_string(c.cp.x) + "," +
+               std::to_string(c.cp.z) + "," + std::to_string(c.count) + "\n";
+    }
+    return res;
+}
+
+std::string EntityCensus::toJson(size_t top) const {
+    nlohmann::json j;
+    j["total"] = this->entityCount();
+    for (int d = 0; d < 4; d++) j["dimensions"][NbtRecordScan::dimName(d)] = this->dim_totals_[d];
+    j["types"] = nlohmann::json::object();
+    for (auto &kv : this->counts_) {
+        auto &t = j["types"][kv.first];
+        int64_t sum = 0;
+        for (int d = 0; d < 4; d++) {
+            t[NbtRecordScan::dimName(d)] = kv.second[d];
+            sum += kv.second[d];
+        }
+        t["total"] = sum;
+    }
+    j["top_chunks"] = nlohmann::json::array();
+    for (auto &c : this->topChunks(top)) {
+        j["top_chunks"].push_back({{"dim", NbtRecordScan::dimName(c.cp.dim)}, {"x", c.cp.x}, {"z", c.cp.z}, {"count", c.count}});
+    }
+    return j.dump(2);
+}
+
+bool EntityCensus::save(const std::string &path, size_t top) const {
+    const bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    if (!f) return false;
+    f << (json ? this->toJson(top) : this->toCsv(top));
+    return f.good();
+}
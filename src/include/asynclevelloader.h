@@ -4,21 +4,32 @@
 #include <qimage.h>
 
 #include <QCache>
+#include <QElapsedTimer>
+#include <QFileSystemWatcher>
 #include <QFuture>
+#include <QFutureWatcher>
 #include <QRunnable>
 #include <QThreadPool>
+#include <QTimer>
 #include <array>
 #include <atomic>
 #include <bitset>
 #include <deque>
+#include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <unordered_set>
 #include <vector>
 
 #include "bedrock_key.h"
 #include "bedrock_level.h"
+#include "chunkindex.h"
 #include "config.h"
+#include "metrics.h"
 #include "palette.h"
+#include "poolsizer.h"
 #include "renderfilterdialog.h"
 
 class AsyncLevelLoader;
@@ -33,6 +44,23 @@ namespace bl {
     }
 }  // namespace bl
 
+// 区域缓存的键，同一个区域用不同过滤器烘焙的结果分开缓存
+struct RegionKey {
+    region_pos pos;
+    uint64_t filter{0};  // MapFilter::hash()
+
+    bool operator==(const RegionKey &other) const { return this->pos == other.pos && this->filter == other.filter; }
+};
+
+inline uint qHash(const RegionKey &key, uint seed) { return bl::qHash(key.pos, seed) ^ static_cast<uint>(key.filter ^ (key.filter >> 32)); }
+
+namespace std {
+    template <>
+    struct hash<RegionKey> {
+        size_t operator()(const RegionKey &key) const { return std::hash<bl::chunk_pos>()(key.pos) ^ static_cast<size_t>(key.filter); }
+    };
+}  // namespace std
+
 struct BlockTipsInfo {
     std::string block_name{"?"};
     bl::biome biome{bl::none};
@@ -41,6 +69,10 @@ struct BlockTipsInfo {
 
 struct ChunkRegion {
     ~ChunkRegion();
+
+    // 统计烘焙结果占用的内存，析构时自动扣除
+    void trackMemory();
+
     struct ActorCount {
         bl::vec3 pos{0, 0, 0};
         int count{0};
@@ -51,111 +83,249 @@ struct ChunkRegion {
     QImage terrain_bake_image_;
     QImage biome_bake_image_;
     QImage height_bake_image_;
+    uint fingerprint_{0};         // 烘焙结果的哈希，用于瓦片服务器的ETag
+    uint64_t filter_key_{0};      // 烘焙时使用的过滤器的哈希
     bool valid{false};
     std::unordered_map<QImage *, std::vector<bl::vec3>> actors_;             // for render mode 0
     std::map<bl::chunk_pos, std::map<QImage *, ActorCount>> actors_counts_;  // for render mode 1
     std::vector<bl::hardcoded_spawn_area> HSAs_;
+    int64_t tracked_images_{0};
+    int64_t tracked_tips_{0};
+    int64_t tracked_actors_{0};
 };
 
-struct RegionTimer {
-    std::deque<int64_t> values;
-
-    [[nodiscard]] int64_t mean() const;
-
-    void push(int64_t value);
-};
-
+/**
+ * 分片加锁的集合，UI线程和后台线程同时访问时很少会争抢同一把锁
+ */
 template <typename T>
 class TaskBuffer {
    public:
     bool contains(const T &t) {
-        bool exist{false};
-        {
-            std::lock_guard<std::mutex> lk(this->mu_);
-            exist = this->buffer_.count(t) > 0;
-        }
-        return exist;
+        auto &s = this->shard(t);
+        std::lock_guard<std::mutex> lk(s.mu);
+        return s.buffer.count(t) > 0;
     }
 
     size_t size() {
         size_t sz = 0;
-        {
-            std::lock_guard<std::mutex> kl(this->mu_);
-            sz = this->buffer_.size();
+        for (auto &s : this->shards_) {
+            std::lock_guard<std::mutex> lk(s.mu);
+            sz += s.buffer.size();
         }
         return sz;
     }
 
     void clear() {
-        std::lock_guard<std::mutex> kl(this->mu_);
-        this->buffer_.clear();
+        for (auto &s : this->shards_) {
+            std::lock_guard<std::mutex> lk(s.mu);
+            s.buffer.clear();
+        }
     }
 
     void add(const T &t) {
-        std::lock_guard<std::mutex> kl(this->mu_);
-        this->buffer_.insert(t);
+        auto &s = this->shard(t);
+        std::lock_guard<std::mutex> lk(s.mu);
+        s.buffer.insert(t);
     }
 
     void remove(const T &t) {
-        std::lock_guard<std::mutex> kl(this->mu_);
-        this->buffer_.erase(t);
+        auto &s = this->shard(t);
+        std::lock_guard<std::mutex> lk(s.mu);
+        s.buffer.erase(t);
     }
 
-    bl::bedrock_level *level() { return this->level_; }
+    template <typename Pred>
+    void removeIf(Pred pred) {
+        for (auto &s : this->shards_) {
+            std::lock_guard<std::mutex> lk(s.mu);
+            for (auto it = s.buffer.begin(); it != s.buffer.end();) {
+                it = pred(*it) ? s.buffer.erase(it) : std::next(it);
+            }
+        }
+    }
+
+   private:
+    static constexpr size_t SHARD_NUM = 16;
+
+    struct Shard {
+        std::mutex mu;
+        std::unordered_set<T> buffer;
+    };
+
+    Shard &shard(const T &t) { return this->shards_[std::hash<T>()(t) % SHARD_NUM]; }
 
-    std::mutex mu_;
-    std::unordered_set<T> buffer_;
+    std::array<Shard, SHARD_NUM> shards_;
 };
 
-class LoadRegionTask : public QObject, public QRunnable {
-    Q_OBJECT
+// 后台任务的结果
+struct RegionResult {
+    region_pos pos;
+    ChunkRegion *region{nullptr};
+    uint64_t generation{0};  // 任务创建时所在维度的代数
+    RegionResult *next{nullptr};
+};
 
+/**
+ * 无锁的结果栈，多个后台线程写入，UI线程一次全部取出
+ */
+class CompletionQueue {
    public:
-    LoadRegionTask(bl::bedrock_level *level, const bl::chunk_pos &pos, const MapFilter *filter)
-        : QRunnable(), level_(level), pos_(pos), filter_(filter) {}
+    // 返回写入之前是否为空
+    bool push(RegionResult *r) {
+        auto *head = this->head_.load(std::memory_order_relaxed);
+        do {
+            r->next = head;
+        } while (!this->head_.compare_exchange_weak(head, r, std::memory_order_release, std::memory_order_relaxed));
+        return head == nullptr;
+    }
+
+    // 按完成的先后顺序返回链表
+    RegionResult *takeAll() {
+        auto *head = this->head_.exchange(nullptr, std::memory_order_acquire);
+        RegionResult *prev{nullptr};
+        while (head) {
+            auto *next = head->next;
+            head->next = prev;
+            prev = head;
+            head = next;
+        }
+        return prev;
+    }
+
+   private:
+    std::atomic<RegionResult *> head_{nullptr};
+};
+
+// 过滤器的不可变快照，修改过滤器时整体替换，后台任务各自持有自己开始时的那一份
+struct FilterSnapshot {
+    explicit FilterSnapshot(const MapFilter &f) : filter(f), key(f.hash()) {}
+
+    MapFilter filter;
+    uint64_t key;
+};
+
+class LoadRegionTask : public QRunnable {
+   public:
+    LoadRegionTask(AsyncLevelLoader *loader, bl::bedrock_level *level, const bl::chunk_pos &pos,
+                   std::shared_ptr<const FilterSnapshot> filter, PipelineMetrics *metrics, uint64_t generation)
+        : QRunnable(),
+          loader_(loader),
+          level_(level),
+          pos_(pos),
+          filter_(std::move(filter)),
+          metrics_(metrics),
+          generation_(generation),
+          queued_at_(PipelineMetrics::Clock::now()) {}
 
     void run() override;
 
-   signals:
+    // 下面几个阶段拆开是为了能单独测量性能(见bench/)
+
+    // 每读完一个区块检查一次cancelled，被取消时返回false，已经读到的区块仍然留在chunks中
+    static bool loadChunks(bl::bedrock_level *level, const region_pos &pos, bl::chunk **chunks,
+                           const std::function<bool()> &cancelled = nullptr);
+
+    static void renderRegion(bl::chunk **chunks, const MapFilter *filter, ChunkRegion *region);
+
+    static void shadeRegion(ChunkRegion *region, int style);
 
-    void finish(int x, int z, int dim, ChunkRegion *region, long long load_time, long long render_time,
-                bl::chunk **chunks);  // NO_LINT
+    static void fingerprintRegion(ChunkRegion *region);
 
    private:
+    [[nodiscard]] bool cancelled() const;
+
+    AsyncLevelLoader *loader_;
     bl::bedrock_level *level_;
     region_pos pos_;
-    const MapFilter *filter_;
+    std::shared_ptr<const FilterSnapshot> filter_;
+    PipelineMetrics *metrics_;
+    uint64_t generation_;
+    PipelineMetrics::Clock::time_point queued_at_;
 };
 
-// class FreeMemoryTask : public QObject, public QRunnable {
-//
-// public:
-//
-//     explicit FreeMemoryTask(bl::chunk **chunks) : chunks_(chunks) {}
-//
-//     void run() override;
-//
-// private:
-//     bl::chunk **chunks_;
-// };
+/**
+ * 在低优先级的后台线程中释放内存，避免UI线程因为大块的析构而卡顿
+ */
+class FreeMemoryTask : public QRunnable {
+   public:
+    FreeMemoryTask(ChunkRegion *region, std::vector<bl::chunk *> chunks) : region_(region), chunks_(std::move(chunks)) {}
+
+    void run() override;
+
+    // 交给回收线程释放，参数可以为空
+    static void retire(ChunkRegion *region, std::vector<bl::chunk *> chunks = {});
+
+   private:
+    static QThreadPool *pool();
+
+    ChunkRegion *region_;
+    std::vector<bl::chunk *> chunks_;
+};
+
+// 区域缓存中的条目，被淘汰时把区域交给回收线程，而不是在UI线程直接析构
+struct CachedRegion {
+    explicit CachedRegion(ChunkRegion *r) : region(r) {}
+
+    ~CachedRegion() { FreeMemoryTask::retire(this->region); }
+
+    CachedRegion(const CachedRegion &) = delete;
+
+    CachedRegion &operator=(const CachedRegion &) = delete;
+
+    ChunkRegion *region;
+};
 
 class AsyncLevelLoader : public QObject {
     Q_OBJECT
 
    public:
+    static constexpr int SLIME_LAYER = 3;  // 和MapWidget::MainRenderType共用编号
+
     AsyncLevelLoader();
 
     void clearAllCache();
 
-    bool open(const std::string &path);
+    /**
+     * 只读打开时所有修改接口都会返回失败
+     * @param snapshot_source 不为空时path是它的快照(见LevelSnapshot)，只读打开，快照归loader所有，关闭时删除
+     *                        监视原存档的日志，变化时重新做快照(用于服务端正在运行、数据库被锁住的存档)
+     */
+    bool open(const std::string &path, bool read_only = false, const std::string &snapshot_source = {});
 
     void close();
 
-    bl::bedrock_level &level() { return this->level_; }
+    /**
+     * 取消某个维度(dim小于0时为所有维度)排队中和正在执行的加载任务
+     * 正在执行的任务会在读完当前区块后退出，已经完成但还没放入缓存的结果会被丢弃
+     */
+    void cancelTasks(int dim = -1);
+
+    inline uint64_t generation(int dim) const { return this->generation_[dim].load(std::memory_order_acquire); }
+
+    bl::bedrock_level &level() { return *this->level_; }
 
     inline bool isOpen() const { return this->loaded_; }
 
-    void setFilter(const MapFilter &f) { this->map_filter_ = f; }
+    inline bool isReadOnly() const { return this->read_only_; }
+
+    /**
+     * 切换过滤器，不同过滤器的烘焙结果共用同一个缓存，切回最近用过的过滤器时不需要重新烘焙
+     * 新的结果出来之前先显示上一个过滤器的结果
+     */
+    void setFilter(const MapFilter &f);
+
+    inline uint64_t filterKey() const { return this->filter_->key; }
+
+    /**
+     * 后台全库扫描期间持有，防止存档被重新打开
+     * 正在重新打开时先等它完成，返回false说明重新打开失败、存档已经关闭，这时没有持有
+     */
+    [[nodiscard]] bool pinLevel();
+
+    inline void unpinLevel() { --this->level_pins_; }
+
+    // 区块存在性索引，打开存档后在后台建立
+    ChunkIndex &chunkIndex() { return this->chunk_index_; }
 
    public:
     /*region cache*/
@@ -167,6 +337,10 @@ class AsyncLevelLoader : public QObject {
 
     QImage *bakedSlimeChunkImage(const region_pos &rp);
 
+    QImage *bakedLayerImage(const region_pos &rp, int layer);
+
+    uint regionFingerprint(const region_pos &rp);
+
     BlockTipsInfo getBlockTips(const bl::block_pos &p, int dim);
 
     std::unordered_map<QImage *, std::vector<bl::vec3>> getActorList(const region_pos &rp);
@@ -179,8 +353,18 @@ class AsyncLevelLoader : public QObject {
     bl::chunk *getChunkDirect(const bl::chunk_pos &p);
 
     // modify
+    /**
+     * 在后台删除矩形范围内的区块，连同新版实体的digp和actorprefix记录
+     * 每个区块列用迭代器找出所有key，删除操作攒成有大小上限的WriteBatch再写入
+     * 完成后只重新加载删除了数据的区域
+     */
     QFuture<bool> dropChunk(const bl::chunk_pos &min, const ::bl::chunk_pos &max);
 
+    // 删除区块的进度，单位是区块
+    inline int dropProgress() const { return this->drop_progress_; }
+
+    inline int dropTotal() const { return this->drop_total_; }
+
     /**
      * 批量修改数据库
      * 对于 @modifies中的没一个key 和value
@@ -202,6 +386,13 @@ class AsyncLevelLoader : public QObject {
     //    bool modifyVillageList(
     //            const std::unordered_map<std::string, std::array<bl::palette::compound_tag *, 4>> &village_list);
 
+    /**
+     * 区块数据被修改之后调用，只让包含这些区块的区域失效并重新烘焙，在UI线程调用
+     * 其他过滤器的烘焙结果和空区域记录直接移除，当前过滤器的结果保留到新的结果出来
+     * 修改时正在烘焙的结果会被丢弃重来；所有modify接口和dropChunk都会自动调用
+     */
+    void invalidate(const std::unordered_set<bl::chunk_pos> &chunks);
+
     bool modifyChunkBlockEntities(const bl::chunk_pos &cp, const std::string &raw);
 
     bool modifyChunkPendingTicks(const bl::chunk_pos &cp, const std::string &raw);
@@ -213,21 +404,121 @@ class AsyncLevelLoader : public QObject {
 
     std::vector<QString> debugInfo();
 
+    // 更新可以直接从缓存大小算出来的内存统计
+    void updateMemoryStats();
+
+    /**
+     * 以低优先级预先加载即将进入视野的区域
+     * 后台队列积压时返回false，调用方应当停止本轮预取
+     */
+    bool prefetchRegion(const region_pos &p);
+
+    // 由后台线程调用，提交一个区域的加载结果
+    void deliver(const region_pos &pos, ChunkRegion *region, uint64_t generation);
+
+    // 把已经完成的结果放入缓存，在UI线程调用，每帧一次
+    void drainCompleted();
+
+    PipelineMetrics &metrics() { return this->metrics_; }
+
+    PoolSizer &poolSizer() { return this->pool_sizer_; }
+
+   signals:
+
+    void regionLoaded(int x, int z, int dim);  // NOLINT
+
+    void chunkIndexReady();
+
+    // 存档被外部修改后没能重新打开，closed为false时是快照没能刷新，旧的快照仍然可用
+    void levelReopenFailed(bool closed);
+
+   private slots:
+
+    void handleLevelDBChanged();
+
+    // 后台任务都结束之后在UI线程换上新的数据库
+    void finishReopen();
+
+    void adjustPoolSize();
+
    private:
     ChunkRegion *tryGetRegion(const region_pos &p, bool &empty);
 
+    void queueRegion(const region_pos &p, const std::shared_ptr<const FilterSnapshot> &filter, int priority = 0);
+
+    // 用上一个过滤器在后台烘焙，切换回去时不需要等待
+    void prebakeAlternate(const region_pos &p);
+
+    [[nodiscard]] bool backgroundBusy() const;
+
+    // 在drainCompleted里调用，每帧统计一次后台队列还能放下多少低优先级任务
+    void updateBackgroundBudget();
+
+    // 重新读取这些区域，缓存中的旧图像会保留到新的结果出来
+    void reloadRegions(const std::unordered_set<region_pos> &regions);
+
+    // 在后台线程调用，关闭当前的存档，新打开的放进reopened_level_
+    bool reopenLevel();
+
+    // 在UI线程等待正在进行的重新打开结束并换上新的存档，访问数据库之前调用
+    void settleReopen();
+
+    // 在后台线程调用，touched返回删除了数据的区域
+    bool dropChunkRange(const bl::chunk_pos &min, const bl::chunk_pos &max, std::unordered_set<region_pos> &touched);
+
+    // 直接打开时是存档自己的db目录，快照模式下是原存档的
+    [[nodiscard]] std::string watchedDbPath() const;
+
+    void startWatching();
+
+    void stopWatching();
+
+    // 本进程写入数据库之后在UI线程调用，日志里的这些记录不需要再处理
+    void skipOwnWrites();
+
+    void discardCompleted();
+
+    void buildChunkIndex();
+
    private:
     std::atomic_bool loaded_{false};
-    bl::bedrock_level level_{};
-    TaskBuffer<region_pos> processing_;
-    std::vector<QCache<region_pos, ChunkRegion> *> region_cache_;
+    bool read_only_{false};
+    std::atomic_int level_pins_{0};
+    std::atomic_int drop_progress_{0};
+    std::atomic_int drop_total_{0};
+    std::array<std::atomic<uint64_t>, 3> generation_{};  // 每次取消任务时递增
+    std::string root_path_;
+    std::unique_ptr<bl::bedrock_level> level_{std::make_unique<bl::bedrock_level>()};
+    TaskBuffer<RegionKey> processing_;
+    std::unordered_set<RegionKey> stale_;  // 区块修改时正在烘焙的任务，只在UI线程访问
+    CompletionQueue completed_;
+    std::vector<QCache<RegionKey, CachedRegion> *> region_cache_;
     std::vector<QCache<region_pos, char> *> invalid_cache_;
     // 主要是缓存图像，计算不是重点
     QCache<region_pos, QImage> *slime_chunk_cache_;
     QThreadPool pool_;
-    MapFilter map_filter_;
-    RegionTimer region_load_timer_;
-    RegionTimer region_render_timer_;
+    PoolSizer pool_sizer_{cfg::THREAD_NUM, cfg::MIN_THREAD_NUM, cfg::MAX_THREAD_NUM};
+    QTimer pool_size_timer_;
+    std::shared_ptr<const FilterSnapshot> filter_{std::make_shared<const FilterSnapshot>(MapFilter())};
+    std::shared_ptr<const FilterSnapshot> alternate_filter_;  // 上一个使用的过滤器
+    PipelineMetrics metrics_;
+    uint64_t prefetched_{0};
+    int background_budget_{0};  // 只在UI线程访问
+    ChunkIndex chunk_index_;
+    QFutureWatcher<bool> chunk_index_watcher_;
+    // 监视db目录
+    QFileSystemWatcher db_watcher_;
+    QTimer db_change_timer_;
+    std::map<std::string, size_t> wal_offsets_;  // 日志文件名 -> 已经解析到的位置
+    // 重新打开数据库期间只在UI线程访问
+    bool reopening_{false};
+    QFutureWatcher<bool> reopen_watcher_;
+    std::unique_ptr<bl::bedrock_level> reopened_level_;  // 后台写入，watcher结束后在UI线程取走
+    std::string reopened_root_;
+    std::string snapshot_source_;  // 快照模式下被快照的存档
+    QElapsedTimer last_reopen_;
+    std::map<std::string, size_t> pending_wal_offsets_;
+    std::unordered_set<region_pos> pending_regions_;
 };
 
 #endif  // ASYNCLEVELLOADER_H
@@ -0,0 +1,78 @@
+#ifndef BEDROCKMAP_CHUNKINDEX_H
+#define BEDROCKMAP_CHUNKINDEX_H
+
+#include <QCache>
+#include <QImage>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <mutex>
+#include <unordered_map>
+
+#include "bedrock_key.h"
+#include "config.h"
+#include "leveldb/db.h"
+
+/**
+ * 存档中所有区块的存在性索引
+ * 打开存档后在后台只遍历一遍key建立，不解析任何value
+ * 每个区域用一个RW*RW位的掩码表示，布局和ChunkRegion::chunk_bit_map_一致
+ */
+class ChunkIndex {
+   public:
+    using RegionMask = std::bitset<cfg::RW * cfg::RW>;
+
+    /**
+     * 建立索引，阻塞直到完成或者被取消，在后台线程调用
+     * @return 是否完整地建立完成，没有完成时所有查询都按“可能有区块”处理
+     */
+    bool build(leveldb::DB *db, int threads);
+
+    inline void cancel() { this->cancel_ = true; }
+
+    [[nodiscard]] inline bool ready() const { return this->ready_; }
+
+    // 在UI线程调用，同时重置取消标记
+    void clear();
+
+    // 外部写入产生的新区块，在UI线程调用；索引只增不减，多出来的区块最多让加载任务白跑一次
+    void add(const bl::chunk_pos &cp);
+
+    // 索引还没建好时返回true
+    [[nodiscard]] bool mayHaveChunks(const region_pos &rp) const;
+
+    // 某个维度所有区块的包围盒，没有区块或者索引还没建好时返回false
+    bool bounds(int dim, bl::chunk_pos &min, bl::chunk_pos &max) const;
+
+    [[nodiscard]] size_t chunkCount() const;
+
+    [[nodiscard]] size_t regionCount() const;
+
+    [[nodiscard]] int64_t memoryUsage() const;
+
+    // 区域的轮廓图(每个区块一个像素)，用于区域还没加载出来时的显示，只在UI线程调用
+    QImage *silhouette(const region_pos &rp);
+
+   private:
+    struct Bounds {
+        int min_x{0};
+        int min_z{0};
+        int max_x{0};
+        int max_z{0};
+        bool valid{false};
+
+        void extend(int x, int z);
+    };
+
+    static int bitOf(const bl::chunk_pos &cp, const region_pos &rp) { return (cp.x - rp.x) * cfg::RW + (cp.z - rp.z); }
+
+    mutable std::mutex mu_;
+    std::array<std::unordered_map<region_pos, RegionMask>, 3> regions_;
+    std::array<Bounds, 3> bounds_{};
+    size_t chunk_count_{0};
+    QCache<region_pos, QImage> silhouette_cache_{8192};
+    std::atomic_bool ready_{false};
+    std::atomic_bool cancel_{false};
+};
+
+#endif  // BEDROCKMAP_CHUNKINDEX_H
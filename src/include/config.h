@@ -28,7 +28,9 @@ struct cfg {
     // 可配置的
     static int SHADOW_LEVEL;             // 地形图的阴影等级
     static float ZOOM_SPEED;             // 滚轮缩放苏晒
-    static int THREAD_NUM;               // 后台线程数
+    static int THREAD_NUM;               // 后台线程数(初始值)
+    static int MIN_THREAD_NUM;           // 自动调整后台线程数的下限
+    static int MAX_THREAD_NUM;           // 自动调整后台线程数的上限
     static int REGION_CACHE_SIZE;        // 区域缓存大小
     static int EMPTY_REGION_CACHE_SIZE;  // 空区域缓存大小
     static int MINIMUM_SCALE_LEVEL;      // 最大缩放等级
@@ -40,6 +42,15 @@ struct cfg {
     static std::string COLOR_THEME;      // 主体
     static std::string GRID_LINE_COLOR;  // 网格线颜色
     static int ACTOR_RENDER_STYLE;       // 实体渲染风格
+    static int TILE_SERVER_PORT;         // 瓦片服务器端口
+    static bool WATCH_LEVEL_CHANGES;     // 监视存档变化并自动刷新
+    static int PREFETCH_RING;            // 预取范围(视野外几圈区域)，0表示关闭
+    static bool PREBAKE_ALT_FILTER;      // 在后台用上一个过滤器烘焙视野内的区域
+    static int LDB_CACHE_MB;             // LevelDB的block cache大小(MB)
+    static int LDB_BLOOM_BITS;           // 布隆过滤器每个key的位数，0表示不使用
+    static int LDB_MAX_OPEN_FILES;       // LevelDB最多同时打开的文件数
+    static bool LDB_VERIFY_CHECKSUM;     // 读取时是否校验数据块
+    static bool CHUNK_INDEX;             // 打开存档后在后台建立区块索引，用于跳过空区域
     // 运行时配置
     static bool transparent_void;
 
@@ -0,0 +1,27 @@
+#ifndef BEDROCKMAP_DBPROFILE_H
+#define BEDROCKMAP_DBPROFILE_H
+
+#include <string>
+
+#include "bedrock_level.h"
+#include "leveldb/db.h"
+
+/**
+ * LevelDB的打开和读取参数，由config.json中leveldb_开头的配置项决定
+ * block cache、bloom filter和压缩器在进程内打开的所有数据库之间共用
+ */
+
+// 打开数据库时使用的参数，压缩方式和游戏保持一致
+leveldb::Options profileOptions();
+
+// 地图交互时的单点读取
+leveldb::ReadOptions interactiveReadOptions();
+
+/**
+ * 用bedrock_level::open打开存档，再把数据库换成用profileOptions打开的
+ * 库的open只接受内置的参数，换数据库是在不修改库的前提下唯一的办法；库的状态(根目录、是否打开)照常由库维护
+ * 用profileOptions打不开时退回库内置的参数重新打开，返回false说明存档本身打不开
+ */
+bool openProfiledLevel(bl::bedrock_level &level, const std::string &root);
+
+#endif  // BEDROCKMAP_DBPROFILE_H
@@ -0,0 +1,68 @@
+#ifndef BEDROCKMAP_ENTITYCENSUS_H
+#define BEDROCKMAP_ENTITYCENSUS_H
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "bedrock_key.h"
+#include "leveldb/db.h"
+#include "recordscan.h"
+
+/**
+ * 全存档的实体统计：按类型和维度计数，以及实体最多的区块
+ * 遍历旧版的区块Entity记录和新版的actorprefix记录，每个实体只读取identifier和Pos
+ */
+class EntityCensus {
+   public:
+    static constexpr int UNKNOWN_DIM = 3;  // 找不到digp记录的新版实体
+
+    using DimCounts = std::array<int64_t, 4>;  // 主世界、下界、末地、未知
+
+    struct ChunkCount {
+        bl::chunk_pos cp;
+        int64_t count{0};
+    };
+
+    bool run(leveldb::DB *db, int threads);
+
+    inline void cancel() { this->scan_.cancel(); }
+
+    // 提交任务之前调用，见NbtRecordScan::reset
+    inline void reset() { this->scan_.reset(); }
+
+    inline int progress() const { return this->scan_.progress(); }
+
+    inline int total() const { return this->scan_.total(); }
+
+    void clear();
+
+    // 实体类型(完整的identifier，和导出的CSV/JSON一致)到各维度数量
+    [[nodiscard]] inline const std::map<std::string, DimCounts> &counts() const { return this->counts_; }
+
+    [[nodiscard]] inline const DimCounts &dimTotals() const { return this->dim_totals_; }
+
+    [[nodiscard]] int64_t entityCount() const;
+
+    // 实体数量最多的区块，数量相同时按坐标排序，结果是确定的
+    [[nodiscard]] std::vector<ChunkCount> topChunks(size_t n) const;
+
+    // 一行一个统计项: category,name,dim,chunk_x,chunk_z,count
+    [[nodiscard]] std::string toCsv(size_t top) const;
+
+    [[nodiscard]] std::string toJson(size_t top) const;
+
+    // 按扩展名选择格式，.json以外都写CSV
+    bool save(const std::string &path, size_t top) const;
+
+   private:
+    NbtRecordScan scan_;
+    std::map<std::string, DimCounts> counts_;
+    DimCounts dim_totals_{};
+    std::vector<ChunkCount> chunks_;
+    int64_t bad_records_{0};
+};
+
+#endif  // BEDROCKMAP_ENTITYCENSUS_H
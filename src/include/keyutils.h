@@ -0,0 +1,52 @@
+#ifndef BEDROCKMAP_KEYUTILS_H
+#define BEDROCKMAP_KEYUTILS_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "bedrock_key.h"
+
+// 直接在原始key上做的一些轻量判断，不经过bedrock-level的解析
+
+inline int32_t readInt32LE(const char *p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return static_cast<int32_t>(v);
+}
+
+/**
+ * 判断一个原始key是不是区块数据的key，是的话返回区块坐标和key类型
+ * 区块key的格式为 x(4) z(4) [dim(4)] type(1) [y_index(1)]
+ */
+inline bool parseChunkKeyPos(const char *key, size_t size, bl::chunk_pos &cp, int &type) {
+    if (size != 9 && size != 10 && size != 13 && size != 14) return false;
+    const bool has_dim = size >= 13;
+    type = static_cast<uint8_t>(key[has_dim ? 12 : 8]);
+    if (!((type >= 43 && type <= 65) || type == 118)) return false;
+    cp.x = readInt32LE(key);
+    cp.z = readInt32LE(key + 4);
+    cp.dim = has_dim ? readInt32LE(key + 8) : 0;
+    // 只有带y_index的子区块key长度才会多一个字节
+    if ((size == 10 || size == 14) && type != 47) return false;
+    return cp.dim >= 0 && cp.dim <= 2;
+}
+
+inline bool parseChunkKeyPos(const std::string &key, bl::chunk_pos &cp, int &type) {
+    return parseChunkKeyPos(key.data(), key.size(), cp, type);
+}
+
+/**
+ * 新版实体格式的区块摘要key: digp x(4) z(4) [dim(4)]
+ */
+inline bool parseDigestKeyPos(const char *key, size_t size, bl::chunk_pos &cp) {
+    if ((size != 12 && size != 16) || std::memcmp(key, "digp", 4) != 0) return false;
+    cp.x = readInt32LE(key + 4);
+    cp.z = readInt32LE(key + 8);
+    cp.dim = size == 16 ? readInt32LE(key + 12) : 0;
+    return cp.dim >= 0 && cp.dim <= 2;
+}
+
+inline bool parseDigestKeyPos(const std::string &key, bl::chunk_pos &cp) { return parseDigestKeyPos(key.data(), key.size(), cp); }
+
+#endif  // BEDROCKMAP_KEYUTILS_H
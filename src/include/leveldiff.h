@@ -0,0 +1,59 @@
+#ifndef BEDROCKMAP_LEVELDIFF_H
+#define BEDROCKMAP_LEVELDIFF_H
+
+#include <QCache>
+#include <QImage>
+#include <atomic>
+#include <unordered_map>
+
+#include "asynclevelloader.h"
+#include "config.h"
+#include "leveldb/db.h"
+
+/**
+ * 两个存档(一般是当前存档和备份)的区块级别差异
+ * 直接按顺序归并遍历两个数据库的key，只比较value的原始字节，不解析NBT
+ */
+class LevelDiff {
+   public:
+    enum State : uint8_t { Same = 0, Added = 1, Removed = 2, Changed = 3 };
+
+    LevelDiff() = default;
+
+    /**
+     * 比较两个数据库，阻塞直到完成或者被取消
+     * @param current 当前存档
+     * @param base 用于比较的旧存档
+     * @param threads 线程数
+     * @return 是否完整地比较完成
+     */
+    bool compare(leveldb::DB *current, leveldb::DB *base, int threads);
+
+    inline void cancel() { this->cancel_ = true; }
+
+    // 在提交任务之前由UI线程调用，compare不会清除取消标记
+    inline void reset() { this->cancel_ = false; }
+
+    inline int progress() const { return this->progress_; }
+
+    inline int total() const { return this->total_; }
+
+    void clear();
+
+    [[nodiscard]] inline bool empty() const { return this->states_.empty(); }
+
+    [[nodiscard]] State state(const bl::chunk_pos &cp) const;
+
+    [[nodiscard]] size_t count(State s) const;
+
+    QImage *regionImage(const region_pos &rp);
+
+   private:
+    std::unordered_map<bl::chunk_pos, State> states_;
+    QCache<region_pos, QImage> image_cache_{4096};
+    std::atomic_bool cancel_{false};
+    std::atomic_int progress_{0};
+    std::atomic_int total_{0};
+};
+
+#endif  // BEDROCKMAP_LEVELDIFF_H
@@ -0,0 +1,48 @@
+#ifndef BEDROCKMAP_LEVELSCAN_H
+#define BEDROCKMAP_LEVELSCAN_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "leveldb/db.h"
+
+/**
+ * 全库遍历的公共工具
+ * 按照key的前缀把整个key空间切成若干段，再交给多个线程分别遍历
+ */
+struct KeyRange {
+    std::string begin;  // 包含
+    std::string end;    // 不包含，为空表示一直到最后
+};
+
+/**
+ * 先按第一个字节切成256段，再根据LevelDB估算的磁盘占用把过大的段按下一个字节继续细分
+ * @param db
+ * @param target_count 期望的分段数量(通常是线程数的几倍)
+ * @param prefix 只切分以prefix开头的key
+ */
+std::vector<KeyRange> splitKeyRanges(leveldb::DB *db, size_t target_count, const std::string &prefix = "");
+
+/**
+ * 用threads个线程遍历所有区间，每个区间只会被一个线程处理
+ * fn的返回值为false时停止分发新的区间
+ */
+void parallelForRanges(const std::vector<KeyRange> &ranges, int threads, const std::function<bool(size_t, const KeyRange &)> &fn);
+
+// 批量遍历时使用，不污染block cache
+leveldb::ReadOptions bulkReadOptions();
+
+// 既不是区块数据也不是实体数据的key(玩家、村庄、地图等)
+bool isGlobalKey(const leveldb::Slice &key);
+
+/**
+ * 全局数据所在的key区间，只覆盖MainWindow会加载的几类前缀(玩家、村庄、地图和其他几个固定的key)
+ * 不需要遍历全部区块数据，但是区间内仍然可能混有区块key，需要用isGlobalKey过滤
+ */
+std::vector<KeyRange> globalKeyRanges(leveldb::DB *db, size_t target_count);
+
+inline bool inRange(const leveldb::Slice &key, const KeyRange &r) { return r.end.empty() || key.compare(r.end) < 0; }
+
+#endif  // BEDROCKMAP_LEVELSCAN_H
@@ -0,0 +1,44 @@
+#ifndef BEDROCKMAP_LEVELSNAPSHOT_H
+#define BEDROCKMAP_LEVELSNAPSHOT_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * 给正在被服务端写入的存档做一个一致的快照，用来只读打开
+ * .ldb文件写完之后不会再被修改，直接硬链接；CURRENT、MANIFEST和日志会被追加写入，需要复制
+ * 快照放在存档所在目录下的.bedrockmap-snapshots里，和存档在同一个分区上才能硬链接，几乎不占用额外的磁盘空间
+ * 每个快照带有标记文件，程序崩溃后留下的快照会在下一次创建快照或者打开同一目录下的存档时清理
+ */
+class LevelSnapshot {
+   public:
+    struct Stats {
+        int linked{0};
+        int copied{0};
+        int64_t copied_bytes{0};
+        int64_t table_bytes{0};    // 所有.ldb文件的大小，无法硬链接时就是需要复制的量
+        bool link_failed{false};  // 无法硬链接并且不允许复制
+    };
+
+    // 已经处理的文件数，给进度条用
+    struct Progress {
+        std::atomic_int done{0};
+        std::atomic_int total{0};
+    };
+
+    /**
+     * 成功时返回快照的根目录，失败时返回空字符串并写入error
+     * @param allow_copy 无法硬链接时是否退回完整复制，为false时直接失败并设置stats->link_failed
+     */
+    static std::string create(const std::string &root, std::string &error, Stats *stats = nullptr, bool allow_copy = false,
+                              Progress *progress = nullptr);
+
+    // 只删除带有标记文件的目录
+    static void remove(const std::string &snapshot_root);
+
+    // 清理root所在目录下已经没有人使用的快照(创建超过10分钟，数据库没有被打开)
+    static void sweep(const std::string &root);
+};
+
+#endif  // BEDROCKMAP_LEVELSNAPSHOT_H
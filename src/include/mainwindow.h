@@ -10,15 +10,23 @@
 #include <QMainWindow>
 #include <QMessageBox>
 #include <QPainter>
+#include <QProgressDialog>
 #include <QPushButton>
+#include <QTimer>
+#include <functional>
+#include <memory>
 #include <unordered_map>
 
 #include "asynclevelloader.h"
 #include "chunkeditorwidget.h"
+#include "entitycensus.h"
+#include "leveldiff.h"
 #include "mapitemeditor.h"
 #include "mapwidget.h"
+#include "nbtsearch.h"
 #include "nbtwidget.h"
 #include "renderfilterdialog.h"
+#include "tileserver.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -38,15 +46,22 @@ struct LogoPos {
     }
 };
 
+// 只保存原始的key和value，在编辑器里打开时才解析
 struct GlobalNBTLoadResult {
-    bl::village_data villageData;
-    bl::general_kv_nbts playerData;
-    bl::general_kv_nbts mapData;
-    bl::general_kv_nbts otherData;
+    std::vector<RawNBTEntry> villageData;
+    std::vector<RawNBTEntry> playerData;
+    std::vector<RawNBTEntry> mapData;
+    std::vector<RawNBTEntry> otherData;
+    std::unordered_map<std::string, QRect> villageBounds;  // 只解析了村庄的INFO，用于在地图上画范围
 };
 
+// 全局数据按key区间分片并行加载，每个分片一份结果
+using GlobalNBTShards = std::vector<std::unique_ptr<GlobalNBTLoadResult>>;
+
 QT_END_NAMESPACE
 
+class NbtSearchDialog;
+
 class MainWindow : public QMainWindow {
     Q_OBJECT
 
@@ -59,6 +74,8 @@ class MainWindow : public QMainWindow {
 
     MapWidget *mapWidget() { return this->map_widget_; }
 
+    LevelDiff *levelDiff() { return &this->level_diff_; }
+
    public slots:
 
     inline bool enable_write() const { return this->write_mode_; }
@@ -74,8 +91,17 @@ class MainWindow : public QMainWindow {
 
     void handle_level_open_finished();
 
+    void handle_level_diff_finished();
+
+    void handle_entity_census_finished();
+
     inline QMap<QString, QRect> &get_villages() { return this->villages_; }
 
+    const std::vector<NbtSearchHit> &searchHits() const;
+
+    // 切换到对应维度并跳转到方块坐标
+    void gotoDimensionBlockPos(int dim, int x, int z);
+
     void applyFilter();
 
    protected:
@@ -87,6 +113,9 @@ class MainWindow : public QMainWindow {
 
     void openLevel();
 
+    // 给正在运行的存档做快照后只读打开
+    void openSnapshot();
+
     void closeLevel();
 
     void close_and_exit();
@@ -95,6 +124,8 @@ class MainWindow : public QMainWindow {
 
     void openMapItemEditor();
 
+    void openNbtSearch();
+
     void on_slime_layer_btn_clicked();
 
     void on_actor_layer_btn_clicked();
@@ -119,14 +150,40 @@ class MainWindow : public QMainWindow {
 
     void on_global_data_btn_clicked();
 
-    void collect_villages(const std::unordered_map<std::string, std::array<bl::palette::compound_tag *, 4>> &vs);
+    void collect_villages(const std::unordered_map<std::string, QRect> &vs);
 
     void on_save_other_btn_clicked();
 
-    void prepareGlobalData(GlobalNBTLoadResult &result);
+    // 在后台线程调用，用户中止或者解析失败时返回false
+    bool loadGlobalShards(GlobalNBTShards &shards);
+
+    void prepareGlobalData(GlobalNBTShards &shards);
 
     void setupShortcuts();
 
+    // snapshot_source不为空时root是它的快照，只读打开
+    void loadLevel(const QString &root, const std::string &snapshot_source = {});
+
+    /**
+     * 在后台给存档创建快照，显示进度，完成后在UI线程调用done
+     * 失败或者用户拒绝完整复制时done的参数为空
+     */
+    void createSnapshot(const QString &root, bool allow_copy, const std::function<void(const std::string &)> &done);
+
+    void startLevelDiff();
+
+    // 对比基准的快照打开之后开始对比
+    void runLevelDiff(const QString &root);
+
+    void stopLevelDiff();
+
+    // 在后台统计当前存档的实体，完成后可以导出CSV/JSON
+    void startEntityCensus();
+
+    void stopEntityCensus();
+
+    void saveJsonReport(const QString &title, const QString &default_name, const std::string &json);
+
    private:
     QString getStaticTitle();
 
@@ -139,12 +196,31 @@ class MainWindow : public QMainWindow {
     ChunkEditorWidget *chunk_editor_widget_;
     // data source
     AsyncLevelLoader *level_loader_{nullptr};
+    TileServer *tile_server_{nullptr};
 
     bool write_mode_{false};
 
     // watcher
     QFutureWatcher<bool> delete_chunks_watcher_;
     QFutureWatcher<bool> load_global_data_watcher_;
+    QFutureWatcher<bool> level_diff_watcher_;
+    QFutureWatcher<bool> entity_census_watcher_;
+
+    // delete chunks
+    QProgressDialog *delete_progress_dialog_{nullptr};
+    QTimer delete_progress_timer_;
+
+    // level diff
+    LevelDiff level_diff_;
+    leveldb::DB *diff_base_db_{nullptr};
+    std::string diff_base_snapshot_;  // 对比基准的快照目录，对比结束后删除
+    QProgressDialog *diff_progress_dialog_{nullptr};
+    QTimer diff_progress_timer_;
+
+    // entity census
+    EntityCensus entity_census_;
+    QProgressDialog *census_progress_dialog_{nullptr};
+    QTimer census_progress_timer_;
 
     // global nbt editors
     NbtWidget *level_dat_editor_;
@@ -153,6 +229,7 @@ class MainWindow : public QMainWindow {
     NbtWidget *other_nbt_editor_;
 
     MapItemEditor *map_item_editor_;
+    NbtSearchDialog *nbt_search_dialog_;
 
     // global data
     QMap<QString, QRect> villages_;
@@ -163,6 +240,9 @@ class MainWindow : public QMainWindow {
     // loading global data?
     std::atomic_bool loading_global_data_{false};
     std::atomic_bool global_data_loaded_{false};
+    std::atomic_int global_data_progress_{0};  // 已经处理完的key区间数
+    std::atomic_int global_data_total_{0};
+    QTimer global_data_progress_timer_;
 
     // Shortcuts
     std::vector<QShortcut *> shortcuts_;
@@ -2,6 +2,7 @@
 #define MAPITEMEDITOR_H
 
 #include <QWidget>
+#include <vector>
 
 #include "global.h"
 #include "nbtwidget.h"
@@ -21,7 +22,8 @@ class MapItemEditor : public QWidget {
 
     ~MapItemEditor() override;
 
-    void load_map_data(const bl::general_kv_nbts &data);
+    // 全局数据是分片加载的，每个分片一份，原始数据会被移走
+    void load_map_data(const std::vector<std::vector<RawNBTEntry> *> &data);
 
     void paintEvent(QPaintEvent *event) override;
 
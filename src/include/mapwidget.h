@@ -1,6 +1,7 @@
 #ifndef MAPWIDGET_H
 #define MAPWIDGET_H
 
+#include <QElapsedTimer>
 #include <QObject>
 #include <QPaintEvent>
 #include <QTimer>
@@ -28,6 +29,7 @@ class MapWidget : public QWidget {
         setMouseTracking(true);
         this->setContextMenuPolicy(Qt::CustomContextMenu);
         setFocusPolicy(Qt::FocusPolicy::StrongFocus);
+        this->pan_clock_.start();
     }
 
     void paintEvent(QPaintEvent *event) override;
@@ -44,10 +46,7 @@ class MapWidget : public QWidget {
     bl::block_pos getCursorBlockPos();
 
    public:
-    inline void changeDimension(DimType dim) {
-        this->dim_type_ = dim;
-        this->update();
-    }
+    void changeDimension(DimType dim);
 
     inline void changeLayer(MainRenderType layer) {
         this->main_render_type_ = layer;
@@ -86,6 +85,11 @@ class MapWidget : public QWidget {
 
     inline void setDrawDebug(bool enable) { this->draw_debug_window_ = enable; }
 
+    inline void setDrawDiff(bool enable) {
+        this->draw_diff_ = enable;
+        this->update();
+    }
+
     // 生成图片
     void saveImageAction(bool full_screen);
 
@@ -114,6 +118,9 @@ class MapWidget : public QWidget {
 
     void gotoBlockPos(int x, int z);
 
+    // 根据区块索引的包围盒缩放并居中，显示当前维度的整个世界
+    void fitWorldToView();
+
     inline void focusOnCursor() {
         auto p = this->getCursorBlockPos();
         gotoBlockPos(p.x, p.z);
@@ -153,10 +160,14 @@ class MapWidget : public QWidget {
 
     void drawHSAs(QPaintEvent *event, QPainter *p);
 
+    void drawDiff(QPaintEvent *event, QPainter *p);
+
     void drawSelectArea(QPaintEvent *event, QPainter *p);
 
     void drawVillages(QPaintEvent *event, QPainter *p);
 
+    void drawSearchHits(QPaintEvent *event, QPainter *p);
+
     void drawMarkers(QPaintEvent *event, QPainter *p);
 
     QRect getRenderSelectArea();
@@ -164,6 +175,12 @@ class MapWidget : public QWidget {
 
     std::tuple<bl::chunk_pos, bl::chunk_pos, QRect> getRenderRange(const QRect &camera);
 
+    // 记录一次平移(origin_的变化量)，用于估计平移速度
+    void trackPan(const QPoint &delta);
+
+    // 根据平移速度和缩放方向预取即将进入视野的区域
+    void prefetchAhead();
+
     ~MapWidget() override;
 
    signals:
@@ -193,6 +210,7 @@ class MapWidget : public QWidget {
     bool draw_actors_{false};
     bool draw_villages_{false};
     bool draw_HSA_{false};
+    bool draw_diff_{false};
 
     int cw_{64};           // 每个区块需要几个像素
     QPoint origin_{0, 0};  // 记录区块0,0的左上角相对widget左上角的坐标
@@ -200,6 +218,13 @@ class MapWidget : public QWidget {
     bool draw_coords_{false};
     bool draw_debug_window_{false};
 
+    // prefetch
+    QElapsedTimer pan_clock_;
+    qint64 last_pan_ms_{-1};
+    qint64 last_zoom_ms_{-1};
+    QPointF pan_velocity_{0, 0};  // origin_的移动速度，单位是像素/毫秒
+    int zoom_dir_{0};             // 最近一次缩放的方向，负数表示缩小
+
     // opened chunk
     bool opened_chunk_{false};
     bl::chunk_pos opened_chunk_pos_;
@@ -0,0 +1,48 @@
+#ifndef BEDROCKMAP_MEMSTATS_H
+#define BEDROCKMAP_MEMSTATS_H
+
+#include <QString>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "palette.h"
+
+/**
+ * 内存占用统计
+ * 进程级别的数据从操作系统读取，各个模块的占用由模块自己上报(估算值)
+ */
+struct MemStats {
+    enum Consumer { RegionImages, TipsInfo, ActorMaps, SlimeCache, NegativeCache, NbtTrees, IconPools, ChunkBitmap, CONSUMER_COUNT };
+
+    // 单位都是字节，读取失败时为-1
+    struct ProcessMemory {
+        int64_t rss{-1};     // 常驻内存
+        int64_t heap{-1};    // 堆(Linux下为数据段，Windows下为私有提交内存)
+        int64_t mapped{-1};  // 虚拟地址空间
+    };
+
+    static void add(Consumer c, int64_t bytes);
+
+    // 用于缓存大小这类可以直接算出来的值
+    static void set(Consumer c, int64_t bytes);
+
+    static int64_t get(Consumer c);
+
+    static const char *name(Consumer c);
+
+    static ProcessMemory processMemory();
+
+    // NBT树的大致内存占用
+    static int64_t estimateNbt(bl::palette::abstract_tag *tag);
+
+    static std::vector<QString> debugInfo();
+
+    static std::string toJson();
+
+   private:
+    static std::atomic<int64_t> consumers_[CONSUMER_COUNT];
+};
+
+#endif  // BEDROCKMAP_MEMSTATS_H
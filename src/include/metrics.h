@@ -0,0 +1,91 @@
+#ifndef BEDROCKMAP_METRICS_H
+#define BEDROCKMAP_METRICS_H
+
+#include <QString>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * 无锁的延迟直方图(单位微秒)
+ * 按2的幂分段，每段再均分成4个桶，百分位的误差不超过25%
+ */
+class LatencyHistogram {
+   public:
+    static constexpr int SUB_BUCKETS = 4;
+    static constexpr int BUCKETS = 40 * SUB_BUCKETS;
+
+    void record(int64_t us);
+
+    void reset();
+
+    [[nodiscard]] uint64_t count() const { return this->count_; }
+
+    [[nodiscard]] double mean() const;
+
+    [[nodiscard]] int64_t max() const { return static_cast<int64_t>(this->max_.load()); }
+
+    // 返回所在桶的上界
+    [[nodiscard]] int64_t percentile(double q) const;
+
+   private:
+    static int bucketOf(uint64_t v);
+
+    static uint64_t bucketUpper(int idx);
+
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets_{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+/**
+ * 区域加载管线的统计数据，release版本也会一直记录
+ * 后台线程直接写入，不需要加锁
+ */
+class PipelineMetrics {
+   public:
+    enum Stage { QueueWait, Load, Bake, Shade, CacheInsert, STAGE_COUNT };
+
+    // 和MapWidget::MainRenderType的编号一致
+    enum Layer { Biome, Terrain, Height, Slime, LAYER_COUNT };
+
+    enum Lookup { Hit, Empty, Miss };
+
+    using Clock = std::chrono::steady_clock;
+
+    void record(Stage stage, Clock::duration d);
+
+    void recordLookup(int layer, Lookup r);
+
+    void recordQueueDepth(size_t depth);
+
+    [[nodiscard]] const LatencyHistogram &histogram(Stage stage) const { return this->stages_[stage]; }
+
+    [[nodiscard]] std::vector<QString> debugInfo() const;
+
+    [[nodiscard]] std::string toJson() const;
+
+    void reset();
+
+    static const char *stageName(Stage stage);
+
+    static const char *layerName(int layer);
+
+   private:
+    struct LookupCounter {
+        std::atomic<uint64_t> hit{0};
+        std::atomic<uint64_t> empty{0};
+        std::atomic<uint64_t> miss{0};
+    };
+
+    std::array<LatencyHistogram, STAGE_COUNT> stages_{};
+    std::array<LookupCounter, LAYER_COUNT> lookups_{};
+    std::atomic<uint64_t> queue_depth_{0};
+    std::atomic<uint64_t> peak_queue_depth_{0};
+};
+
+#endif  // BEDROCKMAP_METRICS_H
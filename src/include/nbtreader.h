@@ -0,0 +1,109 @@
+#ifndef BEDROCKMAP_NBTREADER_H
+#define BEDROCKMAP_NBTREADER_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// 直接在原始的小端NBT数据上读取，不构建bl::palette的树，也不分配内存
+
+enum class NbtType : uint8_t { End, Byte, Short, Int, Long, Float, Double, ByteArray, String, List, Compound, IntArray, LongArray };
+
+struct NbtValue {
+    NbtType type{NbtType::End};
+    int64_t i{0};        // 整数值，数组和列表为元素个数
+    double f{0};         // 浮点值，整数也会转换过来，方便比较
+    std::string_view s;  // 字符串，数组为原始字节；引用原始数据，不能比数据活得久
+
+    [[nodiscard]] inline bool isNumber() const { return this->type >= NbtType::Byte && this->type <= NbtType::Double; }
+};
+
+/**
+ * 需要读取的NBT路径集合，构造好以后只读，可以在多个线程之间共享
+ * 路径格式: Pos[0]、Items[].Name、tag.display.Name，[]表示列表的任意元素
+ */
+class NbtProjection {
+   public:
+    NbtProjection();
+
+    // 返回路径编号(按添加顺序从0开始)，格式不对时返回-1
+    int add(const std::string &path);
+
+    [[nodiscard]] inline size_t size() const { return this->path_count_; }
+
+   private:
+    friend class NbtReader;
+
+    static constexpr int KEY = -2;
+    static constexpr int ANY = -1;
+
+    struct Node {
+        std::string key;
+        int index{KEY};  // 列表下标，KEY表示compound成员，ANY表示任意列表元素
+        std::vector<int> children;
+        std::vector<int> ids;  // 在这个节点结束的路径
+    };
+
+    int child(int parent, const std::string &key, int index);
+
+    std::vector<Node> nodes_;
+    size_t path_count_{0};
+};
+
+/**
+ * 拉取式读取器，数据格式错误时不抛异常，读取函数返回false并记录错误
+ * 一个value里可能连续存放多个根tag(比如旧版的实体数据)，循环读取直到atEnd()
+ */
+class NbtReader {
+   public:
+    using Callback = std::function<void(int id, const NbtValue &value)>;
+
+    NbtReader(const char *data, size_t size) : data_(data), size_(size) {}
+
+    explicit NbtReader(std::string_view data) : NbtReader(data.data(), data.size()) {}
+
+    [[nodiscard]] inline bool atEnd() const { return this->pos_ >= this->size_ || this->error_; }
+
+    [[nodiscard]] inline bool ok() const { return !this->error_; }
+
+    [[nodiscard]] inline const char *error() const { return this->error_ ? this->error_ : ""; }
+
+    [[nodiscard]] inline size_t offset() const { return this->pos_; }
+
+    // 读取tag的类型和名字，End没有名字
+    bool nextTag(NbtType &type, std::string_view &name);
+
+    // 读取一个非容器类型的值
+    bool readValue(NbtType type, NbtValue &value);
+
+    // 跳过一个值(包括整个子树)
+    bool skip(NbtType type);
+
+    // 读取一个根tag，把路径命中的值交给回调，没有命中的子树直接跳过
+    bool project(const NbtProjection &projection, const Callback &cb);
+
+    // 跳过一个根tag
+    bool skipTag();
+
+   private:
+    static constexpr int MAX_DEPTH = 512;
+
+    bool fail(const char *msg);
+
+    bool need(size_t n);
+
+    bool readLength(int32_t &len);
+
+    bool skip(NbtType type, int depth);
+
+    bool projectPayload(const NbtProjection &projection, int node, NbtType type, const Callback &cb, int depth);
+
+    const char *data_;
+    size_t size_;
+    size_t pos_{0};
+    const char *error_{nullptr};
+};
+
+#endif  // BEDROCKMAP_NBTREADER_H
@@ -0,0 +1,84 @@
+#ifndef BEDROCKMAP_NBTSEARCH_H
+#define BEDROCKMAP_NBTSEARCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "nbtreader.h"
+#include "recordscan.h"
+
+struct NbtSearchHit {
+    NbtRecordScan::Kind kind{NbtRecordScan::BlockEntity};
+    int dim{-1};  // 找不到维度的新版实体为-1
+    double x{0};
+    double y{0};
+    double z{0};
+    std::string id;
+};
+
+/**
+ * NBT查询条件
+ * 语法: 路径 [运算符 值]，多个条件用&&和||连接，&&优先
+ * 运算符: == != < <= > >= ~=(字符串包含)，只写路径表示存在即可；路径中的[]会匹配列表的任意元素
+ * 例: id == "Chest" && Items[].Name == "minecraft:elytra"
+ */
+class NbtQuery {
+   public:
+    bool parse(const std::string &text, std::string &error);
+
+    /**
+     * 检查一条记录里的每个根tag，满足条件的交给回调
+     * @return 数据格式是否正确
+     */
+    bool match(const NbtRecordScan::Record &record, const std::function<void(NbtSearchHit &&)> &onHit) const;
+
+   private:
+    enum Op { Exists, Eq, Ne, Lt, Le, Gt, Ge, Contains };
+
+    struct Clause {
+        Op op{Exists};
+        std::string text;
+        double number{0};
+        bool is_number{false};
+
+        [[nodiscard]] bool test(const NbtValue &v) const;
+    };
+
+    NbtProjection projection_;
+    std::vector<Clause> clauses_;   // 第k个条件的路径编号是RESERVED_PATHS + k
+    std::vector<uint64_t> groups_;  // 用||分开的每一组条件的掩码
+};
+
+/**
+ * 全存档的NBT搜索，结果在遍历过程中陆续放进队列，UI线程定时取走
+ */
+class NbtSearch {
+   public:
+    bool run(leveldb::DB *db, int threads, const NbtQuery &query, uint8_t kinds);
+
+    inline void cancel() { this->scan_.cancel(); }
+
+    inline void reset() { this->scan_.reset(); }
+
+    inline int progress() const { return this->scan_.progress(); }
+
+    inline int total() const { return this->scan_.total(); }
+
+    inline size_t hitCount() const { return this->hit_count_; }
+
+    // 取走上次调用之后新找到的结果
+    std::vector<NbtSearchHit> takeHits();
+
+   private:
+    NbtRecordScan scan_;
+    std::mutex mu_;
+    std::vector<NbtSearchHit> pending_;
+    std::atomic<size_t> hit_count_{0};
+    std::atomic<size_t> bad_records_{0};
+};
+
+#endif  // BEDROCKMAP_NBTSEARCH_H
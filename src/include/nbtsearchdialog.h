@@ -0,0 +1,61 @@
+#ifndef NBTSEARCHDIALOG_H
+#define NBTSEARCHDIALOG_H
+
+#include <QDialog>
+#include <QFutureWatcher>
+#include <QListWidgetItem>
+#include <QTimer>
+#include <vector>
+
+#include "nbtsearch.h"
+
+namespace Ui {
+    class NbtSearchDialog;
+}
+
+class MainWindow;
+
+/**
+ * 全存档NBT搜索窗口，结果边搜边显示，同时标在地图上
+ */
+class NbtSearchDialog : public QDialog {
+    Q_OBJECT
+
+   public:
+    explicit NbtSearchDialog(MainWindow *mw, QWidget *parent = nullptr);
+
+    ~NbtSearchDialog() override;
+
+    // 已经取到的结果，地图会把当前维度的结果画出来
+    [[nodiscard]] inline const std::vector<NbtSearchHit> &hits() const { return this->hits_; }
+
+    // 停止正在进行的搜索并等待结束，关闭存档前调用
+    void stop();
+
+    void clearResults();
+
+   private slots:
+
+    void on_search_btn_clicked();
+
+    void on_stop_btn_clicked();
+
+    void on_clear_btn_clicked();
+
+    void on_result_list_itemDoubleClicked(QListWidgetItem *item);
+
+    void handle_search_finished();
+
+   private:
+    void drainHits();
+
+    Ui::NbtSearchDialog *ui;
+    MainWindow *mw_{nullptr};
+    NbtQuery query_;
+    NbtSearch search_;
+    std::vector<NbtSearchHit> hits_;
+    QFutureWatcher<bool> search_watcher_;
+    QTimer progress_timer_;
+};
+
+#endif  // NBTSEARCHDIALOG_H
@@ -9,7 +9,9 @@
 #include <QTreeWidgetItem>
 #include <QWidget>
 #include <string>
+#include <utility>
 
+#include "memstats.h"
 #include "palette.h"
 
 namespace Ui {
@@ -41,31 +43,43 @@ class NBTTreeItem : public QTreeWidgetItem {
     bl::palette::abstract_tag *root_{nullptr};
 };
 
-// 持有数据
+// leveldb中的key和原始value
+using RawNBTEntry = std::pair<std::string, std::string>;
 
+// 持有数据
+// 从存档读出来的数据只保存原始的value，第一次打开时才解析，没有修改过的数据保存时直接写回原始value
 struct NBTListItem : public QListWidgetItem {
     QString getLabel() {
         auto dyn = this->namer_(root_);
         return dyn.size() == 0 ? default_label : dyn;
     }
 
+    // 解析失败时返回nullptr
+    bl::palette::compound_tag *tag();
+
+    std::string toRaw() const;
+
+    inline void markModified() { this->modified_ = true; }
+
     bl::palette::compound_tag *root_{nullptr};                                                                   // 原始数据
     std::function<QString(bl::palette::compound_tag *)> namer_{[](bl::palette::compound_tag *) { return ""; }};  // 动态标签
     QString default_label;                                                                                       // 外显标签
     QString raw_key;  // leveldb中key结构的原始key
-    ~NBTListItem() override { delete this->root_; }
+    std::string raw_;  // 还没解析的原始value
+    bool modified_{false};
+    int64_t tracked_bytes_{0};
+    ~NBTListItem() override {
+        MemStats::add(MemStats::NbtTrees, -this->tracked_bytes_);
+        delete this->root_;
+    }
 
     /*
      * 构造一一个没有动态标签和ICON的NBTListItem
      */
-    static NBTListItem *from(bl::palette::compound_tag *data, const QString &default_label, const QString &key = "") {
-        auto *it = new NBTListItem();
-        it->root_ = data;
-        it->default_label = default_label;
-        it->raw_key = key.isEmpty() ? default_label : key;
-        it->setText(it->getLabel());
-        return it;
-    }
+    static NBTListItem *from(bl::palette::compound_tag *data, const QString &default_label, const QString &key = "");
+
+    // 只保存原始数据，不解析
+    static NBTListItem *fromRaw(std::string raw, const QString &default_label, const QString &key);
 };
 
 struct NBTNodeUIAttr {
@@ -157,6 +171,9 @@ class NbtWidget : public QWidget {
    private:
     void openNBTItem(bl::palette::compound_tag *root);
 
+    // 当前打开的数据被编辑过，重新序列化后放进修改缓存
+    void putOpenedModifyToCache();
+
    private:
     // 不存数据，只引用数据
     Ui::NbtWidget *ui;
@@ -0,0 +1,54 @@
+#ifndef BEDROCKMAP_POOLSIZER_H
+#define BEDROCKMAP_POOLSIZER_H
+
+#include <QString>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/**
+ * 根据后台任务的I/O等待比例和吞吐量自动调整线程数
+ * 后台线程在任务结束时记录墙钟时间和线程CPU时间，UI线程定时调用adjust
+ * 任务大部分时间在等LevelDB的读取时增加线程，CPU已经吃满时减少线程，
+ * 增加线程之后吞吐量没有明显提高、减少线程之后吞吐量下降就退回去(爬山法)
+ * 整个进程已经用满所有核心时不会超过核心数，这时的等待是在排队而不是I/O
+ */
+class PoolSizer {
+   public:
+    PoolSizer(int initial, int min, int max);
+
+    // 当前线程消耗的CPU时间(微秒)
+    static int64_t threadCpuTime();
+
+    // 整个进程消耗的CPU时间(微秒)
+    static int64_t processCpuTime();
+
+    // 后台线程调用
+    void record(int64_t wall_us, int64_t cpu_us);
+
+    // 返回新的线程数，backlog是还在排队的任务数
+    int adjust(size_t backlog);
+
+    [[nodiscard]] int size() const { return this->size_; }
+
+    [[nodiscard]] std::vector<QString> debugInfo() const;
+
+   private:
+    static constexpr uint64_t MIN_SAMPLES = 8;  // 样本太少时不做决定
+
+    std::atomic<uint64_t> wall_us_{0};
+    std::atomic<uint64_t> cpu_us_{0};
+    std::atomic<uint64_t> tasks_{0};
+
+    int size_;
+    int min_;
+    int max_;
+    int last_step_{0};
+    double last_throughput_{0};  // 上一个窗口每秒完成的任务数
+    double io_ratio_{0};         // 上一个窗口中等待I/O的时间占比
+    double cpu_load_{0};         // 上一个窗口中进程CPU时间占所有核心的比例
+    int64_t window_start_us_{0};
+    int64_t window_cpu_us_{0};
+};
+
+#endif  // BEDROCKMAP_POOLSIZER_H
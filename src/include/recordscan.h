@@ -0,0 +1,59 @@
+#ifndef BEDROCKMAP_RECORDSCAN_H
+#define BEDROCKMAP_RECORDSCAN_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+#include "bedrock_key.h"
+#include "leveldb/db.h"
+
+/**
+ * 并行遍历存档里的NBT记录：方块实体、旧版实体(区块内的Entity)和新版实体(actorprefix)
+ * 只把原始value交给调用者，解析交给NbtReader
+ */
+class NbtRecordScan {
+   public:
+    enum Kind : uint8_t { BlockEntity = 1, Entity = 2, Actor = 4, AllKinds = 7 };
+
+    struct Record {
+        Kind kind;
+        bl::chunk_pos cp;      // 所在区块；新版实体取digp里记录的区块，找不到时dim为-1
+        leveldb::Slice value;  // 可能连续存放了多个根tag
+    };
+
+    // 第一个参数是区间编号，同一个区间只会在一个线程里处理；返回false时停止
+    using Visitor = std::function<bool(size_t range, const Record &record)>;
+
+    /**
+     * 遍历存档，阻塞直到完成或者被取消
+     * 有新版实体时先遍历一遍digp建立实体uid到区块的映射(key里没有维度信息)
+     * @param kinds 需要的记录种类(Kind按位或)
+     * @param init 区间划分完成后、开始遍历前调用，参数是区间数量，用来准备每个区间自己的结果
+     * @return 是否完整地遍历完成
+     */
+    bool run(leveldb::DB *db, int threads, uint8_t kinds, const std::function<void(size_t)> &init, const Visitor &fn);
+
+    inline void cancel() { this->cancel_ = true; }
+
+    // 在提交任务之前由UI线程调用，run不会清除取消标记，任务开始之前的cancel不会丢失
+    inline void reset() { this->cancel_ = false; }
+
+    [[nodiscard]] inline bool cancelled() const { return this->cancel_; }
+
+    inline int progress() const { return this->progress_; }
+
+    inline int total() const { return this->total_; }
+
+    static const char *kindName(Kind kind);
+
+    // 搜索结果、实体统计和导出的文件共用的维度名称
+    static const char *dimName(int dim);
+
+   private:
+    std::atomic_bool cancel_{false};
+    std::atomic_int progress_{0};
+    std::atomic_int total_{0};
+};
+
+#endif  // BEDROCKMAP_RECORDSCAN_H
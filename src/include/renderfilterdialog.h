@@ -3,6 +3,7 @@
 
 #include <QDialog>
 #include <QtDebug>
+#include <cstdint>
 #include <unordered_set>
 
 namespace Ui {
@@ -32,6 +33,9 @@ struct MapFilter {
 
     void bakeChunkActors(bl::chunk *ch, ChunkRegion *region) const;
 
+    // 按内容计算的哈希，内容相同的过滤器烘焙结果相同，可以共用缓存
+    [[nodiscard]] uint64_t hash() const;
+
     // void bakeChunkHeight(bl::chunk *ch, int rw, int rh, ChunkRegion *region) const;
 };
 
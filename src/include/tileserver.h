@@ -0,0 +1,101 @@
+#ifndef TILESERVER_H
+#define TILESERVER_H
+
+#include <QByteArray>
+#include <QCache>
+#include <QHash>
+#include <QObject>
+#include <QPointer>
+#include <QSet>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <unordered_map>
+#include <vector>
+
+#include "config.h"
+
+class AsyncLevelLoader;
+
+/**
+ * 本地瓦片服务器
+ * 提供 /{dim}/{layer}/{z}/{x}/{y}.png 格式的瓦片(Leaflet兼容，tileSize为128)
+ * - z == NATIVE_ZOOM 时一个瓦片就是一个区域(1像素 = 1方块)
+ * - z每减少1，一个瓦片覆盖的区域边长翻倍
+ * 所有数据都来自AsyncLevelLoader的区域缓存和线程池
+ */
+class TileServer : public QObject {
+    Q_OBJECT
+
+   public:
+    static constexpr int NATIVE_ZOOM = 3;
+    static constexpr int MIN_ZOOM = 0;
+    static constexpr int TILE_SIZE = cfg::RW << 4;
+
+    explicit TileServer(AsyncLevelLoader *loader, QObject *parent = nullptr);
+
+    ~TileServer() override;
+
+    bool listen(quint16 port);
+
+    void close();
+
+    inline bool isListening() const { return this->server_.isListening(); }
+
+    inline quint16 port() const { return this->server_.serverPort(); }
+
+   private slots:
+
+    void handleNewConnection();
+
+    void handleReadyRead();
+
+    void handleRegionLoaded(int x, int z, int dim);
+
+   private:
+    struct TileRequest {
+        int dim{0};
+        int layer{0};
+        int zoom{0};
+        int x{0};
+        int y{0};
+
+        [[nodiscard]] QString key() const;
+    };
+
+    // 同一个瓦片的多个请求共享一次烘焙
+    struct PendingTile {
+        TileRequest request;
+        std::vector<std::pair<QPointer<QTcpSocket>, QByteArray>> waiters;  // socket + If-None-Match
+    };
+
+    static bool parsePath(const QString &path, TileRequest &req);
+
+    std::vector<region_pos> tileRegions(const TileRequest &req) const;
+
+    // 所有区域都就绪时返回true，同时计算ETag
+    bool tileReady(const TileRequest &req, QByteArray &etag);
+
+    QByteArray renderTile(const TileRequest &req);
+
+    void serveTile(const TileRequest &req, const QByteArray &etag, QTcpSocket *socket, const QByteArray &if_none_match);
+
+    void retryPendingTiles();
+
+    // 瓦片的区域都就绪时响应所有等待的请求，返回是否已经处理
+    bool servePendingTile(const QString &key);
+
+    static void writeResponse(QTcpSocket *socket, int code, const QByteArray &status, const QByteArray &body,
+                              const QByteArray &extra_headers = {});
+
+   private:
+    AsyncLevelLoader *loader_;
+    QTcpServer server_;
+    QHash<QTcpSocket *, QByteArray> buffers_;
+    QHash<QString, PendingTile> pending_;
+    std::unordered_map<region_pos, QSet<QString>> pending_regions_;  // 区域 -> 包含它的挂起瓦片
+    QCache<QByteArray, QByteArray> png_cache_{256};  // ETag -> PNG
+    QTimer retry_timer_;
+};
+
+#endif  // TILESERVER_H
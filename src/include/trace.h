@@ -0,0 +1,59 @@
+#ifndef BEDROCKMAP_TRACE_H
+#define BEDROCKMAP_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/**
+ * 记录Chrome trace-event格式的性能追踪数据，可以直接用Perfetto或者chrome://tracing打开
+ * 每个线程写自己的环形缓冲区，记录时不加锁；关闭时只有一次原子读取的开销
+ * 事件名必须是字符串字面量(只保存指针)
+ */
+class Trace {
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    static inline bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    static void setEnabled(bool enable);
+
+    // 给当前线程起名字，显示在Perfetto的线程列表里
+    static void setThreadName(const char *name);
+
+    // 记录一个已经结束的区间
+    static void complete(const char *name, Clock::time_point begin, Clock::time_point end);
+
+    static bool writeJson(const std::string &path);
+
+    static void clear();
+
+   private:
+    static std::atomic_bool enabled_;
+};
+
+class TraceScope {
+   public:
+    explicit TraceScope(const char *name) : name_(Trace::enabled() ? name : nullptr) {
+        if (this->name_) this->begin_ = Trace::Clock::now();
+    }
+
+    ~TraceScope() {
+        if (this->name_) Trace::complete(this->name_, this->begin_, Trace::Clock::now());
+    }
+
+    TraceScope(const TraceScope &) = delete;
+
+    TraceScope &operator=(const TraceScope &) = delete;
+
+   private:
+    const char *name_;
+    Trace::Clock::time_point begin_;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+#endif  // BEDROCKMAP_TRACE_H
@@ -0,0 +1,126 @@
+#include "leveldiff.h"
+
+#include <QtDebug>
+#include <memory>
+#include <mutex>
+
+#include "keyutils.h"
+#include "levelscan.h"
+
+namespace {
+    // 单个区块内所有key的比较情况
+    enum KeyFlag : uint8_t {
+        OnlyCurrent = 1,
+        OnlyBase = 2,
+        BothSame = 4,
+        BothDiffer = 8,
+    };
+
+    bool chunkOfKey(const leveldb::Slice &key, bl::chunk_pos &cp) {
+        int type{0};
+        return parseChunkKeyPos(key.data(), key.size(), cp, type) || parseDigestKeyPos(key.data(), key.size(), cp);
+    }
+
+    LevelDiff::State flagsToState(uint8_t flags) {
+        if (flags & BothDiffer) return LevelDiff::Changed;
+        if (flags == OnlyCurrent) return LevelDiff::Added;
+        if (flags == OnlyBase) return LevelDiff::Removed;
+        if (flags == BothSame) return LevelDiff::Same;
+        return LevelDiff::Changed;  // 部分key新增或者删除
+    }
+}  // namespace
+
+bool LevelDiff::compare(leveldb::DB *current, leveldb::DB *base, int threads) {
+    this->clear();
+    if (!current || !base) return false;
+    auto ranges = splitKeyRanges(current, static_cast<size_t>(threads) * 8);
+    this->total_ = static_cast<int>(ranges.size());
+    this->progress_ = 0;
+
+    std::mutex mu;
+    std::unordered_map<bl::chunk_pos, uint8_t> flags;
+    parallelForRanges(ranges, threads, [&](size_t, const KeyRange &range) {
+        std::unordered_map<bl::chunk_pos, uint8_t> local;
+        auto opt = bulkReadOptions();
+        std::unique_ptr<leveldb::Iterator> a(current->NewIterator(opt));
+        std::unique_ptr<leveldb::Iterator> b(base->NewIterator(opt));
+        a->Seek(range.begin);
+        b->Seek(range.begin);
+        bl::chunk_pos cp;
+        while (!this->cancel_) {
+            const bool va = a->Valid() && inRange(a->key(), range);
+            const bool vb = b->Valid() && inRange(b->key(), range);
+            if (!va && !vb) break;
+            const int c = !va ? 1 : (!vb ? -1 : a->key().compare(b->key()));
+            if (c < 0) {
+                if (chunkOfKey(a->key(), cp)) local[cp] |= OnlyCurrent;
+                a->Next();
+            } else if (c > 0) {
+                if (chunkOfKey(b->key(), cp)) local[cp] |= OnlyBase;
+                b->Next();
+            } else {
+                // 只比较value的原始字节
+                if (chunkOfKey(a->key(), cp)) local[cp] |= (a->value() == b->value()) ? BothSame : BothDiffer;
+                a->Next();
+                b->Next();
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lk(mu);
+            for (auto &kv : local) flags[kv.first] |= kv.second;
+        }
+        ++this->progress_;
+        return !this->cancel_;
+    });
+
+    if (this->cancel_) return false;
+    for (auto &kv : flags) {
+        auto s = flagsToState(kv.second);
+        if (s != Same) this->states_[kv.first] = s;
+    }
+    qInfo() << "Level diff finished: " << this->count(Added) << " added, " << this->count(Removed) << " removed, " << this->count(Changed)
+            << " changed";
+    return true;
+}
+
+void LevelDiff::clear() {
+    this->states_.clear();
+    this->image_cache_.clear();
+    this->progress_ = 0;
+    this->total_ = 0;
+}
+
+LevelDiff::State LevelDiff::state(const bl::chunk_pos &cp) const {
+    auto it = this->states_.find(cp);
+    return it == this->states_.end() ? Same : it->second;
+}
+
+size_t LevelDiff::count(LevelDiff::State s) const {
+    size_t res = 0;
+    for (auto &kv : this->states_) {
+        if (kv.second == s) res++;
+    }
+    return res;
+}
+
+QImage *LevelDiff::regionImage(const region_pos &rp) {
+    auto *img = this->image_cache_.object(rp);
+    if (img) return img;
+    auto *res = new QImage(cfg::RW << 4, cfg::RW << 4, QImage::Format_Indexed8);
+    res->setColor(Same, qRgba(0, 0, 0, 0));
+    res->setColor(Added, qRgba(46, 204, 113, 150));
+    res->setColor(Removed, qRgba(231, 76, 60, 150));
+    res->setColor(Changed, qRgba(241, 196, 15, 150));
+    for (int rw = 0; rw < cfg::RW; rw++) {
+        for (int rh = 0; rh < cfg::RW; rh++) {
+            auto color = this->state(bl::chunk_pos(rp.x + rw, rp.z + rh, rp.dim));
+            for (int i = 0; i < 16; i++) {
+                for (int j = 0; j < 16; j++) {
+                    res->setPixel((rw << 4) + i, (rh << 4) + j, color);
+                }
+            }
+        }
+    }
+    this->image_cache_.insert(rp, res);
+    return res;
+}
@@ -0,0 +1,151 @@
+#include "levelscan.h"
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+
+#include "config.h"
+#include "keyutils.h"
+
+namespace {
+    constexpr size_t MAX_SPLIT_DEPTH = 6;
+
+    // 互相不是前缀关系，切出来的区间不会重叠
+    const char *const GLOBAL_KEY_PREFIXES[]{"~local_player", "player", "VILLAGE_", "map_", "portals", "scoreboard", "AutonomousEntities",
+                                            "BiomeData", "Nether", "Overworld", "TheEnd", "schedulerWT", "mobevents"};
+
+    struct PendingRange {
+        KeyRange range;
+        std::string prefix;  // 区间内所有key共同的前缀
+    };
+
+    // 把以prefix开头的区间[begin, end)按照prefix之后的一个字节切成256段
+    std::vector<PendingRange> splitByNextByte(const std::string &prefix, const std::string &begin, const std::string &end) {
+        std::vector<PendingRange> res;
+        res.reserve(256);
+        for (int b = 0; b < 256; b++) {
+            PendingRange r;
+            r.prefix = prefix + static_cast<char>(b);
+            r.range.begin = b == 0 ? begin : r.prefix;  // 第一段要包含正好等于prefix的key
+            r.range.end = b == 255 ? end : prefix + static_cast<char>(b + 1);
+            res.push_back(std::move(r));
+        }
+        return res;
+    }
+
+    std::string prefixEnd(const std::string &prefix) {
+        // 前缀之后的第一个key，全是0xff时没有上界
+        std::string res = prefix;
+        while (!res.empty()) {
+            auto c = static_cast<uint8_t>(res.back());
+            if (c != 0xff) {
+                res.back() = static_cast<char>(c + 1);
+                return res;
+            }
+            res.pop_back();
+        }
+        return res;
+    }
+
+    std::vector<uint64_t> approximateSizes(leveldb::DB *db, const std::vector<KeyRange> &ranges) {
+        static const std::string MAX_KEY(32, '\xff');
+        std::vector<leveldb::Range> lr;
+        lr.reserve(ranges.size());
+        for (auto &r : ranges) lr.emplace_back(r.begin, r.end.empty() ? MAX_KEY : r.end);
+        std::vector<uint64_t> sizes(ranges.size(), 0);
+        db->GetApproximateSizes(lr.data(), static_cast<int>(lr.size()), sizes.data());
+        return sizes;
+    }
+}  // namespace
+
+leveldb::ReadOptions bulkReadOptions() {
+    leveldb::ReadOptions opt;
+    opt.fill_cache = false;
+    opt.verify_checksums = cfg::LDB_VERIFY_CHECKSUM;
+    return opt;
+}
+
+bool isGlobalKey(const leveldb::Slice &key) {
+    bl::chunk_pos cp;
+    int type{0};
+    if (parseChunkKeyPos(key.data(), key.size(), cp, type) || parseDigestKeyPos(key.data(), key.size(), cp)) return false;
+    return !key.starts_with("actorprefix");
+}
+
+std::vector<KeyRange> globalKeyRanges(leveldb::DB *db, size_t target_count) {
+    std::vector<KeyRange> res;
+    if (!db) return res;
+    // 数据量大的前缀(通常是村庄)会被切得更细，只有一个key的前缀最后会合并成一个区间
+    for (auto *prefix : GLOBAL_KEY_PREFIXES) {
+        auto ranges = splitKeyRanges(db, target_count, prefix);
+        res.insert(res.end(), ranges.begin(), ranges.end());
+    }
+    return res;
+}
+
+std::vector<KeyRange> splitKeyRanges(leveldb::DB *db, size_t target_count, const std::string &prefix) {
+    std::vector<KeyRange> res;
+    if (!db) return res;
+    auto pending = splitByNextByte(prefix, prefix, prefixEnd(prefix));
+
+    auto sizes = [db](const std::vector<PendingRange> &rs) {
+        std::vector<KeyRange> tmp;
+        tmp.reserve(rs.size());
+        for (auto &r : rs) tmp.push_back(r.range);
+        return approximateSizes(db, tmp);
+    };
+
+    auto sz = sizes(pending);
+    uint64_t total = 0;
+    for (auto s : sz) total += s;
+    const uint64_t budget = std::max<uint64_t>(1, total / std::max<size_t>(1, target_count));
+
+    while (!pending.empty()) {
+        std::vector<PendingRange> next;
+        for (size_t i = 0; i < pending.size(); i++) {
+            auto &p = pending[i];
+            if (sz[i] > budget && p.prefix.size() < prefix.size() + MAX_SPLIT_DEPTH) {
+                for (auto &sub : splitByNextByte(p.prefix, p.range.begin, p.range.end)) next.push_back(std::move(sub));
+            } else {
+                res.push_back(p.range);
+            }
+        }
+        pending.swap(next);
+        if (!pending.empty()) sz = sizes(pending);
+    }
+    std::sort(res.begin(), res.end(), [](const KeyRange &a, const KeyRange &b) { return a.begin < b.begin; });
+
+    // 把相邻的小区间合并到不超过budget，减少迭代器的创建次数
+    // 估算为0的区间也不能丢弃，数据可能只是还在内存表里
+    auto res_sizes = approximateSizes(db, res);
+    std::vector<KeyRange> merged;
+    uint64_t merged_size = 0;
+    for (size_t i = 0; i < res.size(); i++) {
+        if (!merged.empty() && merged_size + res_sizes[i] <= budget) {
+            merged.back().end = res[i].end;
+            merged_size += res_sizes[i];
+        } else {
+            merged.push_back(res[i]);
+            merged_size = res_sizes[i];
+        }
+    }
+    return merged;
+}
+
+void parallelForRanges(const std::vector<KeyRange> &ranges, int threads, const std::function<bool(size_t, const KeyRange &)> &fn) {
+    std::atomic_size_t next{0};
+    std::atomic_bool stop{false};
+    auto worker = [&]() {
+        while (!stop) {
+            auto i = next.fetch_add(1);
+            if (i >= ranges.size()) return;
+            if (!fn(i, ranges[i])) stop = true;
+        }
+    };
+    const int n = std::max(1, std::min<int>(threads, static_cast<int>(ranges.size())));
+    std::vector<std::thread> workers;
+    workers.reserve(n - 1);
+    for (int i = 1; i < n; i++) workers.emplace_back(worker);
+    worker();
+    for (auto &t : workers) t.join();
+}
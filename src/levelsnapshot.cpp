@@ -0,0 +1,251 @@
+#include "levelsnapshot.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include "leveldb/env.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+    constexpr int MAX_ATTEMPTS = 5;
+
+    const char *const SNAPSHOT_DIR = ".bedrockmap-snapshots";
+    const char *const MARKER = ".bedrockmap-snapshot";  // 只有带这个文件的目录才会被删除
+    constexpr auto MIN_STALE_AGE = std::chrono::minutes(10);
+
+    std::string readSmallFile(const fs::path &p) {
+        std::ifstream f(p, std::ios::binary);
+        if (!f.is_open()) return {};
+        return {std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()};
+    }
+
+    bool isTableFile(const fs::path &p) { return p.extension() == ".ldb" || p.extension() == ".sst"; }
+
+    // 锁文件和LevelDB自己的运行日志不需要
+    bool isSkipped(const std::string &name) { return name == "LOCK" || name == "LOG" || name == "LOG.old"; }
+
+    bool copyFile(const fs::path &from, const fs::path &to, LevelSnapshot::Stats &stats, std::error_code &ec) {
+        fs::copy_file(from, to, fs::copy_options::overwrite_existing, ec);
+        if (ec) return false;
+        stats.copied++;
+        stats.copied_bytes += static_cast<int64_t>(fs::file_size(to, ec));
+        ec.clear();
+        return true;
+    }
+
+    // 不在同一个分区或者文件系统不支持硬链接时，只有allow_copy才退回复制
+    bool linkOrCopy(const fs::path &from, const fs::path &to, LevelSnapshot::Stats &stats, bool allow_copy, std::error_code &ec) {
+        fs::create_hard_link(from, to, ec);
+        if (!ec) {
+            stats.linked++;
+            return true;
+        }
+        if (!fs::exists(from)) return false;
+        if (!allow_copy) {
+            stats.link_failed = true;
+            return false;
+        }
+        ec.clear();
+        return copyFile(from, to, stats, ec);
+    }
+
+    fs::path worldDir(const fs::path &root) {
+        auto dir = root.lexically_normal();
+        if (!dir.has_filename()) dir = dir.parent_path();
+        return dir;
+    }
+
+    /**
+     * 快照统一放在存档所在目录下的.bedrockmap-snapshots里，保证和存档在同一个分区
+     * 这个目录的根下没有level.dat，游戏和打开对话框都不会把它当成存档
+     */
+    fs::path snapshotDir(const fs::path &root) { return worldDir(root).parent_path() / SNAPSHOT_DIR; }
+
+    fs::path snapshotPath(const fs::path &root) {
+        const auto stamp =
+            std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        const auto base = worldDir(root).filename().u8string() + "-" + std::to_string(stamp);
+        auto path = snapshotDir(root) / fs::u8path(base);
+        std::error_code ec;
+        for (int i = 1; fs::exists(path, ec); i++) path = snapshotDir(root) / fs::u8path(base + "-" + std::to_string(i));
+        return path;
+    }
+
+    // 创建期间持有标记文件的锁，打开之后数据库持有db/LOCK，能拿到锁说明没有人在用
+    bool inUse(const fs::path &lock_path) {
+        auto *env = leveldb::Env::Default();
+        leveldb::FileLock *lock{nullptr};
+        if (!env->LockFile(lock_path.u8string(), &lock).ok()) return true;
+        env->UnlockFile(lock);
+        return false;
+    }
+
+    class MarkerLock {
+       public:
+        explicit MarkerLock(const fs::path &dir) {
+            if (!leveldb::Env::Default()->LockFile((dir / MARKER).u8string(), &this->lock_).ok()) this->lock_ = nullptr;
+        }
+
+        ~MarkerLock() { this->release(); }
+
+        MarkerLock(const MarkerLock &) = delete;
+
+        MarkerLock &operator=(const MarkerLock &) = delete;
+
+        [[nodiscard]] bool locked() const { return this->lock_ != nullptr; }
+
+        // Windows下持有锁的文件不能删除，删除目录之前先释放
+        void release() {
+            if (this->lock_) leveldb::Env::Default()->UnlockFile(this->lock_);
+            this->lock_ = nullptr;
+        }
+
+       private:
+        leveldb::FileLock *lock_{nullptr};
+    };
+
+    /**
+     * 先复制CURRENT和它指向的MANIFEST，再处理其他文件
+     * 合并和落盘都是先在MANIFEST末尾追加一条记录再删除旧文件，
+     * 所以结束时CURRENT和MANIFEST都没有变化，就说明复制的MANIFEST引用的文件都已经拿到了
+     * 返回false且error为空表示需要重试
+     */
+    bool snapshotDb(const fs::path &src, const fs::path &dst, LevelSnapshot::Stats &stats, bool allow_copy,
+                    LevelSnapshot::Progress &progress, std::string &error) {
+        std::error_code ec;
+        fs::create_directories(dst, ec);
+        if (ec) {
+            error = "Can not create " + dst.u8string() + ": " + ec.message();
+            return false;
+        }
+        const auto current = readSmallFile(src / "CURRENT");
+        if (current.empty() || current.back() != '\n') {
+            error = "Invalid CURRENT file in " + src.u8string();
+            return false;
+        }
+        const auto manifest_name = current.substr(0, current.size() - 1);
+        const auto manifest = readSmallFile(src / manifest_name);
+        {
+            std::ofstream f(dst / "CURRENT", std::ios::binary);
+            f << current;
+            std::ofstream m(dst / manifest_name, std::ios::binary);
+            m << manifest;
+            if (!f.good() || !m.good()) {
+                error = "Can not write manifest to " + dst.u8string();
+                return false;
+            }
+            stats.copied += 2;
+            stats.copied_bytes += static_cast<int64_t>(current.size() + manifest.size());
+            progress.done += 2;
+        }
+
+        for (auto &entry : fs::directory_iterator(src, ec)) {
+            if (!entry.is_regular_file(ec)) continue;
+            const auto name = entry.path().filename().u8string();
+            if (isSkipped(name) || name == "CURRENT" || name.rfind("MANIFEST-", 0) == 0) continue;
+            const auto to = dst / entry.path().filename();
+            const bool ok =
+                isTableFile(entry.path()) ? linkOrCopy(entry.path(), to, stats, allow_copy, ec) : copyFile(entry.path(), to, stats, ec);
+            if (!ok) {
+                if (!fs::exists(entry.path())) return false;  // 遍历时被合并删除了
+                error = (stats.link_failed ? "Can not hard link " : "Can not snapshot ") + entry.path().u8string() + ": " + ec.message();
+                return false;
+            }
+            ++progress.done;
+        }
+        if (ec) {
+            error = "Can not list " + src.u8string() + ": " + ec.message();
+            return false;
+        }
+        return readSmallFile(src / "CURRENT") == current && fs::file_size(src / manifest_name, ec) == manifest.size();
+    }
+}  // namespace
+
+std::string LevelSnapshot::create(const std::string &root, std::string &error, LevelSnapshot::Stats *stats, bool allow_copy,
+                                  LevelSnapshot::Progress *progress) {
+    error.clear();
+    const auto src = fs::u8path(root);
+    const auto dst = snapshotPath(src);
+    std::error_code ec;
+    Progress local_progress;
+    auto &p = progress ? *progress : local_progress;
+
+    // 先统计数据库的文件数和表文件的大小
+    Stats s;
+    int db_files = 0;
+    for (auto &entry : fs::directory_iterator(src / "db", ec)) {
+        if (!entry.is_regular_file(ec)) continue;
+        db_files++;
+        if (isTableFile(entry.path())) s.table_bytes += static_cast<int64_t>(entry.file_size(ec));
+    }
+    ec.clear();
+    p.total = db_files;
+    sweep(root);
+    fs::create_directories(dst, ec);
+    if (ec) {
+        error = "Can not create " + dst.u8string() + ": " + ec.message();
+        return {};
+    }
+    MarkerLock marker(dst);
+    if (!marker.locked()) {
+        error = "Can not create marker in " + dst.u8string();
+        fs::remove_all(dst, ec);
+        return {};
+    }
+    // level.dat、levelname.txt等根目录下的小文件直接复制，子目录(行为包等)不需要
+    for (auto &entry : fs::directory_iterator(src, ec)) {
+        if (!entry.is_regular_file()) continue;
+        std::error_code copy_ec;
+        copyFile(entry.path(), dst / entry.path().filename(), s, copy_ec);
+    }
+    if (ec) {
+        error = "Can not read " + root + ": " + ec.message();
+        marker.release();
+        remove(dst.u8string());
+        return {};
+    }
+
+    for (int i = 0; i < MAX_ATTEMPTS; i++) {
+        auto db_stats = s;
+        p.done = 0;
+        fs::remove_all(dst / "db", ec);
+        const auto ok = snapshotDb(src / "db", dst / "db", db_stats, allow_copy, p, error);
+        if (stats) *stats = db_stats;
+        if (ok) return dst.u8string();
+        if (!error.empty()) break;
+    }
+    if (error.empty()) error = "The level keeps changing, try again later";
+    marker.release();
+    remove(dst.u8string());
+    return {};
+}
+
+void LevelSnapshot::remove(const std::string &snapshot_root) {
+    if (snapshot_root.empty()) return;
+    const auto dir = fs::u8path(snapshot_root);
+    std::error_code ec;
+    if (!fs::exists(dir / MARKER, ec)) return;
+    fs::remove_all(dir, ec);
+    fs::remove(dir.parent_path(), ec);  // 只有空目录才会被删除
+}
+
+void LevelSnapshot::sweep(const std::string &root) {
+    const auto dir = snapshotDir(fs::u8path(root));
+    const auto now = fs::file_time_type::clock::now();
+    std::vector<fs::path> stale;
+    std::error_code ec;
+    for (auto &entry : fs::directory_iterator(dir, ec)) {
+        std::error_code entry_ec;
+        if (!entry.is_directory(entry_ec)) continue;
+        const auto marker = entry.path() / MARKER;
+        const auto created = fs::last_write_time(marker, entry_ec);
+        // 刚创建完还没来得及打开数据库的快照两把锁都不持有，按时间排除
+        if (entry_ec || now - created < MIN_STALE_AGE || inUse(marker)) continue;
+        if (fs::exists(entry.path() / "db", entry_ec) && inUse(entry.path() / "db" / "LOCK")) continue;
+        stale.push_back(entry.path());
+    }
+    for (auto &p : stale) remove(p.u8string());
+}
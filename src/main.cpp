@@ -7,17 +7,82 @@
 #include <QIcon>
 #include <QImage>
 #include <QTextCodec>
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <iostream>
 
 #include "asynclevelloader.h"
 #include "config.h"
+#include "dbprofile.h"
+#include "entitycensus.h"
 #include "mainwindow.h"
 #include "palette.h"
 #include "resourcemanager.h"
+#include "tileserver.h"
 
 QString LOG_FILE_NAME;
 
+// 无界面模式需要在创建QApplication之前判断，所以这里直接扫描argv
+const char *findArgValue(int argc, char *argv[], const char *name) {
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::strcmp(argv[i], name) == 0) return argv[i + 1];
+    }
+    return nullptr;
+}
+
+// BedrockMap --serve <存档根目录> [--port 端口]
+int runTileServer(int argc, char *argv[], const char *world) {
+    QCoreApplication a(argc, argv);
+    AsyncLevelLoader loader;
+    auto path = QString::fromLocal8Bit(world);
+    if (!loader.open(path.toStdString())) {
+        qCritical() << "Can not open level: " << path;
+        return 1;
+    }
+    TileServer server(&loader);
+    auto *port = findArgValue(argc, argv, "--port");
+    if (!server.listen(port ? QString(port).toUShort() : static_cast<quint16>(cfg::TILE_SERVER_PORT))) {
+        return 1;
+    }
+    auto res = QCoreApplication::exec();
+    server.close();
+    loader.close();
+    return res;
+}
+
+// BedrockMap --census <存档根目录> [--out 文件.csv|文件.json] [--top 区块数]，没有--out时把CSV输出到stdout
+int runEntityCensus(int argc, char *argv[], const char *world) {
+    bl::bedrock_level level;
+    level.set_cache(false);
+    auto path = QString::fromLocal8Bit(world);
+    if (!openProfiledLevel(level, path.toStdString())) {
+        qCritical() << "Can not open level: " << path;
+        return 1;
+    }
+    EntityCensus census;
+    auto ok = census.run(level.db(), cfg::THREAD_NUM);
+    level.close();
+    if (!ok) {
+        qCritical() << "Entity census failed";
+        return 1;
+    }
+    auto *top = findArgValue(argc, argv, "--top");
+    const size_t top_n = top ? static_cast<size_t>(std::max(0, std::atoi(top))) : 20;
+    auto *out = findArgValue(argc, argv, "--out");
+    if (!out) {
+        std::cout << census.toCsv(top_n);
+        return 0;
+    }
+    if (!census.save(QString::fromLocal8Bit(out).toStdString(), top_n)) {
+        qCritical() << "Can not write census result to " << out;
+        return 1;
+    }
+    return 0;
+}
+
 void setupLog() {
     namespace fs = std::filesystem;
     if (!fs::exists("./logs")) {
@@ -84,6 +149,12 @@ int main(int argc, char *argv[]) {
 #endif
     initResources();
     cfg::initConfig();
+    if (auto *world = findArgValue(argc, argv, "--serve")) {
+        return runTileServer(argc, argv, world);
+    }
+    if (auto *world = findArgValue(argc, argv, "--census")) {
+        return runEntityCensus(argc, argv, world);
+    }
     QApplication a(argc, argv);
     setupTheme(a);
     setupFont(a);
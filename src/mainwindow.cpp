@@ -4,6 +4,7 @@
 #include <QDesktopWidget>
 #include <QDialog>
 #include <QDir>
+#include <QFile>
 #include <QFileDialog>
 #include <QGridLayout>
 #include <QMessageBox>
@@ -13,17 +14,26 @@
 #include <QStandardPaths>
 #include <QtConcurrent>
 #include <QtDebug>
+#include <algorithm>
+#include <array>
 #include <exception>
 
 #include "./ui_mainwindow.h"
 #include "aboutdialog.h"
+#include "dbprofile.h"
+#include "levelscan.h"
+#include "levelsnapshot.h"
 #include "mapitemeditor.h"
 #include "mapwidget.h"
+#include "memstats.h"
 #include "msg.h"
+#include "nbtreader.h"
+#include "nbtsearchdialog.h"
 #include "nbtwidget.h"
 #include "palette.h"
 #include "renderfilterdialog.h"
 #include "resourcemanager.h"
+#include "trace.h"
 
 namespace {
 
@@ -43,17 +53,82 @@ namespace {
         btn->setPalette(pal);
         btn->update();
     }
+
+    // 村庄的范围要画在地图上，只有INFO需要在加载时读取，而且只读四个坐标
+    bool parseVillageBounds(const std::string &value, QRect &rect) {
+        static const NbtProjection projection = [] {
+            NbtProjection p;
+            for (auto *path : {"X0", "Z0", "X1", "Z1"}) p.add(path);
+            return p;
+        }();
+        std::array<int64_t, 4> v{};
+        int found = 0;
+        NbtReader reader(value);
+        if (!reader.project(projection, [&](int id, const NbtValue &val) {
+                if (!val.isNumber()) return;
+                v[id] = val.i;
+                found |= 1 << id;
+            })) {
+            qWarning() << "Can not parse village info: " << reader.error();
+            return false;
+        }
+        if (found != 0xF) return false;
+        const int x0 = static_cast<int>(v[0]), z0 = static_cast<int>(v[1]), x1 = static_cast<int>(v[2]), z1 = static_cast<int>(v[3]);
+        rect = QRect(std::min(x0, x1), std::min(z0, z1), std::abs(x0 - x1), std::abs(z0 - z1));
+        return true;
+    }
+
+    void classifyGlobalKey(GlobalNBTLoadResult &result, std::string key, std::string value) {
+        if (key.find("player") != std::string::npos) {
+            result.playerData.emplace_back(std::move(key), std::move(value));
+        } else if (key == "portals" || key == "scoreboard" || key == "AutonomousEntities" || key == "BiomeData" || key == "Nether" ||
+                   key == "Overworld" || key == "TheEnd" || key == "schedulerWT" || key == "mobevents") {
+            result.otherData.emplace_back(std::move(key), std::move(value));
+        } else if (key.find("map_") == 0) {
+            result.mapData.emplace_back(std::move(key), std::move(value));
+        } else if (bl::village_key::parse(key).valid()) {
+            const std::string info = std::string("_") + bl::village_key::village_key_type_to_str(bl::village_key::key_type::INFO);
+            QRect rect;
+            if (key.size() > 8 + info.size() && key.compare(key.size() - info.size(), info.size(), info) == 0 &&
+                parseVillageBounds(value, rect)) {
+                result.villageBounds[key.substr(8, key.size() - 8 - info.size())] = rect;  // 去掉VILLAGE_前缀和_INFO后缀
+            }
+            result.villageData.emplace_back(std::move(key), std::move(value));
+        }
+    }
+
+    // 根据key的后缀判断村庄数据的类型，用于选择图标
+    bl::village_key::key_type villageKeyType(const std::string &key) {
+        for (int i = 0; i < 4; i++) {
+            auto type = static_cast<bl::village_key::key_type>(i);
+            const auto suffix = std::string("_") + bl::village_key::village_key_type_to_str(type);
+            if (key.size() > suffix.size() && key.compare(key.size() - suffix.size(), suffix.size(), suffix) == 0) return type;
+        }
+        return bl::village_key::key_type::INFO;
+    }
 }  // namespace
 
 MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWindow) {
     ui->setupUi(this);
     // level loader
     this->level_loader_ = new AsyncLevelLoader();
+    this->tile_server_ = new TileServer(this->level_loader_, this);
     // init and insert map widget
     this->map_widget_ = new MapWidget(this, nullptr);
     this->map_widget_->gotoBlockPos(0, 0);
     ui->map_visual_layout->addWidget(this->map_widget_);
     connect(this->map_widget_, SIGNAL(mouseMove(int, int)), this, SLOT(updateXZEdit(int, int)));  // NOLINT
+    // 索引建好之后未加载的区域可以直接显示轮廓
+    connect(this->level_loader_, &AsyncLevelLoader::chunkIndexReady, this->map_widget_, &MapWidget::asyncRefresh);
+    // 外部修改之后数据库打不开了，关闭存档而不是继续显示过期的数据
+    connect(this->level_loader_, &AsyncLevelLoader::levelReopenFailed, this, [this](bool closed) {
+        if (!closed) {
+            WARN("无法刷新存档快照，之后的修改不会再显示");
+            return;
+        }
+        this->closeLevel();
+        WARN("存档正在被其他程序占用，无法读取最新的修改，存档已关闭");
+    });
     // init chunk editor layout
     this->chunk_editor_widget_ = new ChunkEditorWidget(this);
     ui->map_splitter->setStretchFactor(0, 1);
@@ -113,10 +188,12 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
     ui->main_splitter->setStretchFactor(1, 2);
 
     this->map_item_editor_ = new MapItemEditor(this);
+    this->nbt_search_dialog_ = new NbtSearchDialog(this, this);
     connect(ui->open_level_btn, &QPushButton::clicked, this, &MainWindow::openLevel);
     connect(&this->render_filter_dialog_, &RenderFilterDialog::accepted, this, &MainWindow::applyFilter);
     // menu actions
     connect(ui->action_open, SIGNAL(triggered()), this, SLOT(openLevel()));
+    connect(ui->action_open_snapshot, SIGNAL(triggered()), this, SLOT(openSnapshot()));
     connect(ui->action_close, SIGNAL(triggered()), this, SLOT(closeLevel()));
     connect(ui->action_exit, SIGNAL(triggered()), this, SLOT(close_and_exit()));
     connect(ui->action_NBT, SIGNAL(triggered()), this, SLOT(openNBTEditor()));
@@ -126,6 +203,8 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
             []() { QDesktopServices::openUrl(QUrl::fromLocalFile(cfg::CONFIG_FILE_PATH.c_str())); });
 
     connect(ui->action_map_item, &QAction::triggered, this, [this]() { openMapItemEditor(); });
+    connect(ui->action_nbt_search, &QAction::triggered, this, [this]() { openNbtSearch(); });
+    connect(ui->action_entity_census, &QAction::triggered, this, [this]() { startEntityCensus(); });
 
     // modify
     ui->action_modify->setCheckable(true);
@@ -153,9 +232,81 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
         this->level_loader_->clearAllCache();
     });
 
+    // tile server
+    ui->action_tile_server->setCheckable(true);
+    connect(ui->action_tile_server, &QAction::triggered, this, [this]() {
+        auto checked = this->ui->action_tile_server->isChecked();
+        if (!checked) {
+            this->tile_server_->close();
+            return;
+        }
+        if (!this->tile_server_->listen(static_cast<quint16>(cfg::TILE_SERVER_PORT))) {
+            WARN("无法启动瓦片服务器，请检查端口是否被占用");
+            this->ui->action_tile_server->setChecked(false);
+            return;
+        }
+        INFO(QString("瓦片服务器已启动: http://127.0.0.1:%1/{dim}/{layer}/{z}/{x}/{y}.png").arg(this->tile_server_->port()));
+    });
+
+    // level diff
+    ui->action_level_diff->setCheckable(true);
+    connect(ui->action_level_diff, &QAction::triggered, this, [this]() {
+        if (this->ui->action_level_diff->isChecked()) {
+            this->startLevelDiff();
+        } else {
+            this->stopLevelDiff();
+        }
+    });
+    connect(&this->global_data_progress_timer_, &QTimer::timeout, this, [this]() {
+        const int total = this->global_data_total_;
+        const auto percent = QString(" (%1%)").arg(total == 0 ? 0 : this->global_data_progress_ * 100 / total);
+        ui->player_nbt_loading_label->setText("玩家数据正在后台加载中" + percent);
+        ui->village_nbt_loading_label->setText("村庄数据正在后台加载中" + percent);
+        ui->other_nbt_loading_label->setText("其他数据正在后台加载中" + percent);
+    });
+    connect(&this->diff_progress_timer_, &QTimer::timeout, this, [this]() {
+        if (!this->diff_progress_dialog_) return;
+        this->diff_progress_dialog_->setMaximum(std::max(1, this->level_diff_.total()));
+        this->diff_progress_dialog_->setValue(this->level_diff_.progress());
+    });
+    connect(&this->delete_progress_timer_, &QTimer::timeout, this, [this]() {
+        if (!this->delete_progress_dialog_) return;
+        this->delete_progress_dialog_->setMaximum(std::max(1, this->level_loader_->dropTotal()));
+        this->delete_progress_dialog_->setValue(this->level_loader_->dropProgress());
+    });
+    connect(&this->census_progress_timer_, &QTimer::timeout, this, [this]() {
+        if (!this->census_progress_dialog_) return;
+        this->census_progress_dialog_->setMaximum(std::max(1, this->entity_census_.total()));
+        this->census_progress_dialog_->setValue(this->entity_census_.progress());
+    });
+
+    // metrics
+    connect(ui->action_dump_metrics, &QAction::triggered, this,
+            [this]() { this->saveJsonReport("导出性能统计", "metrics.json", this->level_loader_->metrics().toJson()); });
+    connect(ui->action_dump_memory, &QAction::triggered, this, [this]() {
+        this->level_loader_->updateMemoryStats();
+        this->saveJsonReport("导出内存统计", "memory.json", MemStats::toJson());
+    });
+
+    // trace
+    Trace::setThreadName("ui");
+    ui->action_trace->setCheckable(true);
+    connect(ui->action_trace, &QAction::triggered, this, [this]() {
+        if (this->ui->action_trace->isChecked()) {
+            Trace::clear();
+            Trace::setEnabled(true);
+            return;
+        }
+        Trace::setEnabled(false);
+        auto path = QFileDialog::getSaveFileName(this, tr("保存性能追踪"), "trace.json", tr("JSON (*.json)"));
+        if (!path.isEmpty() && !Trace::writeJson(path.toStdString())) WARN("无法写入文件");
+    });
+
     // watcher
     connect(&this->delete_chunks_watcher_, &QFutureWatcher<bool>::finished, this, &MainWindow::handle_chunk_delete_finished);
     connect(&this->load_global_data_watcher_, &QFutureWatcher<bool>::finished, this, &MainWindow::handle_level_open_finished);
+    connect(&this->level_diff_watcher_, &QFutureWatcher<bool>::finished, this, &MainWindow::handle_level_diff_finished);
+    connect(&this->entity_census_watcher_, &QFutureWatcher<bool>::finished, this, &MainWindow::handle_entity_census_finished);
 
     // reset UI
 
@@ -232,10 +383,75 @@ void MainWindow::openLevel() {
     }
 
     this->closeLevel();
+    LevelSnapshot::sweep(root.toStdString());
+    this->loadLevel(root);
+}
+
+void MainWindow::openSnapshot() {
+    QString root =
+        QFileDialog::getExistingDirectory(this, tr("打开存档快照"), QString(), QFileDialog::ShowDirsOnly | QFileDialog::DontResolveSymlinks);
+    if (root.size() == 0) {
+        return;
+    }
+
+    this->closeLevel();
+    this->createSnapshot(root, false, [this, root](const std::string &snapshot) {
+        if (!snapshot.empty()) this->loadLevel(QString::fromStdString(snapshot), root.toStdString());
+    });
+}
+
+void MainWindow::createSnapshot(const QString &root, bool allow_copy, const std::function<void(const std::string &)> &done) {
+    auto progress = std::make_shared<LevelSnapshot::Progress>();
+    auto stats = std::make_shared<LevelSnapshot::Stats>();
+    auto error = std::make_shared<std::string>();
+    auto *dialog = new QProgressDialog("正在创建存档快照...", QString(), 0, 1, this);
+    dialog->setWindowTitle("存档快照");
+    dialog->setWindowModality(Qt::WindowModal);
+    dialog->setMinimumDuration(500);
+    auto *timer = new QTimer(dialog);
+    connect(timer, &QTimer::timeout, dialog, [dialog, progress]() {
+        dialog->setMaximum(std::max(1, progress->total.load()));
+        dialog->setValue(progress->done);
+    });
+    timer->start(200);
+
+    auto *watcher = new QFutureWatcher<std::string>(this);
+    connect(watcher, &QFutureWatcher<std::string>::finished, this, [=]() {
+        dialog->deleteLater();
+        watcher->deleteLater();
+        auto snapshot = watcher->result();
+        if (!snapshot.empty()) {
+            qInfo() << "Snapshot created at " << snapshot.c_str() << ", " << stats->linked << " files linked, " << stats->copied
+                    << " files (" << stats->copied_bytes << " bytes) copied";
+            done(snapshot);
+            return;
+        }
+        qWarning() << "Can not create snapshot: " << error->c_str();
+        // 不能硬链接时完整复制可能非常慢，也会占用同样大小的磁盘，先征求同意
+        if (stats->link_failed && !allow_copy) {
+            auto text = QString("存档所在的文件系统不支持硬链接，需要完整复制数据库(约%1 MB)，是否继续?")
+                            .arg(QString::number(stats->table_bytes >> 20));
+            if (QMessageBox::question(this, "存档快照", text) == QMessageBox::Yes) {
+                this->createSnapshot(root, true, done);
+                return;
+            }
+        } else {
+            WARN("无法创建存档快照: " + QString::fromStdString(*error));
+        }
+        done({});
+    });
+    watcher->setFuture(QtConcurrent::run([=]() {
+        TRACE_SCOPE("create_snapshot");
+        return LevelSnapshot::create(root.toStdString(), *error, stats.get(), allow_copy, progress.get());
+    }));
+}
+
+void MainWindow::loadLevel(const QString &root, const std::string &snapshot_source) {
     qDebug() << "Level root path is " << root;
     ui->open_level_btn->setText("正在打开...");
     ui->open_level_btn->setEnabled(false);
-    auto res = this->level_loader_->open(root.toStdString());
+    // 快照交给loader管理，服务端写入原存档时它会重新做快照
+    auto res = this->level_loader_->open(root.toStdString(), false, snapshot_source);
     if (!res) {
         this->level_loader_->close();
         qInfo() << "Can not open level: " << root;
@@ -243,6 +459,11 @@ void MainWindow::openLevel() {
         this->resetToInitUI();
         return;
     }
+    // 快照只能只读打开
+    const bool read_only = this->level_loader_->isReadOnly();
+    this->write_mode_ = this->write_mode_ && !read_only;
+    ui->action_modify->setChecked(this->write_mode_);
+    ui->action_modify->setEnabled(!read_only);
 
     // 打开了存档
     this->setWindowTitle(getStaticTitle());  // 刷新标题
@@ -257,35 +478,24 @@ void MainWindow::openLevel() {
     qDebug() << "Loading global data in background thread...";
     // 后台加载全局数据
     this->loading_global_data_ = true;
-    auto future = QtConcurrent::run(
-        [this](const QString &path) -> bool {
-            auto result = GlobalNBTLoadResult();
-            try {
-                if (cfg::LOAD_GLOBAL_DATA) {
-                    this->level_loader_->level().foreach_global_keys([this, &result](const std::string &key, const std::string &value) {
-                        if (!this->loading_global_data_) {
-                            throw std::logic_error("EXIT");  // 手动中止
-                        }
-                        if (key.find("player") != std::string::npos) {
-                            result.playerData.append_nbt(key, value);
-                        } else if (key == "portals" || key == "scoreboard" || key == "AutonomousEntities" || key == "BiomeData" ||
-                                   key == "Nether" || key == "Overworld" || key == "TheEnd" || key == "schedulerWT" || key == "mobevents") {
-                            result.otherData.append_nbt(key, value);
-                        } else if (key.find("map_") == 0) {
-                            result.mapData.append_nbt(key, value);
-                        } else {
-                            bl::village_key vk = bl::village_key::parse(key);
-                            if (vk.valid()) result.villageData.append_village(vk, value);
-                        }
-                    });
-                }
-                this->prepareGlobalData(result);
-                return true;
-            } catch (std::exception &e) {
-                return false;
-            }
-        },
-        root);
+    this->global_data_progress_ = 0;
+    this->global_data_total_ = 0;
+    this->global_data_progress_timer_.start(200);
+    // 加载期间不允许重新打开存档，刚打开的存档不会处在重新打开的过程中
+    (void)this->level_loader_->pinLevel();
+    auto future = QtConcurrent::run([this]() -> bool {
+        TRACE_SCOPE("load_global_data");
+        GlobalNBTShards shards;
+        auto ok = !cfg::LOAD_GLOBAL_DATA || this->loadGlobalShards(shards);
+        this->level_loader_->unpinLevel();
+        if (!ok) return false;
+        try {
+            this->prepareGlobalData(shards);
+            return true;
+        } catch (std::exception &e) {
+            return false;
+        }
+    });
     this->load_global_data_watcher_.setFuture(future);
 }
 
@@ -294,7 +504,13 @@ void MainWindow::closeLevel() {  // NOLINT
     if (!this->level_loader_->isOpen()) return;
     this->loading_global_data_ = false;
     this->load_global_data_watcher_.waitForFinished();
+    this->delete_chunks_watcher_.waitForFinished();
+    this->stopLevelDiff();
+    this->stopEntityCensus();
+    this->nbt_search_dialog_->stop();
+    this->nbt_search_dialog_->clearResults();
     this->level_loader_->close();
+    ui->action_modify->setEnabled(true);
     // free spaces
     this->chunk_editor_widget_->clearData();
     this->village_editor_->clearData();
@@ -332,6 +548,21 @@ void MainWindow::openMapItemEditor() {
     this->map_item_editor_->show();
 }
 
+void MainWindow::openNbtSearch() {
+    if (!CHECK_CONDITION(this->level_loader_->isOpen(), "未打开存档")) return;
+    this->nbt_search_dialog_->show();
+    this->nbt_search_dialog_->raise();
+    this->nbt_search_dialog_->activateWindow();
+}
+
+const std::vector<NbtSearchHit> &MainWindow::searchHits() const { return this->nbt_search_dialog_->hits(); }
+
+void MainWindow::gotoDimensionBlockPos(int dim, int x, int z) {
+    auto it = this->dim_btns_.find(static_cast<MapWidget::DimType>(dim));
+    if (it != this->dim_btns_.end()) it->second->click();
+    this->map_widget_->gotoBlockPos(x, z);
+}
+
 void MainWindow::deleteChunks(const bl::chunk_pos &min, const bl::chunk_pos &max) {
     if (!this->level_loader_->isOpen()) {
         QMessageBox::information(nullptr, "警告", "还没有打开世界", QMessageBox::Yes, QMessageBox::Yes);
@@ -341,24 +572,248 @@ void MainWindow::deleteChunks(const bl::chunk_pos &min, const bl::chunk_pos &max
         QMessageBox::information(nullptr, "警告", "当前为只读模式，无法删除区块", QMessageBox::Yes, QMessageBox::Yes);
         return;
     }
+    if (this->delete_chunks_watcher_.isRunning()) return;
     auto future = this->level_loader_->dropChunk(min, max);
     this->delete_chunks_watcher_.setFuture(future);
+
+    this->delete_progress_dialog_ = new QProgressDialog("正在删除区块...", QString(), 0, 1, this);
+    this->delete_progress_dialog_->setWindowTitle("删除区块");
+    this->delete_progress_dialog_->setMinimumDuration(500);
+    this->delete_progress_timer_.start(200);
 }
 
 void MainWindow::handle_chunk_delete_finished() {
-    INFO("区块删除成功");
-    this->level_loader_->clearAllCache();
+    this->delete_progress_timer_.stop();
+    if (this->delete_progress_dialog_) {
+        this->delete_progress_dialog_->deleteLater();
+        this->delete_progress_dialog_ = nullptr;
+    }
+    // 缓存由AsyncLevelLoader按删除的区域单独刷新
+    if (this->delete_chunks_watcher_.result()) {
+        INFO("区块删除成功");
+    } else {
+        WARN("区块删除失败");
+    }
+}
+
+void MainWindow::saveJsonReport(const QString &title, const QString &default_name, const std::string &json) {
+    auto path = QFileDialog::getSaveFileName(this, title, default_name, tr("JSON (*.json)"));
+    if (path.isEmpty()) return;
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        WARN("无法写入文件");
+        return;
+    }
+    f.write(QByteArray::fromStdString(json));
+}
+
+void MainWindow::startLevelDiff() {
+    if (!CHECK_CONDITION(this->level_loader_->isOpen(), "未打开存档") || this->level_diff_watcher_.isRunning()) {
+        ui->action_level_diff->setChecked(this->level_diff_watcher_.isRunning());
+        return;
+    }
+    auto root = QFileDialog::getExistingDirectory(this, tr("选择用于对比的存档(如备份)"), "",
+                                                  QFileDialog::ShowDirsOnly | QFileDialog::DontResolveSymlinks);
+    if (root.isEmpty()) {
+        ui->action_level_diff->setChecked(false);
+        return;
+    }
+
+    // 对比基准不能被修改(LevelDB打开时会恢复日志、合并文件)，所以打开的是它的快照
+    this->createSnapshot(root, false, [this, root](const std::string &snapshot) {
+        if (snapshot.empty() || !this->level_loader_->isOpen() || !ui->action_level_diff->isChecked()) {
+            LevelSnapshot::remove(snapshot);
+            ui->action_level_diff->setChecked(false);
+            return;
+        }
+        leveldb::DB *base{nullptr};
+        auto s = leveldb::DB::Open(profileOptions(), snapshot + "/db", &base);
+        if (!s.ok()) {
+            qWarning() << "Can not open diff base: " << s.ToString().c_str();
+            LevelSnapshot::remove(snapshot);
+            WARN("无法打开用于对比的存档");
+            ui->action_level_diff->setChecked(false);
+            return;
+        }
+        this->diff_base_db_ = base;
+        this->diff_base_snapshot_ = snapshot;
+        this->runLevelDiff(root);
+    });
 }
 
-void MainWindow::prepareGlobalData(GlobalNBTLoadResult &res) {
+void MainWindow::runLevelDiff(const QString &root) {
+    // 对比期间不允许重新打开当前存档
+    if (!this->level_loader_->pinLevel()) {
+        delete this->diff_base_db_;
+        this->diff_base_db_ = nullptr;
+        LevelSnapshot::remove(this->diff_base_snapshot_);
+        this->diff_base_snapshot_.clear();
+        ui->action_level_diff->setChecked(false);
+        return;
+    }
+    auto *current = this->level_loader_->level().db();
+    auto *base = this->diff_base_db_;
+    qInfo() << "Start level diff with " << root;
+    this->level_diff_.reset();
+    auto future = QtConcurrent::run([this, current, base]() { return this->level_diff_.compare(current, base, cfg::THREAD_NUM); });
+    this->level_diff_watcher_.setFuture(future);
+
+    this->diff_progress_dialog_ = new QProgressDialog("正在对比存档...", "取消", 0, 1, this);
+    this->diff_progress_dialog_->setWindowTitle("存档对比");
+    this->diff_progress_dialog_->setMinimumDuration(0);
+    connect(this->diff_progress_dialog_, &QProgressDialog::canceled, this, [this]() { this->level_diff_.cancel(); });
+    this->diff_progress_timer_.start(200);
+}
+
+void MainWindow::stopLevelDiff() {
+    if (this->level_diff_watcher_.isRunning()) {
+        this->level_diff_.cancel();
+        this->level_diff_watcher_.waitForFinished();
+    }
+    this->level_diff_.clear();
+    this->map_widget_->setDrawDiff(false);
+    ui->action_level_diff->setChecked(false);
+}
+
+void MainWindow::handle_level_diff_finished() {
+    this->diff_progress_timer_.stop();
+    if (this->diff_progress_dialog_) {
+        this->diff_progress_dialog_->deleteLater();
+        this->diff_progress_dialog_ = nullptr;
+    }
+    delete this->diff_base_db_;
+    this->diff_base_db_ = nullptr;
+    LevelSnapshot::remove(this->diff_base_snapshot_);
+    this->diff_base_snapshot_.clear();
+    this->level_loader_->unpinLevel();
+
+    if (!this->level_diff_watcher_.result()) {
+        this->level_diff_.clear();
+        ui->action_level_diff->setChecked(false);
+        return;
+    }
+    this->map_widget_->setDrawDiff(true);
+    INFO(QString("对比完成\n新增区块: %1\n删除区块: %2\n修改区块: %3")
+             .arg(QString::number(this->level_diff_.count(LevelDiff::Added)), QString::number(this->level_diff_.count(LevelDiff::Removed)),
+                  QString::number(this->level_diff_.count(LevelDiff::Changed))));
+}
+
+void MainWindow::startEntityCensus() {
+    if (!CHECK_CONDITION(this->level_loader_->isOpen(), "未打开存档") || this->entity_census_watcher_.isRunning()) return;
+    // 统计期间不允许重新打开存档
+    auto *loader = this->level_loader_;
+    if (!loader->pinLevel()) return;
+    auto *db = loader->level().db();
+    this->entity_census_.reset();
+    qInfo() << "Start entity census";
+    auto future = QtConcurrent::run([this, loader, db]() {
+        TRACE_SCOPE("entity_census");
+        auto res = this->entity_census_.run(db, cfg::THREAD_NUM);
+        loader->unpinLevel();
+        return res;
+    });
+    this->entity_census_watcher_.setFuture(future);
+
+    this->census_progress_dialog_ = new QProgressDialog("正在统计实体...", "取消", 0, 1, this);
+    this->census_progress_dialog_->setWindowTitle("实体统计");
+    this->census_progress_dialog_->setMinimumDuration(0);
+    connect(this->census_progress_dialog_, &QProgressDialog::canceled, this, [this]() { this->entity_census_.cancel(); });
+    this->census_progress_timer_.start(200);
+}
+
+void MainWindow::stopEntityCensus() {
+    if (!this->entity_census_watcher_.isRunning()) return;
+    this->entity_census_.cancel();
+    this->entity_census_watcher_.waitForFinished();
+}
+
+void MainWindow::handle_entity_census_finished() {
+    this->census_progress_timer_.stop();
+    if (this->census_progress_dialog_) {
+        this->census_progress_dialog_->deleteLater();
+        this->census_progress_dialog_ = nullptr;
+    }
+    if (!this->entity_census_watcher_.result()) {
+        this->entity_census_.clear();
+        return;
+    }
+
+    constexpr size_t TOP_TYPES = 10;
+    constexpr size_t TOP_CHUNKS = 20;
+    auto &census = this->entity_census_;
+    auto &dims = census.dimTotals();
+    auto text = QString("实体总数: %1\n主世界: %2  下界: %3  末地: %4  未知维度: %5\n")
+                    .arg(QString::number(census.entityCount()), QString::number(dims[0]), QString::number(dims[1]),
+                         QString::number(dims[2]), QString::number(dims[3]));
+    // 摘要只列出数量最多的几种，完整结果导出到文件
+    std::vector<std::pair<int64_t, std::string>> types;
+    for (auto &kv : census.counts()) {
+        int64_t sum = 0;
+        for (auto c : kv.second) sum += c;
+        types.emplace_back(sum, kv.first);
+    }
+    std::sort(types.begin(), types.end(), [](auto &a, auto &b) { return a.first > b.first; });
+    for (size_t i = 0; i < std::min(TOP_TYPES, types.size()); i++) {
+        text += QString("\n%1: %2").arg(types[i].second.c_str(), QString::number(types[i].first));
+    }
+    auto top = census.topChunks(1);
+    if (!top.empty()) {
+        text += QString("\n\n实体最多的区块: [%1] %2, %3 (%4个)")
+                    .arg(NbtRecordScan::dimName(top[0].cp.dim), QString::number(top[0].cp.x), QString::number(top[0].cp.z),
+                         QString::number(top[0].count));
+    }
+    text += "\n\n是否导出完整结果?";
+    if (QMessageBox::question(this, "实体统计", text) != QMessageBox::Yes) return;
+    auto path = QFileDialog::getSaveFileName(this, "导出实体统计", "entity_census.csv", tr("CSV (*.csv);;JSON (*.json)"));
+    if (path.isEmpty()) return;
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        WARN("无法写入文件");
+        return;
+    }
+    f.write(QByteArray::fromStdString(path.endsWith(".json", Qt::CaseInsensitive) ? census.toJson(TOP_CHUNKS) : census.toCsv(TOP_CHUNKS)));
+}
+
+bool MainWindow::loadGlobalShards(GlobalNBTShards &shards) {
+    auto *db = this->level_loader_->level().db();
+    const int threads = std::max(1, cfg::THREAD_NUM);
+    auto ranges = globalKeyRanges(db, static_cast<size_t>(threads) * 4);
+    this->global_data_total_ = static_cast<int>(ranges.size());
+    // 每个区间一份结果，同一个村庄的几个key前缀相同，总是落在同一个区间里
+    for (size_t i = 0; i < ranges.size(); i++) shards.push_back(std::make_unique<GlobalNBTLoadResult>());
+    std::atomic_bool failed{false};
+    parallelForRanges(ranges, threads, [&](size_t i, const KeyRange &range) {
+        // 只读一遍，不占用地图渲染需要的block cache
+        std::unique_ptr<leveldb::Iterator> it(db->NewIterator(bulkReadOptions()));
+        try {
+            for (it->Seek(range.begin); it->Valid() && inRange(it->key(), range); it->Next()) {
+                if (!this->loading_global_data_) return false;  // 手动中止
+                if (isGlobalKey(it->key())) classifyGlobalKey(*shards[i], it->key().ToString(), it->value().ToString());
+            }
+        } catch (std::exception &e) {
+            qWarning() << "Can not parse global data: " << e.what();
+            failed = true;
+            return false;
+        }
+        ++this->global_data_progress_;
+        return true;
+    });
+    return this->loading_global_data_ && !failed;
+}
+
+void MainWindow::prepareGlobalData(GlobalNBTShards &shards) {
+    TRACE_SCOPE("prepareGlobalData");
+    // 数据都没有解析，这里只建列表项，同一类数据共用一个图标
     // load players
     qInfo() << "Loading player data...";
-    auto &playerData = res.playerData.data();
+    const QIcon playerIcon(QPixmap::fromImage(*PlayerNBTIcon()));
     std::vector<NBTListItem *> playerNBTList;
-    for (auto &kv : playerData) {
-        auto *item = NBTListItem::from(dynamic_cast<compound_tag *>(kv.second->copy()), kv.first.c_str(), kv.first.c_str());
-        item->setIcon(QIcon(QPixmap::fromImage(*PlayerNBTIcon())));
-        playerNBTList.push_back(item);
+    for (auto &res : shards) {
+        for (auto &kv : res->playerData) {
+            auto *item = NBTListItem::fromRaw(std::move(kv.second), kv.first.c_str(), kv.first.c_str());
+            item->setIcon(playerIcon);
+            playerNBTList.push_back(item);
+        }
     }
 
     this->player_editor_->loadNewData(playerNBTList);
@@ -366,41 +821,44 @@ void MainWindow::prepareGlobalData(GlobalNBTLoadResult &res) {
 
     // load other items
     qInfo() << "Loading other data...";
-    auto &otherData = res.otherData.data();
+    const QIcon otherIcon(QPixmap::fromImage(*OtherNBTIcon()));
     std::vector<NBTListItem *> otherNBTList;
-    for (auto &kv : otherData) {
-        auto *item = NBTListItem::from(dynamic_cast<compound_tag *>(kv.second->copy()), kv.first.c_str(), kv.first.c_str());
-        item->setIcon(QIcon(QPixmap::fromImage(*OtherNBTIcon())));
-        otherNBTList.push_back(item);
+    for (auto &res : shards) {
+        for (auto &kv : res->otherData) {
+            auto *item = NBTListItem::fromRaw(std::move(kv.second), kv.first.c_str(), kv.first.c_str());
+            item->setIcon(otherIcon);
+            otherNBTList.push_back(item);
+        }
     }
     this->other_nbt_editor_->loadNewData(otherNBTList);
     qInfo() << "Load other data finished";
 
     // load villages
     qInfo() << "Loading village data...";
-    auto &villData = res.villageData.data();
-    this->collect_villages(villData);
+    std::array<QIcon, 4> villageIcons;
+    for (int i = 0; i < 4; i++) {
+        villageIcons[i] = QIcon(QPixmap::fromImage(*VillageNBTIcon(static_cast<bl::village_key::key_type>(i))));
+    }
     std::vector<NBTListItem *> villNBTList;
-    for (auto &kv : villData) {
-        int index = 0;
-        for (auto &p : kv.second) {
-            if (p) {
-                auto key = kv.first + "_" + bl::village_key::village_key_type_to_str(static_cast<bl::village_key::key_type>(index));
-                auto *item = NBTListItem::from(dynamic_cast<compound_tag *>(p->copy()), key.c_str(), ("VILLAGE_" + key).c_str());
-                item->setIcon(QIcon(QPixmap::fromImage(*VillageNBTIcon(static_cast<bl::village_key::key_type>(index)))));
-                villNBTList.push_back(item);
-            }
-            index++;
+    for (auto &res : shards) {
+        this->collect_villages(res->villageBounds);
+        for (auto &kv : res->villageData) {
+            auto *item = NBTListItem::fromRaw(std::move(kv.second), kv.first.substr(8).c_str(), kv.first.c_str());
+            item->setIcon(villageIcons[static_cast<int>(villageKeyType(kv.first))]);
+            villNBTList.push_back(item);
         }
     }
 
     this->village_editor_->loadNewData(villNBTList);
     qInfo() << "Load village data finished";
     // load map data
-    this->map_item_editor_->load_map_data(res.mapData);
+    std::vector<std::vector<RawNBTEntry> *> mapData;
+    for (auto &res : shards) mapData.push_back(&res->mapData);
+    this->map_item_editor_->load_map_data(mapData);
 }
 
 void MainWindow::handle_level_open_finished() {
+    this->global_data_progress_timer_.stop();
     auto res = this->load_global_data_watcher_.result();
     if (!res) {
         if (!this->loading_global_data_) {  // 说明是主动停止的
@@ -455,20 +913,10 @@ void MainWindow::on_save_other_btn_clicked() {
     this->other_nbt_editor_->clearModifyCache();
 }
 
-void MainWindow::collect_villages(const std::unordered_map<std::string, std::array<bl::palette::compound_tag *, 4>> &vs) {
+void MainWindow::collect_villages(const std::unordered_map<std::string, QRect> &vs) {
     qInfo() << "Collect " << vs.size() << " villages";
-    for (auto kv : vs) {
-        auto *nbt = kv.second[static_cast<int>(bl::village_key::key_type::INFO)];
-        if (!nbt) continue;
-        auto x0 = dynamic_cast<bl::palette::int_tag *>(nbt->get("X0"));
-        auto z0 = dynamic_cast<bl::palette::int_tag *>(nbt->get("Z0"));
-        auto x1 = dynamic_cast<bl::palette::int_tag *>(nbt->get("X1"));
-        auto z1 = dynamic_cast<bl::palette::int_tag *>(nbt->get("Z1"));
-        if (x0 && z0 && x1 && z1) {
-            this->villages_.insert(kv.first.c_str(), QRect(std::min(x0->value, x1->value), std::min(z0->value, z1->value),
-                                                           std::abs(x0->value - x1->value), std::abs(z0->value - z1->value)));
-            qDebug() << x0->value << " " << z0->value << " ~ " << x1->value << " " << z1->value;
-        }
+    for (auto &kv : vs) {
+        this->villages_.insert(kv.first.c_str(), kv.second);
     }
 }
 
@@ -480,7 +928,7 @@ void MainWindow::on_edit_filter_btn_clicked() {
 void MainWindow::applyFilter() {
     this->render_filter_dialog_.collectFilerData();
     this->level_loader_->setFilter(this->render_filter_dialog_.getFilter());
-    this->level_loader_->clearAllCache();
+    this->map_widget_->update();
 }
 
 #include <QPainter>
@@ -535,7 +983,9 @@ QString MainWindow::getStaticTitle() {
     if (this->level_loader_->isOpen()) {
         level_name = this->level_loader_->level().dat().level_name();
     }
-    return cfg::VERSION_STRING() + " " + level_name.c_str();
+    auto title = cfg::VERSION_STRING() + " " + level_name.c_str();
+    if (this->level_loader_->isOpen() && this->level_loader_->isReadOnly()) title += " [快照]";
+    return title;
 }
 
 void MainWindow::resizeEvent(QResizeEvent *event) {
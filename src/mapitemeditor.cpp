@@ -40,12 +40,11 @@ MapItemEditor::~MapItemEditor() {
     delete ui;
 }
 
-void MapItemEditor::load_map_data(const bl::general_kv_nbts &data) {
+void MapItemEditor::load_map_data(const std::vector<std::vector<RawNBTEntry> *> &data) {
     qInfo() << "Loading map data...";
     std::vector<NBTListItem *> items;
-    for (auto &kv : data.data()) {
-        auto *it = NBTListItem::from(dynamic_cast<bl::palette::compound_tag *>(kv.second->copy()), kv.first.c_str(), kv.first.c_str());
-        items.push_back(it);
+    for (auto *shard : data) {
+        for (auto &kv : *shard) items.push_back(NBTListItem::fromRaw(std::move(kv.second), kv.first.c_str(), kv.first.c_str()));
     }
     this->map_nbt_editor_->loadNewData(items);
 }
@@ -90,8 +89,9 @@ void MapItemEditor::on_change_map_btn_clicked() {
     this->img = scale_img;
     // TODO 写入图数据
     auto *it = this->map_nbt_editor_->openedItem();
-    if (!it || !it->root_) return;
-    auto *color_tag = dynamic_cast<bl::palette::byte_array_tag *>(it->root_->get("colors"));
+    if (!it || !it->tag()) return;
+    auto *color_tag = dynamic_cast<bl::palette::byte_array_tag *>(it->tag()->get("colors"));
+    if (!color_tag || color_tag->value.size() != 65536) return;
     for (int i = 0; i < 128; i++) {
         for (int j = 0; j < 128; j++) {
             const int n = (i * 128 + j) * 4;
@@ -101,7 +101,8 @@ void MapItemEditor::on_change_map_btn_clicked() {
             color_tag->value[n + 2] = (int8_t)c.blue();
         }
     }
-    this->map_nbt_editor_->putModifyToCache(it->raw_key.toStdString(), it->root_->to_raw());
+    it->markModified();
+    this->map_nbt_editor_->putModifyToCache(it->raw_key.toStdString(), it->toRaw());
     this->update();
 }
 
@@ -1,6 +1,7 @@
 
 #include <qimage.h>
 
+#include <algorithm>
 #include <cstddef>
 #include <map>
 #include <unordered_map>
@@ -9,14 +10,6 @@
 
 #include "bedrock_key.h"
 
-#ifdef WIN32
-// clang-format off
-#include <Windows.h>
-#include <Psapi.h>
-#include <Pdh.h>
-// clang-format on
-#endif
-
 #include <QAction>
 #include <QApplication>
 #include <QBrush>
@@ -43,24 +36,26 @@
 #include "config.h"
 #include "mainwindow.h"
 #include "mapwidget.h"
+#include "memstats.h"
+#include "trace.h"
 
 namespace {
-
-    double getMemUsage() {
-#ifdef WIN32
-        PROCESS_MEMORY_COUNTERS_EX pmc;
-        GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS *)&pmc, sizeof(pmc));
-        return static_cast<double>(pmc.WorkingSetSize >> 20);
-#else
-        return 0;
-#endif
-    }
+    constexpr qint64 PAN_IDLE_MS = 300;           // 超过这个时间没有移动就认为已经停下
+    constexpr qreal PREFETCH_LOOKAHEAD_MS = 600;  // 按当前速度预测多久之后的视野
+    constexpr qreal VELOCITY_SMOOTHING = 0.4;     // 速度的指数平滑系数
 }  // namespace
 
 void MapWidget::resizeEvent(QResizeEvent *event) { this->camera_ = QRect(-10, -10, this->width() + 10, this->height() + 10); }
 
 void MapWidget::asyncRefresh() { this->update(); }
 
+void MapWidget::changeDimension(MapWidget::DimType dim) {
+    // 原来维度里还没完成的区域已经看不到了，不必再等它们
+    if (dim != this->dim_type_) this->mw_->levelLoader()->cancelTasks(static_cast<int>(this->dim_type_));
+    this->dim_type_ = dim;
+    this->update();
+}
+
 // 显示右键菜单
 void MapWidget::showContextMenu(const QPoint &p) {
     auto *cb = QApplication::clipboard();
@@ -83,6 +78,9 @@ void MapWidget::showContextMenu(const QPoint &p) {
         // for single chunk
         QAction gotoAction("前往坐标", this);
         connect(&gotoAction, &QAction::triggered, this, [this] { this->gotoPositionAction(); });
+        QAction fitWorldAction("显示整个世界", this);
+        fitWorldAction.setEnabled(this->mw_->levelLoader()->chunkIndex().ready());
+        connect(&fitWorldAction, &QAction::triggered, this, [this] { this->fitWorldToView(); });
         auto blockInfo = this->mw_->levelLoader()->getBlockTips(pos, this->dim_type_);
         // block name
         QAction copyBlockNameAction("复制方块名称: " + QString(blockInfo.block_name.c_str()), this);
@@ -117,6 +115,7 @@ void MapWidget::showContextMenu(const QPoint &p) {
         });
 
         contextMenu.addAction(&gotoAction);
+        contextMenu.addAction(&fitWorldAction);
         contextMenu.addAction(&copyBlockNameAction);
         contextMenu.addAction(&copyBiomeAction);
         contextMenu.addAction(&copyHeightAction);
@@ -138,34 +137,46 @@ bl::block_pos MapWidget::getCursorBlockPos() {
 }
 
 void MapWidget::paintEvent(QPaintEvent *event) {
+    TRACE_SCOPE("paintEvent");
+    this->mw_->levelLoader()->drainCompleted();
     QPainter p(this);
+    // 每个绘制步骤单独记录追踪事件
+    auto pass = [this, event, &p](const char *name, void (MapWidget::*draw)(QPaintEvent *, QPainter *)) {
+        TRACE_SCOPE(name);
+        (this->*draw)(event, &p);
+    };
     switch (this->main_render_type_) {
         case MapWidget::Biome:
-            drawBiome(event, &p);
+            pass("drawBiome", &MapWidget::drawBiome);
             break;
         case MapWidget::Terrain:
-            drawTerrain(event, &p);
+            pass("drawTerrain", &MapWidget::drawTerrain);
             break;
         case MapWidget::Height:
-            drawHeight(event, &p);
+            pass("drawHeight", &MapWidget::drawHeight);
             break;
     }
-    if (draw_HSA_) this->drawHSAs(event, &p);
-    if (draw_villages_) this->drawVillages(event, &p);
-    if (draw_actors_) this->drawActors(event, &p);
-    if (draw_slime_chunk_) this->drawSlimeChunks(event, &p);
-    if (draw_grid_) this->drawGrid(event, &p);
-    if (draw_coords_) this->drawChunkPosText(event, &p);
-    if (draw_debug_window_) this->drawDebugWindow(event, &p);
-    this->drawSelectArea(event, &p);
-    this->drawMarkers(event, &p);
+    if (draw_HSA_) pass("drawHSAs", &MapWidget::drawHSAs);
+    if (draw_villages_) pass("drawVillages", &MapWidget::drawVillages);
+    if (draw_actors_) pass("drawActors", &MapWidget::drawActors);
+    if (!this->mw_->searchHits().empty()) pass("drawSearchHits", &MapWidget::drawSearchHits);
+    if (draw_slime_chunk_) pass("drawSlimeChunks", &MapWidget::drawSlimeChunks);
+    if (draw_diff_) pass("drawDiff", &MapWidget::drawDiff);
+    if (draw_grid_) pass("drawGrid", &MapWidget::drawGrid);
+    if (draw_coords_) pass("drawChunkPosText", &MapWidget::drawChunkPosText);
+    if (draw_debug_window_) pass("drawDebugWindow", &MapWidget::drawDebugWindow);
+    pass("drawSelectArea", &MapWidget::drawSelectArea);
+    pass("drawMarkers", &MapWidget::drawMarkers);
+    this->prefetchAhead();
 }
 
 void MapWidget::mouseMoveEvent(QMouseEvent *event) {
     static QPoint lastMove;
     if (event->buttons() & Qt::LeftButton) {
         if (this->dragging_) {
-            this->origin_ += QPoint{event->x() - lastMove.x(), event->y() - lastMove.y()};
+            QPoint delta{event->x() - lastMove.x(), event->y() - lastMove.y()};
+            this->origin_ += delta;
+            this->trackPan(delta);
             this->update();
         } else {
             this->dragging_ = true;
@@ -214,6 +225,11 @@ void MapWidget::wheelEvent(QWheelEvent *event) {
         this->cw_ = ncw;
     }
 
+    if (this->cw_ != lastCW) {
+        this->zoom_dir_ = this->cw_ > lastCW ? 1 : -1;
+        this->last_zoom_ms_ = this->pan_clock_.elapsed();
+    }
+
     auto cursor = this->mapFromGlobal(QCursor::pos());
     double ratio = this->cw_ * 1.0 / lastCW;
     this->origin_.setX(static_cast<int>((this->origin_.x() - cursor.x()) * ratio + cursor.x()));
@@ -222,6 +238,11 @@ void MapWidget::wheelEvent(QWheelEvent *event) {
 }
 
 void MapWidget::drawRegion(QPaintEvent *e, QPainter *p, const region_pos &pos, const QPoint &start, QImage *img) const {
+    // 区域还没烘焙出来时先画区块索引里的轮廓
+    if (img == cfg::UNLOADED_REGION_IMAGE()) {
+        auto *silhouette = this->mw_->levelLoader()->chunkIndex().silhouette(pos);
+        if (silhouette) img = silhouette;
+    }
     if (img)
         p->drawImage(QRectF(start.x(), start.y(), this->cw_ * cfg::RW, this->cw_ * cfg::RW), *img,
                      QRect(0, 0, img->width(), img->height()));
@@ -329,7 +350,8 @@ void MapWidget::drawDebugWindow(QPaintEvent *event, QPainter *painter) {
     QFont font("JetBrains Mono", 6);
     QFontMetrics fm(font);
     auto dbgInfo = this->mw_->levelLoader()->debugInfo();
-    dbgInfo.push_back(QString("Memory usage: %1 MiB").arg(QString::number(getMemUsage())));
+    auto memInfo = MemStats::debugInfo();
+    dbgInfo.insert(dbgInfo.end(), memInfo.begin(), memInfo.end());
     int max_len = 1;
     for (auto &i : dbgInfo) {
         max_len = std::max(max_len, fm.width(i));
@@ -356,6 +378,14 @@ void MapWidget::drawSlimeChunks(QPaintEvent *event, QPainter *painter) {
     });
 }
 
+void MapWidget::drawDiff(QPaintEvent *event, QPainter *painter) {
+    auto *diff = this->mw_->levelDiff();
+    if (diff->empty()) return;
+    this->foreachRegionInCamera([event, this, painter, diff](const region_pos &rp, const QPoint &p) {
+        this->drawRegion(event, painter, rp, p, diff->regionImage(rp));
+    });
+}
+
 void MapWidget::drawBiome(QPaintEvent *event, QPainter *painter) {
     this->foreachRegionInCamera([event, this, painter](const region_pos &rp, const QPoint &p) {
         auto top = this->mw_->levelLoader()->bakedBiomeImage(rp);
@@ -395,6 +425,21 @@ void MapWidget::drawVillages(QPaintEvent *event, QPainter *p) {
     }
 }
 
+void MapWidget::drawSearchHits(QPaintEvent *event, QPainter *p) {
+    auto [mi, ma, render] = this->getRenderRange(this->camera_);
+    const auto origin = mi.get_min_pos(bl::New);
+    const int r = std::max(3, std::min(8, static_cast<int>(BW() * 2)));
+    p->setPen(QPen(QColor(255, 255, 255), 2));
+    p->setBrush(QBrush(QColor(255, 140, 0)));
+    for (auto &hit : this->mw_->searchHits()) {
+        if (hit.dim != static_cast<int>(this->dim_type_)) continue;
+        auto x = (hit.x - origin.x) * this->BW() + render.x();
+        auto z = (hit.z - origin.z) * this->BW() + render.y();
+        if (!this->camera_.contains(static_cast<int>(x), static_cast<int>(z))) continue;
+        p->drawEllipse(QPointF(x, z), r, r);
+    }
+}
+
 void MapWidget::drawHSAs(QPaintEvent *event, QPainter *painter) {
     QColor colors[]{
         QColor(0, 0, 0, 0),         QColor(0, 223, 162, 255),  // 1NetherFortress
@@ -465,6 +510,17 @@ void MapWidget::gotoBlockPos(int x, int z) {
     this->update();
 }
 
+void MapWidget::fitWorldToView() {
+    bl::chunk_pos min, max;
+    if (!this->mw_->levelLoader()->chunkIndex().bounds(static_cast<int>(this->dim_type_), min, max)) return;
+    // 缩放到整个包围盒刚好能放进窗口，超出缩放范围时只保证居中
+    const int w = max.x - min.x + 1;
+    const int h = max.z - min.z + 1;
+    const int cw = std::min(this->width() / w, this->height() / h);
+    this->cw_ = std::clamp(cw, cfg::MINIMUM_SCALE_LEVEL, cfg::MAXIMUM_SCALE_LEVEL);
+    this->gotoBlockPos((min.x + max.x + 1) * 8, (min.z + max.z + 1) * 8);
+}
+
 std::tuple<bl::chunk_pos, bl::chunk_pos, QRect> MapWidget::getRenderRange(const QRect &camera) {
     // 需要的参数
     //  origin  焦点原点在什么地方
@@ -546,9 +602,72 @@ void MapWidget::advancePos(int x, int y) {
     auto nx = this->origin_.x() + x;
     auto ny = this->origin_.y() + y;
     this->origin_ = QPoint(nx, ny);
+    this->trackPan({x, y});
     this->update();
 }
 
+void MapWidget::trackPan(const QPoint &delta) {
+    const auto now = this->pan_clock_.elapsed();
+    const auto dt = now - this->last_pan_ms_;
+    this->last_pan_ms_ = now;
+    if (dt <= 0) return;  // 同一毫秒内的多次事件，下一次再一起计算
+    const QPointF v = QPointF(delta) / static_cast<qreal>(dt);
+    if (dt > PAN_IDLE_MS) {
+        this->pan_velocity_ = v;  // 停下后重新开始，之前的速度没有参考价值
+    } else {
+        this->pan_velocity_ = this->pan_velocity_ * (1 - VELOCITY_SMOOTHING) + v * VELOCITY_SMOOTHING;
+    }
+}
+
+void MapWidget::prefetchAhead() {
+    if (cfg::PREFETCH_RING <= 0) return;
+    auto *loader = this->mw_->levelLoader();
+    if (!loader->isOpen()) return;
+    const auto now = this->pan_clock_.elapsed();
+    const bool panning = this->last_pan_ms_ >= 0 && now - this->last_pan_ms_ < PAN_IDLE_MS;
+    const bool zooming_out = this->zoom_dir_ < 0 && this->last_zoom_ms_ >= 0 && now - this->last_zoom_ms_ < PAN_IDLE_MS;
+    if (!panning && !zooming_out) return;
+
+    QRect ahead = this->camera_;
+    if (panning) {
+        // origin_往一个方向移动，相当于视野往反方向移动
+        ahead.translate((-this->pan_velocity_ * PREFETCH_LOOKAHEAD_MS).toPoint());
+    }
+    if (zooming_out) {
+        // 以视野中心估算下一次缩小后的范围
+        const auto grow = (cfg::ZOOM_SPEED - 1.0) / 2.0;
+        const int dx = static_cast<int>(this->camera_.width() * grow);
+        const int dy = static_cast<int>(this->camera_.height() * grow);
+        ahead.adjust(-dx, -dy, dx, dy);
+    }
+    // 最多预取视野外PREFETCH_RING圈区域
+    const int ring = cfg::PREFETCH_RING * cfg::RW * this->cw_;
+    ahead &= this->camera_.adjusted(-ring, -ring, ring, ring);
+    if (ahead.isEmpty()) return;
+
+    auto [viewMin, viewMax, viewRange] = this->getRenderRange(this->camera_);
+    auto [minChunk, maxChunk, renderRange] = this->getRenderRange(ahead);
+    const auto visibleMin = cfg::c2r(viewMin);
+    const auto visibleMax = cfg::c2r(viewMax);
+    const auto regionMin = cfg::c2r(minChunk);
+    const auto regionMax = cfg::c2r(maxChunk);
+
+    // 离当前视野越近的越先进入视野，优先加载
+    std::vector<std::pair<int, region_pos>> candidates;
+    for (int i = regionMin.x; i <= regionMax.x; i += cfg::RW) {
+        for (int j = regionMin.z; j <= regionMax.z; j += cfg::RW) {
+            const int ox = i < visibleMin.x ? visibleMin.x - i : (i > visibleMax.x ? i - visibleMax.x : 0);
+            const int oz = j < visibleMin.z ? visibleMin.z - j : (j > visibleMax.z ? j - visibleMax.z : 0);
+            if (ox == 0 && oz == 0) continue;  // 已经在视野内，绘制时会正常请求
+            candidates.emplace_back(std::max(ox, oz), region_pos{i, j, minChunk.dim});
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+    for (auto &c : candidates) {
+        if (!loader->prefetchRegion(c.second)) break;
+    }
+}
+
 void MapWidget::drawMarkers(QPaintEvent *event, QPainter *painter) {
     if (this->opened_chunk_ && this->opened_chunk_pos_.dim == this->dim_type_) {
         auto [minChunk, maxChunk, renderRange] = this->getRenderRange(this->camera_);
@@ -0,0 +1,106 @@
+#include "memstats.h"
+
+#ifdef WIN32
+// clang-format off
+#include <Windows.h>
+#include <Psapi.h>
+// clang-format on
+#endif
+
+#include <fstream>
+#include <sstream>
+
+#include "json/json.hpp"
+
+std::atomic<int64_t> MemStats::consumers_[MemStats::CONSUMER_COUNT]{};
+
+namespace {
+    QString mib(int64_t bytes) { return bytes < 0 ? QString("N/A") : QString::number(static_cast<double>(bytes) / 1048576.0, 'f', 1); }
+
+#ifdef __linux__
+    // /proc/self/status 中的 "VmRSS:    1234 kB"
+    int64_t readStatusField(const std::string &status, const std::string &field) {
+        auto pos = status.find(field + ":");
+        if (pos == std::string::npos) return -1;
+        std::istringstream is(status.substr(pos + field.size() + 1));
+        int64_t kb{-1};
+        is >> kb;
+        return kb < 0 ? -1 : kb * 1024;
+    }
+#endif
+}  // namespace
+
+void MemStats::add(MemStats::Consumer c, int64_t bytes) { consumers_[c].fetch_add(bytes, std::memory_order_relaxed); }
+
+void MemStats::set(MemStats::Consumer c, int64_t bytes) { consumers_[c].store(bytes, std::memory_order_relaxed); }
+
+int64_t MemStats::get(MemStats::Consumer c) { return consumers_[c].load(std::memory_order_relaxed); }
+
+const char *MemStats::name(MemStats::Consumer c) {
+    static const char *names[CONSUMER_COUNT]{"region_images", "tips_info", "actor_maps", "slime_cache",
+                                             "negative_cache", "nbt_trees", "icon_pools", "chunk_index"};
+    return names[c];
+}
+
+MemStats::ProcessMemory MemStats::processMemory() {
+    ProcessMemory res;
+#ifdef WIN32
+    PROCESS_MEMORY_COUNTERS_EX pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS *)&pmc, sizeof(pmc))) {
+        res.rss = static_cast<int64_t>(pmc.WorkingSetSize);
+        res.heap = static_cast<int64_t>(pmc.PrivateUsage);
+    }
+    // PagefileUsage和PrivateUsage是同一个值，已经占用的虚拟地址空间要从GlobalMemoryStatusEx算
+    MEMORYSTATUSEX ms;
+    ms.dwLength = sizeof(ms);
+    if (GlobalMemoryStatusEx(&ms)) res.mapped = static_cast<int64_t>(ms.ullTotalVirtual - ms.ullAvailVirtual);
+#elif defined(__linux__)
+    std::ifstream f("/proc/self/status");
+    if (f.is_open()) {
+        std::stringstream ss;
+        ss << f.rdbuf();
+        auto status = ss.str();
+        res.rss = readStatusField(status, "VmRSS");
+        res.heap = readStatusField(status, "VmData");
+        res.mapped = readStatusField(status, "VmSize");
+    }
+#endif
+    return res;
+}
+
+int64_t MemStats::estimateNbt(bl::palette::abstract_tag *tag) {
+    // 每个节点按对象本身、key和容器节点的开销估算
+    constexpr int64_t NODE_OVERHEAD = 96;
+    if (!tag) return 0;
+    int64_t res = NODE_OVERHEAD + static_cast<int64_t>(tag->key().capacity());
+    if (tag->type() == bl::palette::tag_type::Compound) {
+        for (auto &kv : dynamic_cast<bl::palette::compound_tag *>(tag)->value) res += estimateNbt(kv.second);
+    } else if (tag->type() == bl::palette::tag_type::List) {
+        for (auto *child : dynamic_cast<bl::palette::list_tag *>(tag)->value) res += estimateNbt(child);
+    } else if (tag->type() == bl::palette::tag_type::String) {
+        res += static_cast<int64_t>(dynamic_cast<bl::palette::string_tag *>(tag)->value.capacity());
+    }
+    return res;
+}
+
+std::vector<QString> MemStats::debugInfo() {
+    std::vector<QString> res;
+    auto pm = processMemory();
+    res.push_back(QString("Memory: RSS %1 MiB, heap %2 MiB, mapped %3 MiB").arg(mib(pm.rss), mib(pm.heap), mib(pm.mapped)));
+    for (int i = 0; i < CONSUMER_COUNT; i++) {
+        auto c = static_cast<Consumer>(i);
+        res.push_back(QString(" - %1: %2 MiB").arg(name(c), mib(get(c))));
+    }
+    return res;
+}
+
+std::string MemStats::toJson() {
+    nlohmann::json j;
+    auto pm = processMemory();
+    j["process"] = {{"rss", pm.rss}, {"heap", pm.heap}, {"mapped", pm.mapped}};
+    for (int i = 0; i < CONSUMER_COUNT; i++) {
+        auto c = static_cast<Consumer>(i);
+        j["consumers"][name(c)] = get(c);
+    }
+    return j.dump(2);
+}
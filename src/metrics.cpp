@@ -0,0 +1,151 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "json/json.hpp"
+
+namespace {
+    void updateMax(std::atomic<uint64_t> &m, uint64_t v) {
+        auto cur = m.load(std::memory_order_relaxed);
+        while (v > cur && !m.compare_exchange_weak(cur, v, std::memory_order_relaxed)) {
+        }
+    }
+
+    double ratio(uint64_t a, uint64_t total) { return total == 0 ? 0.0 : static_cast<double>(a) / static_cast<double>(total); }
+
+    QString ms(int64_t us) { return QString::number(static_cast<double>(us) / 1000.0, 'f', 2); }
+}  // namespace
+
+int LatencyHistogram::bucketOf(uint64_t v) {
+    if (v < SUB_BUCKETS) return static_cast<int>(v);
+    int p = 63;
+    while (!(v >> p)) p--;
+    const int sub = static_cast<int>((v >> (p - 2)) & (SUB_BUCKETS - 1));
+    return std::min(BUCKETS - 1, (p - 1) * SUB_BUCKETS + sub);
+}
+
+uint64_t LatencyHistogram::bucketUpper(int idx) {
+    if (idx < SUB_BUCKETS) return static_cast<uint64_t>(idx);
+    const int p = idx / SUB_BUCKETS + 1;
+    const uint64_t lower = static_cast<uint64_t>(SUB_BUCKETS + idx % SUB_BUCKETS) << (p - 2);
+    return lower + (1ull << (p - 2)) - 1;
+}
+
+void LatencyHistogram::record(int64_t us) {
+    const auto v = static_cast<uint64_t>(std::max<int64_t>(0, us));
+    this->buckets_[bucketOf(v)].fetch_add(1, std::memory_order_relaxed);
+    this->sum_.fetch_add(v, std::memory_order_relaxed);
+    this->count_.fetch_add(1, std::memory_order_relaxed);
+    updateMax(this->max_, v);
+}
+
+void LatencyHistogram::reset() {
+    for (auto &b : this->buckets_) b = 0;
+    this->count_ = 0;
+    this->sum_ = 0;
+    this->max_ = 0;
+}
+
+double LatencyHistogram::mean() const {
+    const auto n = this->count_.load();
+    return n == 0 ? 0.0 : static_cast<double>(this->sum_.load()) / static_cast<double>(n);
+}
+
+int64_t LatencyHistogram::percentile(double q) const {
+    // 各个桶是分别读取的，并发写入时结果只是近似值
+    uint64_t total = 0;
+    for (auto &b : this->buckets_) total += b.load(std::memory_order_relaxed);
+    if (total == 0) return 0;
+    const auto target = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * static_cast<double>(total))));
+    uint64_t acc = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        acc += this->buckets_[i].load(std::memory_order_relaxed);
+        if (acc >= target) return static_cast<int64_t>(std::min(bucketUpper(i), this->max_.load()));
+    }
+    return this->max();
+}
+
+void PipelineMetrics::record(PipelineMetrics::Stage stage, Clock::duration d) {
+    this->stages_[stage].record(std::chrono::duration_cast<std::chrono::microseconds>(d).count());
+}
+
+void PipelineMetrics::recordLookup(int layer, PipelineMetrics::Lookup r) {
+    if (layer < 0 || layer >= LAYER_COUNT) return;
+    auto &c = this->lookups_[layer];
+    switch (r) {
+        case Hit:
+            c.hit.fetch_add(1, std::memory_order_relaxed);
+            break;
+        case Empty:
+            c.empty.fetch_add(1, std::memory_order_relaxed);
+            break;
+        case Miss:
+            c.miss.fetch_add(1, std::memory_order_relaxed);
+            break;
+    }
+}
+
+void PipelineMetrics::recordQueueDepth(size_t depth) {
+    this->queue_depth_ = depth;
+    updateMax(this->peak_queue_depth_, depth);
+}
+
+const char *PipelineMetrics::stageName(PipelineMetrics::Stage stage) {
+    static const char *names[STAGE_COUNT]{"queue_wait", "load", "bake", "shade", "cache_insert"};
+    return names[stage];
+}
+
+const char *PipelineMetrics::layerName(int layer) {
+    static const char *names[LAYER_COUNT]{"biome", "terrain", "height", "slime"};
+    return layer >= 0 && layer < LAYER_COUNT ? names[layer] : "unknown";
+}
+
+std::vector<QString> PipelineMetrics::debugInfo() const {
+    std::vector<QString> res;
+    res.push_back(QString(" - Queue depth: %1 (peak %2)").arg(QString::number(this->queue_depth_), QString::number(this->peak_queue_depth_)));
+    res.emplace_back("Stage latency (p50/p90/p99 ms):");
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        auto &h = this->stages_[i];
+        res.push_back(QString(" - %1: %2/%3/%4 (%5)")
+                          .arg(stageName(static_cast<Stage>(i)), ms(h.percentile(0.5)), ms(h.percentile(0.9)), ms(h.percentile(0.99)),
+                               QString::number(h.count())));
+    }
+    res.emplace_back("Cache hit ratio:");
+    for (int i = 0; i < LAYER_COUNT; i++) {
+        auto &c = this->lookups_[i];
+        const auto hit = c.hit.load() + c.empty.load();
+        res.push_back(QString(" - %1: %2%").arg(layerName(i), QString::number(ratio(hit, hit + c.miss.load()) * 100.0, 'f', 1)));
+    }
+    return res;
+}
+
+std::string PipelineMetrics::toJson() const {
+    nlohmann::json j;
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        auto &h = this->stages_[i];
+        j["stages"][stageName(static_cast<Stage>(i))] = {
+            {"count", h.count()},           {"mean_us", h.mean()},           {"p50_us", h.percentile(0.5)},
+            {"p90_us", h.percentile(0.9)}, {"p99_us", h.percentile(0.99)}, {"max_us", h.max()},
+        };
+    }
+    for (int i = 0; i < LAYER_COUNT; i++) {
+        auto &c = this->lookups_[i];
+        const auto hit = c.hit.load(), empty = c.empty.load(), miss = c.miss.load();
+        j["cache"][layerName(i)] = {
+            {"hit", hit}, {"empty", empty}, {"miss", miss}, {"hit_ratio", ratio(hit + empty, hit + empty + miss)}};
+    }
+    j["queue_depth"] = this->queue_depth_.load();
+    j["peak_queue_depth"] = this->peak_queue_depth_.load();
+    return j.dump(2);
+}
+
+void PipelineMetrics::reset() {
+    for (auto &h : this->stages_) h.reset();
+    for (auto &c : this->lookups_) {
+        c.hit = 0;
+        c.empty = 0;
+        c.miss = 0;
+    }
+    this->peak_queue_depth_ = this->queue_depth_.load();
+}
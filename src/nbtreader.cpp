@@ -0,0 +1,316 @@
+#include "nbtreader.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+    template <typename T>
+    T readLE(const char *p) {
+        T v;
+        std::memcpy(&v, p, sizeof(T));
+        return v;
+    }
+
+    // 超出int64范围的浮点数直接转换是未定义行为，NaN当作0，其余的截断到边界
+    int64_t clampToInt64(double f) {
+        constexpr double LIMIT = 9223372036854775808.0;  // 2^63
+        if (std::isnan(f)) return 0;
+        if (f >= LIMIT) return std::numeric_limits<int64_t>::max();
+        if (f < -LIMIT) return std::numeric_limits<int64_t>::min();
+        return static_cast<int64_t>(f);
+    }
+
+    // 定长类型的大小，变长类型返回0
+    size_t fixedSize(NbtType type) {
+        switch (type) {
+            case NbtType::Byte:
+                return 1;
+            case NbtType::Short:
+                return 2;
+            case NbtType::Int:
+            case NbtType::Float:
+                return 4;
+            case NbtType::Long:
+            case NbtType::Double:
+                return 8;
+            default:
+                return 0;
+        }
+    }
+}  // namespace
+
+NbtProjection::NbtProjection() { this->nodes_.emplace_back(); }
+
+int NbtProjection::child(int parent, const std::string &key, int index) {
+    for (auto c : this->nodes_[parent].children) {
+        if (this->nodes_[c].index == index && this->nodes_[c].key == key) return c;
+    }
+    this->nodes_.push_back({key, index, {}, {}});
+    const int c = static_cast<int>(this->nodes_.size()) - 1;
+    this->nodes_[parent].children.push_back(c);
+    return c;
+}
+
+int NbtProjection::add(const std::string &path) {
+    if (path.empty()) return -1;
+    // 先完整检查一遍再修改，格式错误时不留下半截路径
+    std::vector<std::pair<std::string, int>> segments;
+    size_t i = 0;
+    while (i < path.size()) {
+        const auto end = path.find_first_of(".[", i);
+        auto key = path.substr(i, end == std::string::npos ? std::string::npos : end - i);
+        if (key.empty()) return -1;
+        segments.emplace_back(key, KEY);
+        i = end == std::string::npos ? path.size() : end;
+        while (i < path.size() && path[i] == '[') {
+            const auto close = path.find(']', i);
+            if (close == std::string::npos) return -1;
+            auto index = path.substr(i + 1, close - i - 1);
+            if (index.empty() || index == "*") {
+                segments.emplace_back("", ANY);
+            } else {
+                if (index.find_first_not_of("0123456789") != std::string::npos || index.size() > 9) return -1;
+                segments.emplace_back("", std::stoi(index));
+            }
+            i = close + 1;
+        }
+        if (i < path.size()) {
+            if (path[i] != '.' || i + 1 == path.size()) return -1;
+            i++;
+        }
+    }
+
+    int node = 0;
+    for (auto &seg : segments) node = this->child(node, seg.first, seg.second);
+    const int id = static_cast<int>(this->path_count_++);
+    this->nodes_[node].ids.push_back(id);
+    return id;
+}
+
+bool NbtReader::fail(const char *msg) {
+    if (!this->error_) this->error_ = msg;
+    return false;
+}
+
+bool NbtReader::need(size_t n) {
+    if (this->error_) return false;
+    if (n > this->size_ - this->pos_) return this->fail("unexpected end of data");
+    return true;
+}
+
+bool NbtReader::readLength(int32_t &len) {
+    if (!this->need(4)) return false;
+    len = readLE<int32_t>(this->data_ + this->pos_);
+    this->pos_ += 4;
+    if (len < 0) return this->fail("negative length");
+    return true;
+}
+
+bool NbtReader::nextTag(NbtType &type, std::string_view &name) {
+    if (!this->need(1)) return false;
+    const auto t = static_cast<uint8_t>(this->data_[this->pos_++]);
+    if (t > static_cast<uint8_t>(NbtType::LongArray)) return this->fail("unknown tag type");
+    type = static_cast<NbtType>(t);
+    name = {};
+    if (type == NbtType::End) return true;
+    if (!this->need(2)) return false;
+    const auto len = readLE<uint16_t>(this->data_ + this->pos_);
+    this->pos_ += 2;
+    if (!this->need(len)) return false;
+    name = std::string_view(this->data_ + this->pos_, len);
+    this->pos_ += len;
+    return true;
+}
+
+bool NbtReader::readValue(NbtType type, NbtValue &value) {
+    value = NbtValue();
+    value.type = type;
+    const char *p = this->data_ + this->pos_;
+    switch (type) {
+        case NbtType::Byte:
+            if (!this->need(1)) return false;
+            value.i = static_cast<int8_t>(*p);
+            break;
+        case NbtType::Short:
+            if (!this->need(2)) return false;
+            value.i = readLE<int16_t>(p);
+            break;
+        case NbtType::Int:
+            if (!this->need(4)) return false;
+            value.i = readLE<int32_t>(p);
+            break;
+        case NbtType::Long:
+            if (!this->need(8)) return false;
+            value.i = readLE<int64_t>(p);
+            break;
+        case NbtType::Float:
+            if (!this->need(4)) return false;
+            value.f = readLE<float>(p);
+            value.i = clampToInt64(value.f);
+            this->pos_ += 4;
+            return true;
+        case NbtType::Double:
+            if (!this->need(8)) return false;
+            value.f = readLE<double>(p);
+            value.i = clampToInt64(value.f);
+            this->pos_ += 8;
+            return true;
+        case NbtType::String: {
+            if (!this->need(2)) return false;
+            const auto len = readLE<uint16_t>(p);
+            this->pos_ += 2;
+            if (!this->need(len)) return false;
+            value.i = len;
+            value.s = std::string_view(this->data_ + this->pos_, len);
+            this->pos_ += len;
+            return true;
+        }
+        case NbtType::ByteArray:
+        case NbtType::IntArray:
+        case NbtType::LongArray: {
+            int32_t len;
+            if (!this->readLength(len)) return false;
+            const size_t bytes = static_cast<size_t>(len) * (type == NbtType::ByteArray ? 1 : type == NbtType::IntArray ? 4 : 8);
+            if (!this->need(bytes)) return false;
+            value.i = len;
+            value.s = std::string_view(this->data_ + this->pos_, bytes);
+            this->pos_ += bytes;
+            return true;
+        }
+        default:
+            return this->fail("not a value type");
+    }
+    this->pos_ += fixedSize(type);
+    value.f = static_cast<double>(value.i);
+    return true;
+}
+
+bool NbtReader::skip(NbtType type) { return this->skip(type, 0); }
+
+bool NbtReader::skip(NbtType type, int depth) {
+    if (depth > MAX_DEPTH) return this->fail("nesting too deep");
+    if (type == NbtType::List) {
+        if (!this->need(1)) return false;
+        const auto t = static_cast<uint8_t>(this->data_[this->pos_++]);
+        if (t > static_cast<uint8_t>(NbtType::LongArray)) return this->fail("unknown tag type");
+        const auto elem = static_cast<NbtType>(t);
+        int32_t len;
+        if (!this->readLength(len)) return false;
+        // 定长元素的列表(比如Pos)直接跳过
+        const auto size = fixedSize(elem);
+        if (size > 0 || elem == NbtType::End) {
+            if (!this->need(size * len)) return false;
+            this->pos_ += size * len;
+            return true;
+        }
+        for (int32_t i = 0; i < len; i++) {
+            if (!this->skip(elem, depth + 1)) return false;
+        }
+        return true;
+    }
+    if (type == NbtType::Compound) {
+        NbtType t;
+        std::string_view name;
+        while (this->nextTag(t, name)) {
+            if (t == NbtType::End) return true;
+            if (!this->skip(t, depth + 1)) return false;
+        }
+        return false;
+    }
+    const auto size = fixedSize(type);
+    if (size > 0) {
+        if (!this->need(size)) return false;
+        this->pos_ += size;
+        return true;
+    }
+    NbtValue unused;
+    return this->readValue(type, unused);
+}
+
+bool NbtReader::skipTag() {
+    NbtType type;
+    std::string_view name;
+    if (!this->nextTag(type, name)) return false;
+    return type == NbtType::End || this->skip(type);
+}
+
+bool NbtReader::project(const NbtProjection &projection, const Callback &cb) {
+    NbtType type;
+    std::string_view name;
+    if (!this->nextTag(type, name)) return false;
+    if (type == NbtType::End) return true;
+    return this->projectPayload(projection, 0, type, cb, 0);
+}
+
+bool NbtReader::projectPayload(const NbtProjection &projection, int node, NbtType type, const Callback &cb, int depth) {
+    if (depth > MAX_DEPTH) return this->fail("nesting too deep");
+    auto &n = projection.nodes_[node];
+    if (type != NbtType::List && type != NbtType::Compound) {
+        if (n.ids.empty()) return this->skip(type, depth);
+        NbtValue value;
+        if (!this->readValue(type, value)) return false;
+        for (auto id : n.ids) cb(id, value);
+        return true;
+    }
+
+    if (type == NbtType::Compound) {
+        if (!n.ids.empty()) {
+            NbtValue value;
+            value.type = type;
+            for (auto id : n.ids) cb(id, value);
+        }
+        if (n.children.empty()) return this->skip(type, depth);
+        NbtType t;
+        std::string_view name;
+        while (this->nextTag(t, name)) {
+            if (t == NbtType::End) return true;
+            int next = -1;
+            for (auto c : n.children) {
+                auto &child = projection.nodes_[c];
+                if (child.index == NbtProjection::KEY && child.key == name) {
+                    next = c;
+                    break;
+                }
+            }
+            if (!(next < 0 ? this->skip(t, depth + 1) : this->projectPayload(projection, next, t, cb, depth + 1))) return false;
+        }
+        return false;
+    }
+
+    // List
+    const auto begin = this->pos_;
+    if (!this->need(1)) return false;
+    const auto t = static_cast<uint8_t>(this->data_[this->pos_++]);
+    if (t > static_cast<uint8_t>(NbtType::LongArray)) return this->fail("unknown tag type");
+    const auto elem = static_cast<NbtType>(t);
+    int32_t len;
+    if (!this->readLength(len)) return false;
+    if (!n.ids.empty()) {
+        NbtValue value;
+        value.type = type;
+        value.i = len;
+        for (auto id : n.ids) cb(id, value);
+    }
+    if (n.children.empty()) {
+        this->pos_ = begin;
+        return this->skip(type, depth);
+    }
+    for (int32_t i = 0; i < len; i++) {
+        // 同一个元素可能同时命中下标和[]，这时回退重新读一遍
+        const auto start = this->pos_;
+        size_t end = start;
+        bool matched = false;
+        for (auto c : n.children) {
+            auto &child = projection.nodes_[c];
+            if (child.index != NbtProjection::ANY && child.index != i) continue;
+            this->pos_ = start;
+            if (!this->projectPayload(projection, c, elem, cb, depth + 1)) return false;
+            end = this->pos_;
+            matched = true;
+        }
+        if (!matched && !this->skip(elem, depth + 1)) return false;
+        if (matched) this->pos_ = end;
+    }
+    return true;
+}
@@ -0,0 +1,230 @@
+#include "nbtsearch.h"
+
+#include <QtDebug>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+    // 每条记录都会读取的路径，查询条件的路径排在后面
+    enum ReservedPath { BlockEntityId, ActorId, BlockX, BlockY, BlockZ, PosX, PosY, PosZ, RESERVED_PATHS };
+
+    constexpr size_t MAX_CLAUSES = 64;
+    constexpr size_t MAX_HITS = 100000;  // 超过之后只计数不保存
+
+    bool isOpChar(char c) { return c == '=' || c == '!' || c == '<' || c == '>' || c == '~' || c == '&' || c == '|'; }
+}  // namespace
+
+bool NbtQuery::Clause::test(const NbtValue &v) const {
+    if (this->op == Exists) return true;
+    if (v.type == NbtType::String) {
+        const int c = v.s.compare(this->text);
+        switch (this->op) {
+            case Eq:
+                return c == 0;
+            case Ne:
+                return c != 0;
+            case Lt:
+                return c < 0;
+            case Le:
+                return c <= 0;
+            case Gt:
+                return c > 0;
+            case Ge:
+                return c >= 0;
+            case Contains:
+                return v.s.find(this->text) != std::string_view::npos;
+            default:
+                return false;
+        }
+    }
+    if (!v.isNumber() || !this->is_number) return false;
+    switch (this->op) {
+        case Eq:
+            return v.f == this->number;
+        case Ne:
+            return v.f != this->number;
+        case Lt:
+            return v.f < this->number;
+        case Le:
+            return v.f <= this->number;
+        case Gt:
+            return v.f > this->number;
+        case Ge:
+            return v.f >= this->number;
+        default:
+            return false;
+    }
+}
+
+bool NbtQuery::parse(const std::string &text, std::string &error) {
+    this->projection_ = NbtProjection();
+    this->clauses_.clear();
+    this->groups_.assign(1, 0);
+    for (auto *path : {"id", "identifier", "x", "y", "z", "Pos[0]", "Pos[1]", "Pos[2]"}) this->projection_.add(path);
+
+    size_t i = 0;
+    auto skipSpace = [&]() {
+        while (i < text.size() && std::isspace(static_cast<unsigned char>(text[i]))) i++;
+    };
+    auto startsWith = [&](const char *s) { return text.compare(i, std::strlen(s), s) == 0; };
+
+    skipSpace();
+    if (i == text.size()) {
+        error = "查询条件为空";
+        return false;
+    }
+    while (true) {
+        skipSpace();
+        const auto begin = i;
+        while (i < text.size() && !std::isspace(static_cast<unsigned char>(text[i])) && !isOpChar(text[i])) i++;
+        auto path = text.substr(begin, i - begin);
+        if (path.empty()) {
+            error = "第" + std::to_string(begin + 1) + "个字符处缺少路径";
+            return false;
+        }
+        if (this->clauses_.size() >= MAX_CLAUSES) {
+            error = "条件太多";
+            return false;
+        }
+        if (this->projection_.add(path) < 0) {
+            error = "路径格式错误: " + path;
+            return false;
+        }
+
+        Clause clause;
+        skipSpace();
+        // 两个字符的运算符要先匹配
+        static const std::pair<const char *, Op> OPS[]{
+            {"==", Eq}, {"!=", Ne}, {"<=", Le}, {">=", Ge}, {"~=", Contains}, {"<", Lt}, {">", Gt},
+        };
+        for (auto &op : OPS) {
+            if (startsWith(op.first)) {
+                clause.op = op.second;
+                i += std::strlen(op.first);
+                break;
+            }
+        }
+        if (clause.op != Exists) {
+            skipSpace();
+            if (i < text.size() && text[i] == '"') {
+                i++;
+                bool closed = false;
+                while (i < text.size()) {
+                    if (text[i] == '\\' && i + 1 < text.size()) {
+                        clause.text += text[i + 1];
+                        i += 2;
+                    } else if (text[i] == '"') {
+                        i++;
+                        closed = true;
+                        break;
+                    } else {
+                        clause.text += text[i++];
+                    }
+                }
+                if (!closed) {
+                    error = "字符串缺少结束的引号";
+                    return false;
+                }
+            } else {
+                const auto vb = i;
+                while (i < text.size() && !std::isspace(static_cast<unsigned char>(text[i])) && text[i] != '&' && text[i] != '|') i++;
+                clause.text = text.substr(vb, i - vb);
+                if (clause.text.empty()) {
+                    error = "路径" + path + "缺少比较的值";
+                    return false;
+                }
+                char *end = nullptr;
+                clause.number = std::strtod(clause.text.c_str(), &end);
+                clause.is_number = end && *end == '\0';
+            }
+        }
+        this->groups_.back() |= uint64_t{1} << this->clauses_.size();
+        this->clauses_.push_back(std::move(clause));
+
+        skipSpace();
+        if (i == text.size()) break;
+        if (startsWith("&&")) {
+            i += 2;
+        } else if (startsWith("||")) {
+            i += 2;
+            this->groups_.push_back(0);
+        } else {
+            error = "第" + std::to_string(i + 1) + "个字符处无法识别: " + text.substr(i, 16);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool NbtQuery::match(const NbtRecordScan::Record &record, const std::function<void(NbtSearchHit &&)> &onHit) const {
+    NbtReader reader(record.value.data(), record.value.size());
+    while (!reader.atEnd()) {
+        uint64_t satisfied = 0;
+        std::string_view id;
+        double pos[6]{};  // x y z Pos[0] Pos[1] Pos[2]
+        unsigned found = 0;
+        auto ok = reader.project(this->projection_, [&](int path, const NbtValue &v) {
+            if (path >= RESERVED_PATHS) {
+                const auto k = static_cast<size_t>(path - RESERVED_PATHS);
+                if (this->clauses_[k].test(v)) satisfied |= uint64_t{1} << k;
+            } else if (path == BlockEntityId || path == ActorId) {
+                if (v.type == NbtType::String) id = v.s;
+            } else if (v.isNumber()) {
+                pos[path - BlockX] = v.f;
+                found |= 1u << (path - BlockX);
+            }
+        });
+        if (!ok) return false;
+        bool accepted = false;
+        for (auto g : this->groups_) accepted = accepted || (g != 0 && (satisfied & g) == g);
+        if (!accepted) continue;
+
+        NbtSearchHit hit;
+        hit.kind = record.kind;
+        hit.dim = record.cp.dim;
+        hit.id = std::string(id);
+        // 实体用Pos，方块实体用x y z，都没有时取区块中心
+        constexpr unsigned ACTOR_POS = 1u << (PosX - BlockX) | 1u << (PosZ - BlockX);
+        constexpr unsigned BLOCK_POS = 1u << 0 | 1u << (BlockZ - BlockX);
+        const int base = (found & ACTOR_POS) == ACTOR_POS ? PosX - BlockX : ((found & BLOCK_POS) == BLOCK_POS ? 0 : -1);
+        if (base >= 0) {
+            hit.x = pos[base];
+            hit.y = pos[base + 1];
+            hit.z = pos[base + 2];
+        } else {
+            hit.x = record.cp.x * 16 + 8;
+            hit.z = record.cp.z * 16 + 8;
+        }
+        onHit(std::move(hit));
+    }
+    return true;
+}
+
+bool NbtSearch::run(leveldb::DB *db, int threads, const NbtQuery &query, uint8_t kinds) {
+    {
+        std::lock_guard<std::mutex> lk(this->mu_);
+        this->pending_.clear();
+    }
+    this->hit_count_ = 0;
+    this->bad_records_ = 0;
+    auto onHit = [this](NbtSearchHit &&hit) {
+        if (this->hit_count_++ >= MAX_HITS) return;
+        std::lock_guard<std::mutex> lk(this->mu_);
+        this->pending_.push_back(std::move(hit));
+    };
+    auto visit = [&](size_t, const NbtRecordScan::Record &record) {
+        if (!query.match(record, onHit)) ++this->bad_records_;
+        return true;
+    };
+    auto res = this->scan_.run(db, threads, kinds, [](size_t) {}, visit);
+    if (this->bad_records_ > 0) qWarning() << "NBT search skipped " << this->bad_records_.load() << " malformed records";
+    return res;
+}
+
+std::vector<NbtSearchHit> NbtSearch::takeHits() {
+    std::vector<NbtSearchHit> res;
+    std::lock_guard<std::mutex> lk(this->mu_);
+    res.swap(this->pending_);
+    return res;
+}
@@ -0,0 +1,122 @@
+#include "nbtsearchdialog.h"
+
+#include <QtConcurrent>
+#include <QtDebug>
+#include <cmath>
+
+#include "config.h"
+#include "mainwindow.h"
+#include "msg.h"
+#include "trace.h"
+#include "ui_nbtsearchdialog.h"
+
+NbtSearchDialog::NbtSearchDialog(MainWindow *mw, QWidget *parent) : QDialog(parent), ui(new Ui::NbtSearchDialog), mw_(mw) {
+    ui->setupUi(this);
+    connect(&this->search_watcher_, &QFutureWatcher<bool>::finished, this, &NbtSearchDialog::handle_search_finished);
+    connect(&this->progress_timer_, &QTimer::timeout, this, &NbtSearchDialog::drainHits);
+}
+
+NbtSearchDialog::~NbtSearchDialog() {
+    this->stop();
+    delete ui;
+}
+
+void NbtSearchDialog::stop() {
+    if (!this->search_watcher_.isRunning()) return;
+    this->search_.cancel();
+    this->search_watcher_.waitForFinished();
+}
+
+void NbtSearchDialog::clearResults() {
+    this->hits_.clear();
+    ui->result_list->clear();
+    ui->progress_bar->setValue(0);
+    this->mw_->mapWidget()->update();
+}
+
+void NbtSearchDialog::on_search_btn_clicked() {
+    if (this->search_watcher_.isRunning()) return;
+    if (!CHECK_CONDITION(this->mw_->levelLoader()->isOpen(), "未打开存档")) return;
+    std::string error;
+    if (!this->query_.parse(ui->query_edit->text().toStdString(), error)) {
+        WARN(QString("查询条件有误: ") + error.c_str());
+        return;
+    }
+    uint8_t kinds = 0;
+    if (ui->block_entity_box->isChecked()) kinds |= NbtRecordScan::BlockEntity;
+    if (ui->entity_box->isChecked()) kinds |= NbtRecordScan::Entity;
+    if (ui->actor_box->isChecked()) kinds |= NbtRecordScan::Actor;
+    if (!CHECK_CONDITION(kinds != 0, "至少选择一种数据")) return;
+    // 搜索期间不允许重新打开存档，正在重新打开时会先等它完成，失败时存档已经被关闭
+    auto *loader = this->mw_->levelLoader();
+    if (!loader->pinLevel()) return;
+
+    this->clearResults();
+    ui->search_btn->setEnabled(false);
+    ui->stop_btn->setEnabled(true);
+    ui->status_label->setText("正在搜索...");
+    qInfo() << "Start NBT search: " << ui->query_edit->text();
+
+    auto *db = loader->level().db();
+    this->search_.reset();
+    auto future = QtConcurrent::run([this, loader, db, kinds]() {
+        TRACE_SCOPE("nbt_search");
+        auto res = this->search_.run(db, cfg::THREAD_NUM, this->query_, kinds);
+        loader->unpinLevel();
+        return res;
+    });
+    this->search_watcher_.setFuture(future);
+    this->progress_timer_.start(200);
+}
+
+void NbtSearchDialog::on_stop_btn_clicked() { this->search_.cancel(); }
+
+void NbtSearchDialog::on_clear_btn_clicked() {
+    if (this->search_watcher_.isRunning()) return;
+    this->clearResults();
+    ui->status_label->clear();
+}
+
+void NbtSearchDialog::on_result_list_itemDoubleClicked(QListWidgetItem *item) {
+    const auto index = item->data(Qt::UserRole).toULongLong();
+    if (index >= this->hits_.size()) return;
+    auto &hit = this->hits_[index];
+    if (!CHECK_CONDITION(hit.dim >= 0 && hit.dim <= 2, "无法确定这个实体所在的维度")) return;
+    this->mw_->gotoDimensionBlockPos(hit.dim, static_cast<int>(std::floor(hit.x)), static_cast<int>(std::floor(hit.z)));
+}
+
+void NbtSearchDialog::drainHits() {
+    auto hits = this->search_.takeHits();
+    ui->progress_bar->setMaximum(std::max(1, this->search_.total()));
+    ui->progress_bar->setValue(this->search_.progress());
+    ui->status_label->setText(QString("已找到%1个结果").arg(this->search_.hitCount()));
+    if (hits.empty()) return;
+    for (auto &hit : hits) {
+        const char *name = hit.id.empty() ? NbtRecordScan::kindName(hit.kind) : hit.id.c_str();
+        auto *item = new QListWidgetItem(QString("[%1] %2  %3, %4, %5")
+                                             .arg(NbtRecordScan::dimName(hit.dim), name)
+                                             .arg(static_cast<int>(std::floor(hit.x)))
+                                             .arg(static_cast<int>(std::floor(hit.y)))
+                                             .arg(static_cast<int>(std::floor(hit.z))));
+        item->setData(Qt::UserRole, static_cast<qulonglong>(this->hits_.size()));
+        ui->result_list->addItem(item);
+        this->hits_.push_back(std::move(hit));
+    }
+    this->mw_->mapWidget()->update();
+}
+
+void NbtSearchDialog::handle_search_finished() {
+    this->progress_timer_.stop();
+    this->drainHits();
+    ui->search_btn->setEnabled(true);
+    ui->stop_btn->setEnabled(false);
+    const auto found = this->search_.hitCount();
+    if (!this->search_watcher_.result()) {
+        ui->status_label->setText(QString("搜索已停止，找到%1个结果").arg(found));
+        return;
+    }
+    auto text = QString("搜索完成，找到%1个结果").arg(found);
+    if (found > this->hits_.size()) text += QString("(只显示前%1个)").arg(this->hits_.size());
+    ui->status_label->setText(text);
+    qInfo() << "NBT search finished: " << found << " hits";
+}
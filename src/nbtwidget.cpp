@@ -74,6 +74,45 @@ bool NBTTreeItem::tryAddChild(bl::palette::abstract_tag *tag) {
     return true;
 }
 
+NBTListItem *NBTListItem::from(bl::palette::compound_tag *data, const QString &default_label, const QString &key) {
+    auto *it = new NBTListItem();
+    it->root_ = data;
+    it->tracked_bytes_ = MemStats::estimateNbt(data);
+    MemStats::add(MemStats::NbtTrees, it->tracked_bytes_);
+    it->default_label = default_label;
+    it->raw_key = key.isEmpty() ? default_label : key;
+    it->setText(it->getLabel());
+    return it;
+}
+
+NBTListItem *NBTListItem::fromRaw(std::string raw, const QString &default_label, const QString &key) {
+    auto *it = new NBTListItem();
+    it->raw_ = std::move(raw);
+    it->tracked_bytes_ = static_cast<int64_t>(it->raw_.capacity());
+    MemStats::add(MemStats::NbtTrees, it->tracked_bytes_);
+    it->default_label = default_label;
+    it->raw_key = key;
+    it->setText(it->getLabel());
+    return it;
+}
+
+bl::palette::compound_tag *NBTListItem::tag() {
+    if (this->root_ || this->raw_.empty()) return this->root_;
+    auto palette = bl::palette::read_palette_to_end(this->raw_.data(), this->raw_.size());
+    if (palette.empty()) return nullptr;
+    this->root_ = palette[0];
+    for (size_t i = 1; i < palette.size(); i++) delete palette[i];
+    const auto bytes = MemStats::estimateNbt(this->root_);
+    this->tracked_bytes_ += bytes;
+    MemStats::add(MemStats::NbtTrees, bytes);
+    return this->root_;
+}
+
+std::string NBTListItem::toRaw() const {
+    if (!this->modified_ && !this->raw_.empty()) return this->raw_;
+    return this->root_ ? this->root_->to_raw() : std::string();
+}
+
 NbtWidget::NbtWidget(QWidget *parent) : QWidget(parent), ui(new Ui::NbtWidget) {
     ui->setupUi(this);
     ui->splitter->setStretchFactor(0, 1);
@@ -137,9 +176,14 @@ void NbtWidget::on_list_widget_itemDoubleClicked(QListWidgetItem *item) {
         QMessageBox::information(nullptr, "警告", "空的nbt数据", QMessageBox::Yes, QMessageBox::Yes);
         return;
     }
+    auto *root = nbtItem->tag();
+    if (!root) {
+        WARN("无法解析NBT数据");
+        return;
+    }
     this->current_opened_ = nbtItem;
     qDebug() << "Select NBT item : [" << this->current_opened_->raw_key << "] -> " << nbtItem->getLabel();
-    this->openNBTItem(nbtItem->root_);
+    this->openNBTItem(root);
     this->refreshLabel();
 }
 
@@ -186,7 +230,7 @@ void NbtWidget::prepareTreeWidgetMenu(const QPoint &pos) {
                 WARN("创建节点失败: 已存在相同key的TAG");
             } else {
                 current->updateLabel();
-                putModifyToCache(current_opened_->raw_key.toStdString(), current_opened_->root_->to_raw());
+                this->putOpenedModifyToCache();
             }
         }
     });
@@ -205,7 +249,7 @@ void NbtWidget::prepareTreeWidgetMenu(const QPoint &pos) {
                 WARN("修改节点失败： " + err);
             } else {
                 current->updateLabel();
-                putModifyToCache(current_opened_->raw_key.toStdString(), current_opened_->root_->to_raw());
+                this->putOpenedModifyToCache();
             }
         }
     });
@@ -235,7 +279,7 @@ void NbtWidget::prepareTreeWidgetMenu(const QPoint &pos) {
             tag->remove(idx);
             parent->updateLabel();
         }
-        putModifyToCache(current_opened_->raw_key.toStdString(), current_opened_->root_->to_raw());
+        this->putOpenedModifyToCache();
         parent->removeChild(current);
         delete current;
     });
@@ -259,7 +303,7 @@ void NbtWidget::prepareTreeWidgetMenu(const QPoint &pos) {
         auto children = current->takeChildren();
         qDeleteAll(children);
         current->updateLabel();
-        putModifyToCache(current_opened_->raw_key.toStdString(), current_opened_->root_->to_raw());
+        this->putOpenedModifyToCache();
     });
     menu.exec(ui->tree_widget->mapToGlobal(pos));
 }
@@ -294,8 +338,9 @@ void NbtWidget::prepareListWidgetMenu(const QPoint &pos) {
             if (!this->modify_allowed_) return;
             // create a new NBT item and push back to the end
             auto *nbtItem = NBTListItem::from(new bl::palette::compound_tag("New"), QString::number(ui->list_widget->count()));
+            nbtItem->markModified();
             ui->list_widget->addItem(nbtItem);
-            putModifyToCache(nbtItem->raw_key.toStdString(), nbtItem->root_->to_raw());
+            putModifyToCache(nbtItem->raw_key.toStdString(), nbtItem->toRaw());
             this->refreshLabel();
         });
         QObject::connect(clearAction, &QAction::triggered, [this, pos](bool) {
@@ -384,12 +429,12 @@ void NbtWidget::saveNBTs(bool selectOnly) {
     std::string res;
     if (selectOnly) {
         for (auto &item : ui->list_widget->selectedItems()) {
-            if (!item->isHidden()) res += dynamic_cast<NBTListItem *>(item)->root_->to_raw();
+            if (!item->isHidden()) res += dynamic_cast<NBTListItem *>(item)->toRaw();
         }
     } else {
         for (int i = 0; i < ui->list_widget->count(); ++i) {
             auto *item = ui->list_widget->item(i);
-            if (!item->isHidden()) res += dynamic_cast<NBTListItem *>(item)->root_->to_raw();
+            if (!item->isHidden()) res += dynamic_cast<NBTListItem *>(item)->toRaw();
         }
     }
 
@@ -399,7 +444,7 @@ void NbtWidget::saveNBTs(bool selectOnly) {
 std::string NbtWidget::getCurrentPaletteRaw() {
     std::string res;
     for (int i = 0; i < ui->list_widget->count(); ++i) {
-        res += dynamic_cast<NBTListItem *>(ui->list_widget->item(i))->root_->to_raw();
+        res += dynamic_cast<NBTListItem *>(ui->list_widget->item(i))->toRaw();
     }
     return res;
 }
@@ -407,7 +452,8 @@ std::string NbtWidget::getCurrentPaletteRaw() {
 std::vector<bl::palette::compound_tag *> NbtWidget::getPaletteCopy() {
     std::vector<bl::palette::compound_tag *> res;
     for (int i = 0; i < ui->list_widget->count(); ++i) {
-        res.push_back(dynamic_cast<bl::palette::compound_tag *>(dynamic_cast<NBTListItem *>(ui->list_widget->item(i))->root_->copy()));
+        auto *tag = dynamic_cast<NBTListItem *>(ui->list_widget->item(i))->tag();
+        res.push_back(tag ? dynamic_cast<bl::palette::compound_tag *>(tag->copy()) : nullptr);
     }
     return res;
 }
@@ -416,7 +462,7 @@ void NbtWidget::foreachItem(const std::function<void(const std::string &, bl::pa
     for (int i = 0; i < ui->list_widget->count(); ++i) {
         auto *item = dynamic_cast<NBTListItem *>(ui->list_widget->item(i));
         if (item) {
-            func(item->getLabel().toStdString(), item->root_);
+            func(item->getLabel().toStdString(), item->tag());
         }
     }
 }
@@ -458,6 +504,12 @@ NbtWidget::~NbtWidget() {
     this->clearData();
 }
 
+void NbtWidget::putOpenedModifyToCache() {
+    if (!this->current_opened_) return;
+    this->current_opened_->markModified();
+    this->putModifyToCache(this->current_opened_->raw_key.toStdString(), this->current_opened_->toRaw());
+}
+
 void NbtWidget::putModifyToCache(const std::string &key, const std::string &value) {
     if (enable_modify_cache_) {
         this->modified_cache_[key] = value;
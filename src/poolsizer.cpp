@@ -0,0 +1,122 @@
+#include "poolsizer.h"
+
+#ifdef WIN32
+// clang-format off
+#include <Windows.h>
+// clang-format on
+#else
+#include <ctime>
+#endif
+
+#include <QThread>
+#include <algorithm>
+#include <chrono>
+
+namespace {
+    constexpr double IO_BOUND_RATIO = 0.5;   // 超过一半的时间在等I/O，加线程能提高吞吐
+    constexpr double CPU_BOUND_RATIO = 0.2;  // 几乎都在计算，线程多于核心数只会互相抢占
+    constexpr double REGRESSION = 0.9;       // 减少线程之后吞吐量下降超过10%就认为调整是错的
+    constexpr double IMPROVEMENT = 1.05;     // 增加线程之后吞吐量至少要提高5%才保留
+    constexpr double CPU_SATURATED = 0.85;   // 整个进程的CPU占用超过所有核心的85%，认为核心已经跑满
+
+    int64_t nowMicros() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}  // namespace
+
+PoolSizer::PoolSizer(int initial, int min, int max) : min_(std::max(1, min)), max_(std::max(std::max(1, min), max)) {
+    this->size_ = std::clamp(initial, this->min_, this->max_);
+    this->window_start_us_ = nowMicros();
+    this->window_cpu_us_ = processCpuTime();
+}
+
+int64_t PoolSizer::threadCpuTime() {
+#ifdef WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) return 0;
+    auto ticks = [](const FILETIME &t) { return (static_cast<int64_t>(t.dwHighDateTime) << 32) | t.dwLowDateTime; };
+    return (ticks(kernel) + ticks(user)) / 10;  // 100ns
+#else
+    timespec ts{};
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+int64_t PoolSizer::processCpuTime() {
+#ifdef WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) return 0;
+    auto ticks = [](const FILETIME &t) { return (static_cast<int64_t>(t.dwHighDateTime) << 32) | t.dwLowDateTime; };
+    return (ticks(kernel) + ticks(user)) / 10;  // 100ns
+#else
+    timespec ts{};
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0) return 0;
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+void PoolSizer::record(int64_t wall_us, int64_t cpu_us) {
+    this->wall_us_.fetch_add(static_cast<uint64_t>(std::max<int64_t>(0, wall_us)), std::memory_order_relaxed);
+    this->cpu_us_.fetch_add(static_cast<uint64_t>(std::max<int64_t>(0, std::min(cpu_us, wall_us))), std::memory_order_relaxed);
+    this->tasks_.fetch_add(1, std::memory_order_release);
+}
+
+int PoolSizer::adjust(size_t backlog) {
+    const auto now = nowMicros();
+    const auto process_cpu = processCpuTime();
+    // 队列空闲时吞吐量只取决于请求的速度，不能说明线程数合不合适
+    if (backlog <= static_cast<size_t>(this->size_) || this->min_ == this->max_) {
+        this->tasks_ = 0;
+        this->wall_us_ = 0;
+        this->cpu_us_ = 0;
+        this->window_start_us_ = now;
+        this->window_cpu_us_ = process_cpu;
+        this->last_step_ = 0;
+        this->last_throughput_ = 0;
+        return this->size_;
+    }
+    if (this->tasks_.load(std::memory_order_relaxed) < MIN_SAMPLES) return this->size_;
+
+    // 先取任务数，record最后才增加任务数，取到的每个任务的时间都已经累加进去了
+    const auto tasks = this->tasks_.exchange(0, std::memory_order_acquire);
+    const auto wall = this->wall_us_.exchange(0);
+    const auto cpu = this->cpu_us_.exchange(0);
+    const auto elapsed = std::max<int64_t>(1, now - this->window_start_us_);
+    const auto cores = std::max(1, QThread::idealThreadCount());
+    // 墙钟减CPU时间里既有I/O等待也有排队等核心的时间，只有整个进程没有用满所有核心时才是真的在等I/O
+    this->cpu_load_ = static_cast<double>(process_cpu - this->window_cpu_us_) / (static_cast<double>(elapsed) * cores);
+    this->window_start_us_ = now;
+    this->window_cpu_us_ = process_cpu;
+    const double throughput = static_cast<double>(tasks) * 1e6 / static_cast<double>(elapsed);
+    this->io_ratio_ = wall == 0 ? 0.0 : 1.0 - static_cast<double>(cpu) / static_cast<double>(wall);
+    const bool saturated = this->cpu_load_ > CPU_SATURATED;
+
+    int step = 0;
+    if (this->last_step_ > 0 && throughput < this->last_throughput_ * IMPROVEMENT) {
+        step = -this->last_step_;  // 多出来的线程没有带来吞吐量，退回去
+    } else if (this->last_step_ < 0 && throughput < this->last_throughput_ * REGRESSION) {
+        step = -this->last_step_;
+    } else if (this->io_ratio_ > IO_BOUND_RATIO && (this->size_ < cores || !saturated)) {
+        step = 1;
+    } else if ((this->io_ratio_ < CPU_BOUND_RATIO || saturated) && this->size_ > cores) {
+        step = -1;
+    }
+    const int next = std::clamp(this->size_ + step, this->min_, this->max_);
+    const int applied = next - this->size_;
+    // 刚退回过的下一轮不再和上一轮比较，避免在两个值之间来回跳
+    this->last_step_ = applied != 0 && applied == -this->last_step_ ? 0 : applied;
+    this->last_throughput_ = throughput;
+    this->size_ = next;
+    return this->size_;
+}
+
+std::vector<QString> PoolSizer::debugInfo() const {
+    std::vector<QString> res;
+    res.push_back(QString(" - Active threads: %1 (%2 ~ %3)")
+                      .arg(QString::number(this->size_), QString::number(this->min_), QString::number(this->max_)));
+    res.push_back(QString(" - I/O wait: %1%, CPU load: %2%, %3 regions/s")
+                      .arg(QString::number(this->io_ratio_ * 100.0, 'f', 1), QString::number(this->cpu_load_ * 100.0, 'f', 1),
+                           QString::number(this->last_throughput_, 'f', 1)));
+    return res;
+}
@@ -0,0 +1,127 @@
+#include "recordscan.h"
+
+#include <QtDebug>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "keyutils.h"
+#include "levelscan.h"
+
+namespace {
+    constexpr size_t ACTOR_PREFIX_LEN = 11;  // "actorprefix"
+    constexpr size_t UID_LEN = 8;
+
+    enum ChunkKeyType { BlockEntityKey = 49, EntityKey = 50 };
+
+    uint64_t readUid(const char *p) {
+        uint64_t v;
+        std::memcpy(&v, p, UID_LEN);
+        return v;
+    }
+
+    // digp的value是这个区块里所有实体uid的列表
+    bool buildActorChunks(leveldb::DB *db, const std::vector<KeyRange> &ranges, int threads, const std::atomic_bool &cancel,
+                          std::atomic_int &progress, std::unordered_map<uint64_t, bl::chunk_pos> &res) {
+        std::mutex mu;
+        std::atomic_bool failed{false};
+        parallelForRanges(ranges, threads, [&](size_t, const KeyRange &range) {
+            std::vector<std::pair<uint64_t, bl::chunk_pos>> local;
+            std::unique_ptr<leveldb::Iterator> it(db->NewIterator(bulkReadOptions()));
+            bl::chunk_pos cp;
+            for (it->Seek(range.begin); it->Valid() && inRange(it->key(), range) && !cancel; it->Next()) {
+                auto key = it->key();
+                if (!parseDigestKeyPos(key.data(), key.size(), cp)) continue;
+                auto value = it->value();
+                for (size_t i = 0; i + UID_LEN <= value.size(); i += UID_LEN) local.emplace_back(readUid(value.data() + i), cp);
+            }
+            if (!it->status().ok()) failed = true;
+            {
+                std::lock_guard<std::mutex> lk(mu);
+                res.insert(local.begin(), local.end());
+            }
+            ++progress;
+            return !cancel && !failed;
+        });
+        return !cancel && !failed;
+    }
+}  // namespace
+
+const char *NbtRecordScan::kindName(Kind kind) {
+    switch (kind) {
+        case BlockEntity:
+            return "block_entity";
+        case Entity:
+            return "entity";
+        case Actor:
+            return "actor";
+        default:
+            return "unknown";
+    }
+}
+
+const char *NbtRecordScan::dimName(int dim) {
+    switch (dim) {
+        case 0:
+            return "overworld";
+        case 1:
+            return "nether";
+        case 2:
+            return "the_end";
+        default:
+            return "unknown";
+    }
+}
+
+bool NbtRecordScan::run(leveldb::DB *db, int threads, uint8_t kinds, const std::function<void(size_t)> &init, const Visitor &fn) {
+    if (!db) return false;
+    this->progress_ = 0;
+    threads = std::max(1, threads);
+    auto ranges = splitKeyRanges(db, static_cast<size_t>(threads) * 8);
+    std::vector<KeyRange> digests;
+    if (kinds & Actor) digests = splitKeyRanges(db, static_cast<size_t>(threads) * 2, "digp");
+    this->total_ = static_cast<int>(ranges.size() + digests.size());
+
+    std::unordered_map<uint64_t, bl::chunk_pos> actor_chunks;
+    if (kinds & Actor) {
+        if (!buildActorChunks(db, digests, threads, this->cancel_, this->progress_, actor_chunks)) return false;
+        qInfo() << "Actor digests: " << actor_chunks.size();
+    }
+
+    init(ranges.size());
+    std::atomic_bool failed{false};
+    parallelForRanges(ranges, threads, [&](size_t i, const KeyRange &range) {
+        std::unique_ptr<leveldb::Iterator> it(db->NewIterator(bulkReadOptions()));
+        Record record{BlockEntity, {}, {}};
+        int type{0};
+        bool go = true;
+        for (it->Seek(range.begin); go && it->Valid() && inRange(it->key(), range) && !this->cancel_; it->Next()) {
+            auto key = it->key();
+            if (key.size() == ACTOR_PREFIX_LEN + UID_LEN && key.starts_with("actorprefix")) {
+                if (!(kinds & Actor)) continue;
+                auto c = actor_chunks.find(readUid(key.data() + ACTOR_PREFIX_LEN));
+                record.kind = Actor;
+                record.cp = c == actor_chunks.end() ? bl::chunk_pos{0, 0, -1} : c->second;
+            } else if (parseChunkKeyPos(key.data(), key.size(), record.cp, type)) {
+                if (type == BlockEntityKey && (kinds & BlockEntity)) {
+                    record.kind = BlockEntity;
+                } else if (type == EntityKey && (kinds & Entity)) {
+                    record.kind = Entity;
+                } else {
+                    continue;
+                }
+            } else {
+                continue;
+            }
+            record.value = it->value();
+            go = fn(i, record);
+        }
+        if (!it->status().ok()) failed = true;
+        ++this->progress_;
+        return go && !this->cancel_ && !failed;
+    });
+    return !this->cancel_ && !failed;
+}
@@ -1,6 +1,9 @@
 #include "renderfilterdialog.h"
 
 #include <QColor>
+#include <algorithm>
+#include <string>
+#include <vector>
 
 #include "asynclevelloader.h"
 #include "color.h"
@@ -17,8 +20,39 @@ namespace {
         auto gray = static_cast<int>(static_cast<qreal>(height - min[dim]) / static_cast<qreal>(max[dim] - min[dim]) * 255.0);
         return {255 - gray, 255 - gray, 255 - gray};
     }
+
+    // FNV-1a
+    void hashBytes(uint64_t &h, const void *data, size_t len) {
+        const auto *p = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < len; i++) {
+            h ^= p[i];
+            h *= 1099511628211ull;
+        }
+    }
+
+    void hashStrings(uint64_t &h, const std::unordered_set<std::string> &set) {
+        // unordered_set的遍历顺序和插入的先后有关，排序之后再算
+        std::vector<std::string> items(set.begin(), set.end());
+        std::sort(items.begin(), items.end());
+        for (auto &item : items) hashBytes(h, item.c_str(), item.size() + 1);
+        hashBytes(h, "|", 1);
+    }
 }  // namespace
 
+uint64_t MapFilter::hash() const {
+    uint64_t h = 14695981039346656037ull;
+    std::vector<int> biomes(this->biomes_list_.begin(), this->biomes_list_.end());
+    std::sort(biomes.begin(), biomes.end());
+    for (auto b : biomes) hashBytes(h, &b, sizeof(b));
+    hashBytes(h, "|", 1);
+    hashStrings(h, this->blocks_list_);
+    hashStrings(h, this->actors_list_);
+    const int flags[]{this->enable_layer_ ? this->layer : INT32_MIN, this->biome_black_mode_, this->block_black_mode_,
+                      this->actor_black_mode_};
+    hashBytes(h, flags, sizeof(flags));
+    return h;
+}
+
 RenderFilterDialog::RenderFilterDialog(QWidget *parent) : QDialog(parent), ui(new Ui::RenderFilterDialog) {
     ui->setupUi(this);
     this->setWindowTitle("配置地图过滤器");
@@ -18,6 +18,7 @@
 #include <unordered_map>
 
 #include "bedrock_key.h"
+#include "memstats.h"
 
 namespace {
     QMap<QString, QImage *> actor_img_pool;
@@ -136,6 +137,15 @@ void initResources() {
         //        qDebug() << "NBT Icon: " << key;
         tag_icon_pool[key] = scale2(img);
     }
+
+    int64_t icon_bytes = 0;
+    for (auto *pool : {&actor_img_pool, &block_actor_icon_pool, &tag_icon_pool, &entity_icon_pool}) {
+        for (auto *img : *pool) icon_bytes += img->sizeInBytes();
+    }
+    for (auto *img : {unknown_img, village_dwellers_nbt, village_players_nbt, village_info_nbt, village_poi_nbt, player_nbt, other_nbt}) {
+        icon_bytes += img->sizeInBytes();
+    }
+    MemStats::set(MemStats::IconPools, icon_bytes);
 }
 
 void IconManager::init() {}
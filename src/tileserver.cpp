@@ -0,0 +1,262 @@
+#include "tileserver.h"
+
+#include <QBuffer>
+#include <QHostAddress>
+#include <QImage>
+#include <QPainter>
+#include <QRegularExpression>
+#include <QtDebug>
+
+#include "asynclevelloader.h"
+#include "mapwidget.h"
+
+namespace {
+    constexpr int MAX_REQUEST_SIZE = 8192;
+
+    int layerFromName(const QString &name) {
+        if (name == "biome") return MapWidget::Biome;
+        if (name == "terrain") return MapWidget::Terrain;
+        if (name == "height") return MapWidget::Height;
+        if (name == "slime") return AsyncLevelLoader::SLIME_LAYER;
+        return -1;
+    }
+
+    QByteArray headerValue(const QByteArray &request, const QByteArray &name) {
+        for (auto &line : request.split('\n')) {
+            auto idx = line.indexOf(':');
+            if (idx <= 0) continue;
+            if (line.left(idx).trimmed().toLower() == name) return line.mid(idx + 1).trimmed();
+        }
+        return {};
+    }
+}  // namespace
+
+QString TileServer::TileRequest::key() const {
+    return QString("%1/%2/%3/%4/%5").arg(QString::number(dim), QString::number(layer), QString::number(zoom), QString::number(x),
+                                         QString::number(y));
+}
+
+TileServer::TileServer(AsyncLevelLoader *loader, QObject *parent) : QObject(parent), loader_(loader) {
+    connect(&this->server_, &QTcpServer::newConnection, this, &TileServer::handleNewConnection);
+    connect(this->loader_, &AsyncLevelLoader::regionLoaded, this, &TileServer::handleRegionLoaded);
+    // 区域可能在等待期间被缓存淘汰，定时重试避免请求永远挂起
+    connect(&this->retry_timer_, &QTimer::timeout, this, &TileServer::retryPendingTiles);
+    this->retry_timer_.start(500);
+}
+
+TileServer::~TileServer() { this->close(); }
+
+bool TileServer::listen(quint16 port) {
+    if (this->server_.isListening()) this->server_.close();
+    auto ok = this->server_.listen(QHostAddress::LocalHost, port);
+    if (ok) {
+        qInfo() << "Tile server is listening on http://127.0.0.1:" << this->server_.serverPort();
+    } else {
+        qWarning() << "Can not start tile server: " << this->server_.errorString();
+    }
+    return ok;
+}
+
+void TileServer::close() {
+    this->server_.close();
+    for (auto it = this->buffers_.begin(); it != this->buffers_.end(); ++it) {
+        it.key()->disconnectFromHost();
+    }
+    this->buffers_.clear();
+    this->pending_.clear();
+    this->pending_regions_.clear();
+    this->png_cache_.clear();
+}
+
+void TileServer::handleNewConnection() {
+    while (this->server_.hasPendingConnections()) {
+        auto *socket = this->server_.nextPendingConnection();
+        this->buffers_.insert(socket, {});
+        connect(socket, &QTcpSocket::readyRead, this, &TileServer::handleReadyRead);
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket] {
+            this->buffers_.remove(socket);
+            socket->deleteLater();
+        });
+    }
+}
+
+void TileServer::handleReadyRead() {
+    auto *socket = qobject_cast<QTcpSocket *>(this->sender());
+    if (!socket || !this->buffers_.contains(socket)) return;
+    auto &buf = this->buffers_[socket];
+    buf += socket->readAll();
+    if (buf.size() > MAX_REQUEST_SIZE) {
+        writeResponse(socket, 413, "Payload Too Large", {});
+        return;
+    }
+    if (!buf.contains("\r\n\r\n")) return;  // 请求头还没收完
+
+    auto request = buf;
+    buf.clear();
+    auto request_line = request.left(request.indexOf("\r\n")).split(' ');
+    if (request_line.size() < 2) {
+        writeResponse(socket, 400, "Bad Request", {});
+        return;
+    }
+    if (request_line[0] != "GET") {
+        writeResponse(socket, 405, "Method Not Allowed", {}, "Allow: GET\r\n");
+        return;
+    }
+
+    TileRequest req;
+    if (!parsePath(QString::fromUtf8(request_line[1]), req)) {
+        writeResponse(socket, 404, "Not Found", {});
+        return;
+    }
+    if (!this->loader_->isOpen()) {
+        writeResponse(socket, 503, "Service Unavailable", {});
+        return;
+    }
+
+    auto if_none_match = headerValue(request, "if-none-match");
+    QByteArray etag;
+    if (this->tileReady(req, etag)) {
+        this->serveTile(req, etag, socket, if_none_match);
+        return;
+    }
+
+    // 还有区域没有加载完，挂起请求，相同瓦片的请求合并
+    auto key = req.key();
+    auto it = this->pending_.find(key);
+    if (it == this->pending_.end()) {
+        it = this->pending_.insert(key, PendingTile{req, {}});
+        for (auto &rp : this->tileRegions(req)) this->pending_regions_[rp].insert(key);
+    }
+    it->waiters.emplace_back(socket, if_none_match);
+}
+
+bool TileServer::parsePath(const QString &path, TileRequest &req) {
+    static const QRegularExpression re(R"(^/(\d+)/(\w+)/(-?\d+)/(-?\d+)/(-?\d+)\.png(\?.*)?$)");
+    auto m = re.match(path);
+    if (!m.hasMatch()) return false;
+    req.dim = m.captured(1).toInt();
+    req.layer = layerFromName(m.captured(2));
+    req.zoom = m.captured(3).toInt();
+    req.x = m.captured(4).toInt();
+    req.y = m.captured(5).toInt();
+    return req.dim >= 0 && req.dim <= 2 && req.layer >= 0 && req.zoom >= MIN_ZOOM && req.zoom <= NATIVE_ZOOM;
+}
+
+std::vector<region_pos> TileServer::tileRegions(const TileRequest &req) const {
+    const int n = 1 << (NATIVE_ZOOM - req.zoom);  // 瓦片边长(单位是区域)
+    std::vector<region_pos> res;
+    res.reserve(n * n);
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            res.emplace_back((req.x * n + i) * cfg::RW, (req.y * n + j) * cfg::RW, req.dim);
+        }
+    }
+    return res;
+}
+
+bool TileServer::tileReady(const TileRequest &req, QByteArray &etag) {
+    uint hash = qHash(req.key());
+    bool ready = true;
+    for (auto &rp : this->tileRegions(req)) {
+        // 未加载的区域会在这里被提交到线程池
+        auto *img = this->loader_->bakedLayerImage(rp, req.layer);
+        if (img == cfg::UNLOADED_REGION_IMAGE()) {
+            ready = false;
+            continue;
+        }
+        if (req.layer != AsyncLevelLoader::SLIME_LAYER) hash = 31 * hash + this->loader_->regionFingerprint(rp);
+    }
+    if (ready) etag = '"' + QByteArray::number(hash, 16) + '"';
+    return ready;
+}
+
+QByteArray TileServer::renderTile(const TileRequest &req) {
+    const int n = 1 << (NATIVE_ZOOM - req.zoom);
+    const int w = TILE_SIZE / n;
+    QImage tile(TILE_SIZE, TILE_SIZE, QImage::Format_ARGB32);
+    tile.fill(Qt::transparent);
+    {
+        QPainter painter(&tile);
+        for (auto &rp : this->tileRegions(req)) {
+            auto *img = this->loader_->bakedLayerImage(rp, req.layer);
+            if (!img || img == cfg::NULL_REGION_IMAGE() || img == cfg::UNLOADED_REGION_IMAGE()) continue;
+            const int x = (rp.x / cfg::RW - req.x * n) * w;
+            const int y = (rp.z / cfg::RW - req.y * n) * w;
+            painter.drawImage(QRect(x, y, w, w), *img, QRect(0, 0, img->width(), img->height()));
+        }
+    }
+    QByteArray png;
+    QBuffer buffer(&png);
+    buffer.open(QIODevice::WriteOnly);
+    tile.save(&buffer, "PNG");
+    return png;
+}
+
+void TileServer::serveTile(const TileRequest &req, const QByteArray &etag, QTcpSocket *socket, const QByteArray &if_none_match) {
+    const QByteArray headers = "ETag: " + etag + "\r\nCache-Control: no-cache\r\n";
+    if (!if_none_match.isEmpty() && if_none_match == etag) {
+        writeResponse(socket, 304, "Not Modified", {}, headers);
+        return;
+    }
+    auto *png = this->png_cache_.object(etag);
+    if (!png) {
+        png = new QByteArray(this->renderTile(req));
+        this->png_cache_.insert(etag, png);
+    }
+    writeResponse(socket, 200, "OK", *png, "Content-Type: image/png\r\n" + headers);
+}
+
+void TileServer::handleRegionLoaded(int x, int z, int dim) {
+    // 只检查包含这个区域的瓦片
+    auto it = this->pending_regions_.find(region_pos{x, z, dim});
+    if (it == this->pending_regions_.end()) return;
+    const auto keys = it->second;  // servePendingTile会修改索引
+    for (auto &key : keys) this->servePendingTile(key);
+}
+
+void TileServer::retryPendingTiles() {
+    if (this->pending_.isEmpty()) return;
+    if (!this->loader_->isOpen()) {
+        for (auto &p : this->pending_) {
+            for (auto &w : p.waiters) {
+                if (w.first) writeResponse(w.first, 503, "Service Unavailable", {});
+            }
+        }
+        this->pending_.clear();
+        this->pending_regions_.clear();
+        return;
+    }
+
+    const auto keys = this->pending_.keys();
+    for (auto &key : keys) this->servePendingTile(key);
+}
+
+bool TileServer::servePendingTile(const QString &key) {
+    auto it = this->pending_.find(key);
+    if (it == this->pending_.end()) return true;
+    QByteArray etag;
+    if (!this->tileReady(it->request, etag)) return false;
+    for (auto &w : it->waiters) {
+        if (w.first) this->serveTile(it->request, etag, w.first, w.second);
+    }
+    for (auto &rp : this->tileRegions(it->request)) {
+        auto r = this->pending_regions_.find(rp);
+        if (r == this->pending_regions_.end()) continue;
+        r->second.remove(key);
+        if (r->second.isEmpty()) this->pending_regions_.erase(r);
+    }
+    this->pending_.erase(it);
+    return true;
+}
+
+void TileServer::writeResponse(QTcpSocket *socket, int code, const QByteArray &status, const QByteArray &body,
+                               const QByteArray &extra_headers) {
+    QByteArray resp = "HTTP/1.1 " + QByteArray::number(code) + " " + status + "\r\n";
+    resp += "Access-Control-Allow-Origin: *\r\n";
+    resp += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    resp += extra_headers;
+    resp += "Connection: close\r\n\r\n";
+    resp += body;
+    socket->write(resp);
+    socket->disconnectFromHost();
+}
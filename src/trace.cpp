@@ -0,0 +1,134 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "json/json.hpp"
+
+std::atomic_bool Trace::enabled_{false};
+
+namespace {
+    constexpr size_t RING_SIZE = 1 << 15;  // 每个线程最多保留的事件数
+
+    // 导出时会和所属线程的写入同时发生，字段都用relaxed原子变量，x86上和普通读写一样
+    struct TraceEvent {
+        std::atomic<const char *> name{nullptr};
+        std::atomic<int64_t> ts{0};   // 微秒
+        std::atomic<int64_t> dur{0};  // 微秒
+    };
+
+    struct Snapshot {
+        const char *name;
+        int64_t ts;
+        int64_t dur;
+    };
+
+    struct ThreadBuffer {
+        int tid{0};
+        std::atomic<const char *> name{nullptr};
+        std::atomic<uint64_t> head{0};
+        std::array<TraceEvent, RING_SIZE> events{};
+    };
+
+    const Trace::Clock::time_point &traceEpoch() {
+        static const auto epoch = Trace::Clock::now();
+        return epoch;
+    }
+
+    std::mutex &registryMutex() {
+        static std::mutex mu;
+        return mu;
+    }
+
+    // 线程退出后缓冲区仍然保留，导出时还能看到线程池里已经结束的线程
+    std::vector<std::shared_ptr<ThreadBuffer>> &registry() {
+        static std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+        return buffers;
+    }
+
+    ThreadBuffer &localBuffer() {
+        thread_local std::shared_ptr<ThreadBuffer> buffer = [] {
+            auto b = std::make_shared<ThreadBuffer>();
+            std::lock_guard<std::mutex> lk(registryMutex());
+            b->tid = static_cast<int>(registry().size()) + 1;
+            registry().push_back(b);
+            return b;
+        }();
+        return *buffer;
+    }
+
+    int64_t toMicros(Trace::Clock::time_point t) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(t - traceEpoch()).count();
+    }
+}  // namespace
+
+void Trace::setEnabled(bool enable) {
+    traceEpoch();
+    enabled_ = enable;
+}
+
+void Trace::setThreadName(const char *name) { localBuffer().name = name; }
+
+void Trace::complete(const char *name, Clock::time_point begin, Clock::time_point end) {
+    if (!enabled()) return;
+    auto &b = localBuffer();
+    const auto h = b.head.load(std::memory_order_relaxed);
+    const auto ts = toMicros(begin);
+    // 导出线程读到这次写入的任何一个字段时，也一定能看到之前对head的更新
+    std::atomic_thread_fence(std::memory_order_release);
+    auto &e = b.events[h % RING_SIZE];
+    e.name.store(name, std::memory_order_relaxed);
+    e.ts.store(ts, std::memory_order_relaxed);
+    e.dur.store(toMicros(end) - ts, std::memory_order_relaxed);
+    b.head.store(h + 1, std::memory_order_release);
+}
+
+bool Trace::writeJson(const std::string &path) {
+    // 导出时其他线程可能还在写，复制完之后再读一次head，丢掉复制期间可能被覆盖的事件
+    nlohmann::json events = nlohmann::json::array();
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lk(registryMutex());
+        buffers = registry();
+    }
+    for (auto &b : buffers) {
+        const auto *name = b->name.load();
+        events.push_back({{"ph", "M"},
+                          {"name", "thread_name"},
+                          {"pid", 1},
+                          {"tid", b->tid},
+                          {"args", {{"name", name ? name : "worker " + std::to_string(b->tid)}}}});
+        const auto head = b->head.load(std::memory_order_acquire);
+        const auto first = head > RING_SIZE ? head - RING_SIZE : 0;
+        std::vector<Snapshot> copied;
+        copied.reserve(static_cast<size_t>(head - first));
+        for (auto i = first; i < head; i++) {
+            auto &e = b->events[i % RING_SIZE];
+            copied.push_back({e.name.load(std::memory_order_relaxed), e.ts.load(std::memory_order_relaxed),
+                              e.dur.load(std::memory_order_relaxed)});
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // 序号为now的事件可能正在写，它和序号now - RING_SIZE共用一个位置，序号不大于它的都不可信
+        const auto now = b->head.load(std::memory_order_relaxed);
+        const auto valid = now >= RING_SIZE ? now - RING_SIZE + 1 : 0;
+        for (auto i = std::max(first, valid); i < head; i++) {
+            const auto &e = copied[static_cast<size_t>(i - first)];
+            if (!e.name) continue;
+            events.push_back({{"ph", "X"}, {"name", e.name}, {"pid", 1}, {"tid", b->tid}, {"ts", e.ts}, {"dur", e.dur}});
+        }
+    }
+    std::ofstream f(std::filesystem::u8path(path));
+    if (!f.is_open()) return false;
+    f << nlohmann::json{{"traceEvents", events}, {"displayTimeUnit", "ms"}}.dump();
+    return f.good();
+}
+
+void Trace::clear() {
+    std::lock_guard<std::mutex> lk(registryMutex());
+    for (auto &b : registry()) b->head = 0;
+}
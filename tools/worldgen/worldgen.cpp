@@ -0,0 +1,518 @@
+// 生成确定性的基岩版测试存档，用于回归测试和性能测试
+// 相同的参数和种子总是写入相同的key和value
+// 用法见 docs/worldgen.md
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "leveldb/db.h"
+#include "leveldb/write_batch.h"
+#include "leveldb/zlib_compressor.h"
+
+namespace {
+    namespace fs = std::filesystem;
+
+    constexpr int32_t BLOCK_VERSION = 17959425;  // 1.19.1
+    constexpr uint8_t SUB_CHUNK_VERSION = 9;
+    constexpr uint8_t CHUNK_VERSION = 40;
+
+    // 区块key的类型
+    enum ChunkTag : uint8_t {
+        Data3D = 43,
+        Version = 44,
+        SubChunkPrefix = 47,
+        BlockEntity = 49,
+        Entity = 50,
+        FinalizedState = 54,
+    };
+
+    enum class ActorFormat { Old, New, Both };
+
+    struct Options {
+        std::string out;
+        uint64_t seed{0};
+        int radius{16};  // 每个维度生成 [-radius, radius) 范围的区块
+        std::vector<int> dims{0};
+        int sub_chunks{8};      // 每个区块从底部开始写入的子区块数量
+        int palette_size{8};    // 每个子区块的方块种类(包括空气)
+        int entities{2};        // 每个区块的实体数量
+        int block_entities{1};  // 每个区块的方块实体数量
+        ActorFormat actor_format{ActorFormat::Both};
+    };
+
+    // splitmix64，保证不同平台上的结果一致
+    class Random {
+       public:
+        explicit Random(uint64_t seed) : state_(seed) {}
+
+        uint64_t next() {
+            uint64_t z = (this->state_ += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            return z ^ (z >> 31);
+        }
+
+        int range(int lo, int hi) { return lo + static_cast<int>(this->next() % static_cast<uint64_t>(hi - lo + 1)); }
+
+        float real(float lo, float hi) { return lo + static_cast<float>(this->next() >> 40) / static_cast<float>(1ull << 24) * (hi - lo); }
+
+       private:
+        uint64_t state_;
+    };
+
+    uint64_t mix(uint64_t seed, int64_t a, int64_t b, int64_t c) {
+        Random r(seed ^ (static_cast<uint64_t>(a) * 0x9e3779b97f4a7c15ull) ^ (static_cast<uint64_t>(b) * 0xc2b2ae3d27d4eb4full) ^
+                 (static_cast<uint64_t>(c) * 0x165667b19e3779f9ull));
+        return r.next();
+    }
+
+    // 基岩版NBT(小端)
+    class NbtWriter {
+       public:
+        void begin(uint8_t type, const std::string &name) {
+            this->u8(type);
+            this->str(name);
+        }
+
+        void u8(uint8_t v) { this->out_.push_back(static_cast<char>(v)); }
+
+        void i16(int16_t v) { this->raw(&v, 2); }
+
+        void i32(int32_t v) { this->raw(&v, 4); }
+
+        void i64(int64_t v) { this->raw(&v, 8); }
+
+        void f32(float v) { this->raw(&v, 4); }
+
+        void str(const std::string &s) {
+            auto len = static_cast<uint16_t>(s.size());
+            this->raw(&len, 2);
+            this->out_ += s;
+        }
+
+        void list(const std::string &name, uint8_t type, int32_t count) {
+            this->begin(9, name);
+            this->u8(type);
+            this->i32(count);
+        }
+
+        void end() { this->u8(0); }
+
+        std::string &data() { return this->out_; }
+
+       private:
+        void raw(const void *p, size_t n) { this->out_.append(static_cast<const char *>(p), n); }
+
+        std::string out_;
+    };
+
+    void appendInt32(std::string &s, int32_t v) { s.append(reinterpret_cast<const char *>(&v), 4); }
+
+    void appendInt64(std::string &s, int64_t v) { s.append(reinterpret_cast<const char *>(&v), 8); }
+
+    std::string chunkKey(int x, int z, int dim, uint8_t tag) {
+        std::string key;
+        appendInt32(key, x);
+        appendInt32(key, z);
+        if (dim != 0) appendInt32(key, dim);
+        key.push_back(static_cast<char>(tag));
+        return key;
+    }
+
+    std::string digestKey(int x, int z, int dim) {
+        std::string key = "digp";
+        appendInt32(key, x);
+        appendInt32(key, z);
+        if (dim != 0) appendInt32(key, dim);
+        return key;
+    }
+
+    // 每个维度的子区块范围
+    void subChunkRange(int dim, int &min_index, int &max_index) {
+        if (dim == 0) {
+            min_index = -4, max_index = 19;
+        } else if (dim == 1) {
+            min_index = 0, max_index = 7;
+        } else {
+            min_index = 0, max_index = 15;
+        }
+    }
+
+    const std::vector<std::string> &blockNames() {
+        static const std::vector<std::string> names{
+            "minecraft:stone",    "minecraft:dirt",        "minecraft:grass",       "minecraft:sand",        "minecraft:gravel",
+            "minecraft:deepslate", "minecraft:cobblestone", "minecraft:andesite",    "minecraft:diorite",     "minecraft:granite",
+            "minecraft:coal_ore", "minecraft:iron_ore",    "minecraft:gold_ore",    "minecraft:diamond_ore", "minecraft:water",
+            "minecraft:oak_log",  "minecraft:oak_leaves",  "minecraft:clay",        "minecraft:sandstone",   "minecraft:netherrack",
+            "minecraft:end_stone", "minecraft:obsidian",   "minecraft:snow",        "minecraft:ice",         "minecraft:moss_block",
+            "minecraft:tuff",     "minecraft:calcite",     "minecraft:mud",         "minecraft:terracotta",  "minecraft:red_sand",
+            "minecraft:basalt",   "minecraft:blackstone",
+        };
+        return names;
+    }
+
+    const std::vector<std::string> &actorNames() {
+        static const std::vector<std::string> names{"minecraft:cow",    "minecraft:sheep",  "minecraft:pig",   "minecraft:zombie",
+                                                    "minecraft:skeleton", "minecraft:creeper", "minecraft:villager_v2", "minecraft:item"};
+        return names;
+    }
+
+    int bitsForPalette(int size) {
+        for (int bits : {1, 2, 3, 4, 5, 6, 8, 16}) {
+            if ((1 << bits) >= size) return bits;
+        }
+        return 16;
+    }
+
+    std::string blockPaletteEntry(const std::string &name) {
+        NbtWriter w;
+        w.begin(10, "");
+        w.begin(8, "name");
+        w.str(name);
+        w.begin(10, "states");
+        w.end();
+        w.begin(3, "version");
+        w.i32(BLOCK_VERSION);
+        w.end();
+        return w.data();
+    }
+
+    /**
+     * 生成一个子区块，低于surface的位置是实心方块，其余是空气
+     * 格式: version(1) storage_count(1) y_index(1) [header(1) words palette_size(4) palette...]
+     */
+    std::string subChunkData(const Options &opt, int cx, int cz, int dim, int y_index, const int surface[16][16]) {
+        std::string res;
+        res.push_back(static_cast<char>(SUB_CHUNK_VERSION));
+        res.push_back(1);
+        res.push_back(static_cast<char>(static_cast<int8_t>(y_index)));
+
+        const auto &names = blockNames();
+        const int palette_size = std::max(2, std::min<int>(opt.palette_size, static_cast<int>(names.size()) + 1));
+        const int bits = bitsForPalette(palette_size);
+        const int per_word = 32 / bits;
+        const int word_count = (4096 + per_word - 1) / per_word;
+        res.push_back(static_cast<char>(bits << 1));  // 最低位为0表示调色板是NBT格式
+
+        // 每个区块使用不同的方块子集，让调色板在整个存档中有变化
+        const auto offset = static_cast<size_t>(mix(opt.seed, cx, cz, dim * 64 + y_index) % names.size());
+        std::vector<uint32_t> words(word_count, 0);
+        for (int x = 0; x < 16; x++) {
+            for (int z = 0; z < 16; z++) {
+                for (int y = 0; y < 16; y++) {
+                    const int world_y = y_index * 16 + y;
+                    uint32_t idx = 0;
+                    if (world_y <= surface[x][z]) {
+                        idx = 1 + static_cast<uint32_t>(mix(opt.seed, cx * 16 + x, world_y, cz * 16 + z) % (palette_size - 1));
+                    }
+                    const int i = (x << 8) | (z << 4) | y;
+                    words[i / per_word] |= idx << ((i % per_word) * bits);
+                }
+            }
+        }
+        for (auto w : words) appendInt32(res, static_cast<int32_t>(w));
+        appendInt32(res, palette_size);
+        res += blockPaletteEntry("minecraft:air");
+        for (int i = 1; i < palette_size; i++) res += blockPaletteEntry(names[(offset + i - 1) % names.size()]);
+        return res;
+    }
+
+    // 高度图(相对维度最低高度) + 每个子区块的群系，群系全部使用单值调色板
+    std::string data3D(const Options &opt, int cx, int cz, int dim, const int surface[16][16]) {
+        int min_index{0}, max_index{0};
+        subChunkRange(dim, min_index, max_index);
+        const int min_y = min_index * 16;
+        std::string res;
+        for (int z = 0; z < 16; z++) {
+            for (int x = 0; x < 16; x++) {
+                auto h = static_cast<int16_t>(surface[x][z] + 1 - min_y);
+                res.append(reinterpret_cast<const char *>(&h), 2);
+            }
+        }
+        static const int overworld_biomes[]{1, 2, 4, 5, 6, 21, 24, 35};
+        const int biome = dim == 1 ? 8 : dim == 2 ? 9 : overworld_biomes[mix(opt.seed, cx >> 2, cz >> 2, 7) % 8];
+        for (int i = min_index; i <= max_index; i++) {
+            res.push_back(1);
+            appendInt32(res, biome);
+        }
+        return res;
+    }
+
+    std::string actorNbt(Random &r, int cx, int cz, int surface, int64_t uid) {
+        const auto &names = actorNames();
+        const auto &name = names[r.next() % names.size()];
+        NbtWriter w;
+        w.begin(10, "");
+        w.begin(8, "identifier");
+        w.str(name);
+        w.begin(4, "UniqueID");
+        w.i64(uid);
+        w.list("Pos", 5, 3);
+        w.f32(static_cast<float>(cx * 16) + r.real(0, 16));
+        w.f32(static_cast<float>(surface + 1));
+        w.f32(static_cast<float>(cz * 16) + r.real(0, 16));
+        w.list("Rotation", 5, 2);
+        w.f32(r.real(0, 360));
+        w.f32(0);
+        w.list("Motion", 5, 3);
+        w.f32(0);
+        w.f32(0);
+        w.f32(0);
+        w.list("definitions", 8, 1);
+        w.str("+" + name);
+        w.begin(1, "Persistent");
+        w.u8(1);
+        w.end();
+        return w.data();
+    }
+
+    std::string chestNbt(Random &r, int x, int y, int z) {
+        const auto &names = blockNames();
+        NbtWriter w;
+        w.begin(10, "");
+        w.begin(8, "id");
+        w.str("Chest");
+        w.begin(3, "x");
+        w.i32(x);
+        w.begin(3, "y");
+        w.i32(y);
+        w.begin(3, "z");
+        w.i32(z);
+        w.begin(1, "isMovable");
+        w.u8(1);
+        const int items = r.range(0, 27);
+        w.list("Items", 10, items);
+        for (int i = 0; i < items; i++) {
+            w.begin(1, "Count");
+            w.u8(static_cast<uint8_t>(r.range(1, 64)));
+            w.begin(2, "Damage");
+            w.i16(0);
+            w.begin(8, "Name");
+            w.str(names[r.next() % names.size()]);
+            w.begin(1, "Slot");
+            w.u8(static_cast<uint8_t>(i));
+            w.begin(1, "WasPickedUp");
+            w.u8(0);
+            w.end();
+        }
+        w.end();
+        return w.data();
+    }
+
+    struct Stats {
+        size_t chunks{0};
+        size_t sub_chunks{0};
+        size_t actors{0};
+        size_t block_entities{0};
+    };
+
+    void writeChunk(const Options &opt, int cx, int cz, int dim, leveldb::WriteBatch &batch, Stats &stats) {
+        int min_index{0}, max_index{0};
+        subChunkRange(dim, min_index, max_index);
+        const int top_index = std::min(max_index, min_index + std::max(1, opt.sub_chunks) - 1);
+
+        // 简单的起伏地形，最高不超过最上面一个子区块
+        int surface[16][16];
+        for (int x = 0; x < 16; x++) {
+            for (int z = 0; z < 16; z++) {
+                const int rough = static_cast<int>(mix(opt.seed, (cx * 16 + x) >> 3, (cz * 16 + z) >> 3, dim) % 12);
+                surface[x][z] = top_index * 16 + 15 - rough;
+            }
+        }
+
+        std::string version(1, static_cast<char>(CHUNK_VERSION));
+        batch.Put(chunkKey(cx, cz, dim, Version), version);
+        batch.Put(chunkKey(cx, cz, dim, Data3D), data3D(opt, cx, cz, dim, surface));
+        for (int y = min_index; y <= top_index; y++) {
+            auto key = chunkKey(cx, cz, dim, SubChunkPrefix);
+            key.push_back(static_cast<char>(static_cast<int8_t>(y)));
+            batch.Put(key, subChunkData(opt, cx, cz, dim, y, surface));
+            stats.sub_chunks++;
+        }
+        std::string finalized;
+        appendInt32(finalized, 2);
+        batch.Put(chunkKey(cx, cz, dim, FinalizedState), finalized);
+
+        Random r(mix(opt.seed, cx, cz, dim + 1024));
+        if (opt.block_entities > 0) {
+            std::string data;
+            for (int i = 0; i < opt.block_entities; i++) {
+                const int x = r.range(0, 15), z = r.range(0, 15);
+                data += chestNbt(r, cx * 16 + x, surface[x][z], cz * 16 + z);
+            }
+            batch.Put(chunkKey(cx, cz, dim, BlockEntity), data);
+            stats.block_entities += opt.block_entities;
+        }
+
+        if (opt.entities > 0) {
+            // 两种格式都要时按区块交替使用
+            const bool use_new = opt.actor_format == ActorFormat::New || (opt.actor_format == ActorFormat::Both && ((cx + cz) & 1));
+            std::string old_data, digest;
+            for (int i = 0; i < opt.entities; i++) {
+                const auto uid = static_cast<int64_t>(r.next() >> 1);
+                auto nbt = actorNbt(r, cx, cz, surface[8][8], uid);
+                if (use_new) {
+                    std::string uid_raw;
+                    appendInt64(uid_raw, uid);
+                    digest += uid_raw;
+                    batch.Put("actorprefix" + uid_raw, nbt);
+                } else {
+                    old_data += nbt;
+                }
+            }
+            if (use_new) {
+                batch.Put(digestKey(cx, cz, dim), digest);
+            } else {
+                batch.Put(chunkKey(cx, cz, dim, Entity), old_data);
+            }
+            stats.actors += opt.entities;
+        }
+        stats.chunks++;
+    }
+
+    bool writeLevelDat(const Options &opt) {
+        NbtWriter w;
+        w.begin(10, "");
+        w.begin(8, "LevelName");
+        w.str("BedrockMap worldgen " + std::to_string(opt.seed));
+        w.begin(4, "RandomSeed");
+        w.i64(static_cast<int64_t>(opt.seed));
+        w.begin(3, "StorageVersion");
+        w.i32(10);
+        w.begin(3, "NetworkVersion");
+        w.i32(575);
+        w.begin(3, "Generator");
+        w.i32(1);
+        w.begin(3, "GameType");
+        w.i32(1);
+        w.begin(3, "SpawnX");
+        w.i32(0);
+        w.begin(3, "SpawnY");
+        w.i32(64);
+        w.begin(3, "SpawnZ");
+        w.i32(0);
+        w.begin(4, "LastPlayed");
+        w.i64(0);  // 固定值，保证输出一致
+        w.list("lastOpenedWithVersion", 3, 5);
+        for (int v : {1, 19, 80, 0, 0}) w.i32(v);
+        w.end();
+
+        std::string header;
+        appendInt32(header, 10);
+        appendInt32(header, static_cast<int32_t>(w.data().size()));
+        std::ofstream f(fs::u8path(opt.out) / "level.dat", std::ios::binary);
+        if (!f.is_open()) return false;
+        f << header << w.data();
+        std::ofstream name(fs::u8path(opt.out) / "levelname.txt", std::ios::binary);
+        name << "BedrockMap worldgen " << opt.seed;
+        return true;
+    }
+
+    bool parseOptions(int argc, char *argv[], Options &opt) {
+        for (int i = 1; i + 1 < argc; i += 2) {
+            const std::string arg = argv[i];
+            const std::string value = argv[i + 1];
+            if (arg == "--out") {
+                opt.out = value;
+            } else if (arg == "--seed") {
+                opt.seed = std::stoull(value);
+            } else if (arg == "--radius") {
+                opt.radius = std::max(1, std::stoi(value));
+            } else if (arg == "--dims") {
+                opt.dims.clear();
+                for (char c : value) {
+                    if (c >= '0' && c <= '2') opt.dims.push_back(c - '0');
+                }
+            } else if (arg == "--sub-chunks") {
+                opt.sub_chunks = std::max(1, std::stoi(value));
+            } else if (arg == "--palette") {
+                opt.palette_size = std::max(2, std::stoi(value));
+            } else if (arg == "--entities") {
+                opt.entities = std::max(0, std::stoi(value));
+            } else if (arg == "--block-entities") {
+                opt.block_entities = std::max(0, std::stoi(value));
+            } else if (arg == "--actor-format") {
+                if (value == "old") {
+                    opt.actor_format = ActorFormat::Old;
+                } else if (value == "new") {
+                    opt.actor_format = ActorFormat::New;
+                } else if (value == "both") {
+                    opt.actor_format = ActorFormat::Both;
+                } else {
+                    return false;
+                }
+            } else {
+                return false;
+            }
+        }
+        return argc % 2 == 1 && !opt.out.empty() && !opt.dims.empty();
+    }
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    Options opt;
+    try {
+        if (!parseOptions(argc, argv, opt)) {
+            std::cerr << "Usage: bedrockmap_worldgen --out <dir> [--seed N] [--radius R] [--dims 012] [--sub-chunks N]\n"
+                         "                          [--palette N] [--entities N] [--block-entities N] [--actor-format old|new|both]"
+                      << std::endl;
+            return 1;
+        }
+    } catch (std::exception &e) {
+        std::cerr << "Invalid argument: " << e.what() << std::endl;
+        return 1;
+    }
+
+    std::error_code ec;
+    if (fs::exists(fs::u8path(opt.out) / "db", ec)) {
+        std::cerr << "Output directory already contains a world: " << opt.out << std::endl;
+        return 1;
+    }
+    fs::create_directories(fs::u8path(opt.out) / "db", ec);
+    if (ec || !writeLevelDat(opt)) {
+        std::cerr << "Can not write level.dat to " << opt.out << std::endl;
+        return 1;
+    }
+
+    // 和游戏使用相同的压缩方式，写缓冲足够大，避免后台合并影响输出
+    leveldb::Options options;
+    options.create_if_missing = true;
+    options.write_buffer_size = 64 * 1024 * 1024;
+    options.compressors[0] = new leveldb::ZlibCompressorRaw(-1);
+    options.compressors[1] = new leveldb::ZlibCompressor();
+    leveldb::DB *db{nullptr};
+    auto s = leveldb::DB::Open(options, (fs::u8path(opt.out) / "db").u8string(), &db);
+    if (!s.ok()) {
+        std::cerr << "Can not open db: " << s.ToString() << std::endl;
+        return 1;
+    }
+
+    Stats stats;
+    for (int dim : opt.dims) {
+        const int r = dim == 1 ? std::max(1, opt.radius / 8) : opt.radius;  // 下界按1:8缩小
+        for (int x = -r; x < r; x++) {
+            leveldb::WriteBatch batch;
+            for (int z = -r; z < r; z++) writeChunk(opt, x, z, dim, batch, stats);
+            s = db->Write(leveldb::WriteOptions(), &batch);
+            if (!s.ok()) break;
+        }
+        if (!s.ok()) break;
+    }
+    if (s.ok()) db->CompactRange(nullptr, nullptr);
+    delete db;
+    delete options.compressors[0];
+    delete options.compressors[1];
+    if (!s.ok()) {
+        std::cerr << "Write failed: " << s.ToString() << std::endl;
+        return 1;
+    }
+    std::cout << "Generated " << stats.chunks << " chunks, " << stats.sub_chunks << " sub chunks, " << stats.actors << " actors, "
+              << stats.block_entities << " block entities in " << opt.out << std::endl;
+    return 0;
+}